@@ -117,6 +117,7 @@ typedef enum _RESOURCE_ID {
 	RESOURCE_ID_MSR_SYSENTER_EIP,
 	RESOURCE_ID_MSR_SYSENTER_PAT,
 
+	RESOURCE_ID_MEMORY, /* guest memory ranges, any number of them */
 
 	RESOURCE_ID_END,
 	RESOURCE_ID_UNKNOWN
@@ -127,13 +128,23 @@ typedef enum {
 	POLICY_ENTRY_DISABLE,
 	POLICY_MAKE_IMMUTABLE,
 	POLICY_INIT_LOG,
-	POLICY_DEBUG
+	POLICY_DEBUG,
+	POLICY_INIT_STATS,
+	POLICY_LOG_EPOCH,
+	POLICY_CMD_DOORBELL,
+	POLICY_REPORT,
+	POLICY_CMD_RING_STOP,
+	POLICY_STATS_LATENCY
 } COMMAND_CODE;
 
 typedef enum {
 	POLICY_INFO_IDX_MASK = 0,
 	POLICY_INFO_IDX_CPU_MASK_1,
 	POLICY_INFO_IDX_CPU_MASK_2,
+	POLICY_INFO_IDX_LOG_INTERVAL, /* TSC cycles per log token, 0 = no limit */
+	POLICY_INFO_IDX_LOG_BURST,    /* log tokens a resource can save up */
+	POLICY_INFO_IDX_ADDR,         /* memory range guest virtual address */
+	POLICY_INFO_IDX_SIZE,         /* memory range size in bytes */
 
 	POLICY_INFO_IDX_MAX /* last */
 } POLICY_RESOUCE_INFO_IDX;
@@ -153,10 +164,18 @@ typedef enum {
 #define POLICY_INFO_SET_MASK(e, val) ((e)->resource_info[POLICY_INFO_IDX_MASK] = val)
 #define POLICY_INFO_SET_CPU_MASK_1(e, val) ((e)->resource_info[POLICY_INFO_IDX_CPU_MASK_1] = val)
 #define POLICY_INFO_SET_CPU_MASK_2(e, val) ((e)->resource_info[POLICY_INFO_IDX_CPU_MASK_2] = val)
+#define POLICY_INFO_SET_LOG_INTERVAL(e, val) ((e)->resource_info[POLICY_INFO_IDX_LOG_INTERVAL] = val)
+#define POLICY_INFO_SET_LOG_BURST(e, val) ((e)->resource_info[POLICY_INFO_IDX_LOG_BURST] = val)
+#define POLICY_INFO_SET_ADDR(e, val) ((e)->resource_info[POLICY_INFO_IDX_ADDR] = val)
+#define POLICY_INFO_SET_SIZE(e, val) ((e)->resource_info[POLICY_INFO_IDX_SIZE] = val)
 
 #define POLICY_INFO_GET_MASK(e) ((e)->resource_info[POLICY_INFO_IDX_MASK])
 #define POLICY_INFO_GET_CPU_MASK_1(e) ((e)->resource_info[POLICY_INFO_IDX_CPU_MASK_1])
 #define POLICY_INFO_GET_CPU_MASK_2(e) ((e)->resource_info[POLICY_INFO_IDX_CPU_MASK_2])
+#define POLICY_INFO_GET_LOG_INTERVAL(e) ((e)->resource_info[POLICY_INFO_IDX_LOG_INTERVAL])
+#define POLICY_INFO_GET_LOG_BURST(e) ((e)->resource_info[POLICY_INFO_IDX_LOG_BURST])
+#define POLICY_INFO_GET_ADDR(e) ((e)->resource_info[POLICY_INFO_IDX_ADDR])
+#define POLICY_INFO_GET_SIZE(e) ((e)->resource_info[POLICY_INFO_IDX_SIZE])
 
 typedef struct {
 	uint32_t	resource_id;
@@ -170,8 +189,28 @@ typedef struct {
 typedef struct {
 	char *log_addr;
 	uint32_t log_size;
+	uint32_t log_burst;    /* log rate limit of memory events */
+	uint64_t log_interval;
+	uint32_t log_flags;
+	uint32_t cmd_ring_size;
+	char *cmd_ring_addr;   /* optional cmd_ring_t */
+	uint32_t log_version;  /* LOG_RING_VERSION to ask for the v2 layout */
+	uint32_t log_num_of_cpus;
+	uint32_t log_num_records; /* v2 records per cpu, a power of 2 */
+	uint32_t log_num_pages;
+	char *log_page_list;   /* v2: gva of each page of the buffer, in order */
 } log_message_t;
 
+/* log_flags: log a write violation once per guest page until the agent
+* sends POLICY_LOG_EPOCH, repeated writes to a hot page are not logged
+*/
+#define LOG_FLAG_MEM_WRITE_ONCE 0x1
+
+typedef struct {
+	char *stats_addr;
+	uint32_t stats_size;
+} stats_message_t;
+
 typedef struct {
 	char *report_addr;
 	uint32_t report_size;
@@ -187,11 +226,80 @@ typedef struct {
 	union {
 		policy_update_rec_t policy_data[1];
 		log_message_t    log_param;
+		stats_message_t  stats_param;
 		report_message_t report_param;
 		debug_message_t  debug_param;
 	};
 } policy_message_t;
 
+/* POLICY_ENTRY_ENABLE and POLICY_ENTRY_DISABLE messages carry count records
+* in policy_data[], applied together. A message is never shorter than
+* sizeof(policy_message_t). With POLICY_MSG_STATUS set in count, a
+* uint32_t per record follows the records, the handler writes there
+* whether it applied the record.
+*/
+#define POLICY_MSG_MAX_RECORDS 256
+#define POLICY_MSG_SIZE(count) \
+	(__builtin_offsetof(policy_message_t, policy_data) \
+	 + (count) * sizeof(policy_update_rec_t))
+
+#define POLICY_MSG_STATUS 0x80000000 /* flag in count */
+
+/* status of a policy record, the agent sets POLICY_REC_PENDING */
+#define POLICY_REC_PENDING 0
+#define POLICY_REC_OK      1
+#define POLICY_REC_FAILED  2
+
+/* Command ring registered with POLICY_INIT_LOG. The agent is the only
+* producer, it fills slot[head % num_slots] and then advances head. The
+* handler drains it on the next exit of any cpu or on POLICY_CMD_DOORBELL,
+* and advances tail. head and tail only grow. Memory ranges are only
+* applied on the doorbell, they are translated in the address space of
+* the agent. POLICY_CMD_RING_STOP unregisters the ring, a ring sent with a
+* later POLICY_INIT_LOG replaces it.
+*/
+#define CMD_RING_SIGNATURE  0x474E4952 /* "RING" */
+#define CMD_RING_VERSION    2
+
+typedef struct {
+	uint32_t command; /* POLICY_ENTRY_ENABLE or POLICY_ENTRY_DISABLE */
+	uint32_t status;  /* POLICY_REC_*, written by the handler before tail */
+	policy_update_rec_t rec;
+} cmd_ring_slot_t;
+
+typedef struct {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t num_slots; /* power of 2 */
+	uint32_t slot_size; /* sizeof(cmd_ring_slot_t) */
+	uint64_t head __attribute__((aligned(64))); /* written by the agent */
+	uint64_t tail __attribute__((aligned(64))); /* written by the handler */
+	cmd_ring_slot_t slot[] __attribute__((aligned(64)));
+} cmd_ring_t;
+
+#define CMD_RING_SIZE(num_slots) \
+	(sizeof(cmd_ring_t) + (num_slots) * sizeof(cmd_ring_slot_t))
+
+/* reason of a record summarizing events dropped by the log rate limit:
+* qualification is the number of events not logged, gva the resource id
+* (0 for memory events)
+*/
+#define LOG_REASON_SUPPRESSED 0xFFFFFFFF
+
+/* Log ring protocol, in both layouts. Each cpu ring has one producer,
+* the handler on that cpu, and any number of readers that never write to
+* it. The seq_num of a record doubles as its sequence stamp:
+*
+* producer: store seq_num, release fence, store the other fields and
+*           valid, then store head = seq_num + 1 with release.
+* reader:   load head with acquire. For a seq below head, load seq_num of
+*           its slot with acquire, copy the record, read fence, load
+*           seq_num again. The copy is good if both loads return seq.
+*
+* A record below head is complete. The producer changes seq_num before
+* anything else when it writes the slot over, so a copy that saw any of
+* the new fields sees a new seq_num on the second load and is dropped.
+*/
 typedef union {
 	struct {
 		uint64_t seq_num; /* sequence number of this record */
@@ -208,6 +316,260 @@ typedef union {
 	} meta;
 } log_entry_t;
 
+/* Log buffer layout v2. The buffer starts with a header holding the head
+* of every cpu on a cache line of its own, the per cpu rings of
+* 64 byte records follow page aligned. The buffer need not be physically
+* contiguous: the agent sends the list of its pages in POLICY_INIT_LOG
+* instead of log_addr, and may send a new list later to resize the rings.
+* A handler that knows the layout writes the header, signature last.
+* Otherwise the agent falls back to a log_addr buffer in the v1 layout of
+* log_entry_t.
+*/
+#define LOG_RING_SIGNATURE  0x474F4C52 /* "RLOG" */
+#define LOG_RING_VERSION    2
+
+typedef struct {
+	uint64_t seq_num; /* sequence number of this record */
+	uint32_t reason;
+	uint32_t valid;
+	uint64_t qualification;
+	uint64_t rip;
+	uint64_t gva; /* GVA for the event and only valid for memory events */
+	uint64_t reserved[3];
+} __attribute__((aligned(64))) log_record_t;
+
+typedef struct {
+	uint64_t head; /* next sequence number */
+} __attribute__((aligned(64))) log_ring_head_t;
+
+typedef struct {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t num_of_cpus;
+	uint32_t num_records; /* per cpu, a power of 2 */
+	uint32_t record_size; /* sizeof(log_record_t) */
+	uint32_t ring_offset; /* offset of the ring of cpu 0 */
+	log_ring_head_t cpu_head[] __attribute__((aligned(64)));
+} log_ring_header_t;
+
+#define LOG_RING_OFFSET(num_of_cpus) \
+	((sizeof(log_ring_header_t) + (num_of_cpus) * sizeof(log_ring_head_t) \
+	  + PAGE_4KB - 1) & ~(PAGE_4KB - 1))
+
+#define LOG_RING_SIZE(num_of_cpus, num_records) \
+	(LOG_RING_OFFSET(num_of_cpus) \
+	 + (num_of_cpus) * (num_records) * sizeof(log_record_t))
+
+/* record returned by reads of /dev/ikgt_log, a page holds 64 of them */
+typedef struct {
+	uint32_t cpu;
+	uint32_t reason;
+	uint64_t seq_num;
+	uint64_t qualification;
+	uint64_t rip;
+	uint64_t gva;
+	uint64_t lost;  /* records of the cpu written over before this one */
+	uint64_t reserved[2];
+} log_dev_record_t;
+
+/* mmap() of /dev/ikgt_log. Offset LOG_DEV_CURSOR_PGOFF maps the cursor
+* page of the open file, read-write. From LOG_DEV_RING_PGOFF on the pages
+* of the v2 buffer are mapped read-only, header first, and the records
+* are read as in the log ring protocol above. A consumer stores there the
+* next record it reads of each cpu, read() moves the same cursors. When
+* the rings are resized, the signature in the mapped header is cleared
+* and the new rings have to be mapped again, starting from 0.
+* A consumer reading the mapped rings write()s to the file once it has
+* read them all; with mem_log_once, pages are logged again after that.
+* read() does so itself when it drains all the rings.
+*/
+#define LOG_DEV_CURSOR_PGOFF  0
+#define LOG_DEV_RING_PGOFF    1
+
+typedef struct {
+	uint32_t num_of_cpus;
+	uint32_t reserved;
+	uint64_t seq_num[]; /* next record to read of each cpu */
+} log_dev_cursor_t;
+
+#define LOG_DEV_CURSOR_SIZE(num_of_cpus) \
+	((sizeof(log_dev_cursor_t) + (num_of_cpus) * sizeof(uint64_t) \
+	  + PAGE_4KB - 1) & ~(PAGE_4KB - 1))
+
+/* limit of the pages of a v2 buffer */
+#define LOG_RING_MAX_PAGES (1 << 20)
+
+/* statistics page filled in by the handler and read by the agent without
+* a hypercall. The handler writes the header once the page is registered;
+* the agent must check signature and version before using the rest.
+*/
+#define STATS_PAGE_SIGNATURE  0x53544154 /* "STAT" */
+#define STATS_PAGE_VERSION    11
+
+typedef enum {
+	STATS_CPU_REG = 0,
+	STATS_CPU_MSR,
+
+	STATS_CR0,
+	STATS_CR0_ALLOW,
+	STATS_CR0_SKIP,
+	STATS_CR0_STICKY_ALLOW,
+	STATS_CR0_STICKY_SKIP,
+
+	STATS_CR4,
+	STATS_CR4_ALLOW,
+	STATS_CR4_SKIP,
+	STATS_CR4_STICKY_ALLOW,
+	STATS_CR4_STICKY_SKIP,
+
+	STATS_MSR,
+	STATS_MSR_ALLOW,
+	STATS_MSR_SKIP,
+	STATS_MSR_STICKY_ALLOW,
+	STATS_MSR_STICKY_SKIP,
+
+	STATS_MEM_READ,
+	STATS_MEM_WRITE,
+	STATS_MEM_EXEC,
+
+	STATS_CR0_SHADOW_HIT,  /* CR0 exits handled without reading CR0 */
+	STATS_CR0_SHADOW_MISS,
+	STATS_CR4_SHADOW_HIT,
+	STATS_CR4_SHADOW_MISS,
+
+	STATS_LOG_RECORD,
+	STATS_LOG_DROP, /* events to be logged while no log buffer is set */
+	STATS_LOG_SUPPRESSED, /* events over the log rate limit */
+	STATS_LOG_DEDUP, /* writes to a page already logged in the epoch */
+
+	/* large guest physical frames a permission update covers whole or
+	* only in part. This is alignment only; whether EPT actually maps a
+	* frame large is up to the monitor and not visible here.
+	*/
+	STATS_EPT_2M_ALIGNED,
+	STATS_EPT_2M_PARTIAL,
+	STATS_EPT_1G_ALIGNED,
+	STATS_EPT_1G_PARTIAL,
+
+	STATS_CMD_RING, /* policy records taken from the command ring */
+
+	STATS_MAX /* last */
+} stats_id_t;
+
+/* exit handling latency is measured per event type and phase */
+typedef enum {
+	STATS_EVENT_CR0 = 0,
+	STATS_EVENT_CR4,
+	STATS_EVENT_MSR,
+	STATS_EVENT_MEM,
+	STATS_EVENT_MSG,
+
+	STATS_EVENT_MAX /* last */
+} stats_event_t;
+
+typedef enum {
+	STATS_PHASE_READ = 0, /* reading guest state */
+	STATS_PHASE_EVAL,     /* policy evaluation */
+	STATS_PHASE_LOG,      /* log_event() */
+	STATS_PHASE_WRITE,    /* writing guest state back */
+	STATS_PHASE_TOTAL,    /* whole event handler */
+
+	STATS_PHASE_MAX /* last */
+} stats_phase_t;
+
+/* bucket n counts durations of [2^n, 2^(n+1)) TSC cycles, the last bucket
+* also everything longer
+*/
+#define STATS_LATENCY_BUCKETS 24
+
+/* counters of one cpu, only ever written by that cpu. Padded to a cache
+* line so that cpus do not share one.
+*/
+typedef struct {
+	uint64_t count[STATS_MAX];
+	uint64_t access_count[RESOURCE_ID_END]; /* policy hits by resource id */
+	/* reset generation access_count belongs to. A policy change of the
+	* resource starts a new one; the cpu drops its count on its next hit,
+	* so a count may still be from an older policy until then.
+	*/
+	uint32_t access_gen[RESOURCE_ID_END];
+} __attribute__((aligned(64))) stats_cpu_t;
+
+typedef struct {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t num_of_cpus;
+	uint32_t cpu_offset;    /* offset of the stats_cpu_t array */
+	uint32_t cpu_size;      /* sizeof(stats_cpu_t) */
+	uint32_t num_counters;  /* STATS_MAX */
+	uint32_t num_resources; /* RESOURCE_ID_END */
+	uint32_t cpus_per_page; /* STATS_CPUS_PER_PAGE */
+} stats_page_header_t;
+
+/* The handler maps the statistics page 4K page by page, so it need not be
+* physically contiguous but must be page aligned. The header has the first
+* page, then each page holds STATS_CPUS_PER_PAGE stats_cpu_t, none of them
+* crosses a page.
+*/
+#define STATS_CPUS_PER_PAGE  (PAGE_4KB / sizeof(stats_cpu_t))
+#define STATS_CPU_OFFSET(cpu) \
+	(PAGE_4KB * (1 + (cpu) / STATS_CPUS_PER_PAGE) \
+	 + ((cpu) % STATS_CPUS_PER_PAGE) * sizeof(stats_cpu_t))
+#define STATS_PAGE_SIZE(num_of_cpus) \
+	(PAGE_4KB * (1 + ((num_of_cpus) + STATS_CPUS_PER_PAGE - 1) / STATS_CPUS_PER_PAGE))
+
+/* POLICY_STATS_LATENCY fills the buffer of report_message_t with the
+* exit latency histograms, added up over all cpus. They are kept by the
+* handler instead of in the statistics page, where they would take ~5KB
+* per cpu.
+*/
+#define LATENCY_REPORT_SIGNATURE  0x5943544C /* "LTCY" */
+#define LATENCY_REPORT_VERSION    1
+
+typedef struct {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t num_events;    /* STATS_EVENT_MAX */
+	uint32_t num_phases;    /* STATS_PHASE_MAX */
+	uint32_t num_buckets;   /* STATS_LATENCY_BUCKETS */
+	uint32_t reserved;
+	uint64_t latency[STATS_EVENT_MAX][STATS_PHASE_MAX][STATS_LATENCY_BUCKETS];
+} latency_report_t;
+
+/* POLICY_REPORT fills the buffer of report_message_t with the policy in
+* force, so an agent loaded again can pick up where the last one stopped.
+* Entries that do not fit are counted in total_entries only. Memory ranges
+* are reported as the records the agent enabled, by guest virtual address.
+* The buffer need not be physically contiguous.
+*/
+#define REPORT_SIGNATURE  0x54524552 /* "RERT" */
+#define REPORT_VERSION    2
+
+#define REPORT_FLAG_IMMUTABLE 0x1
+
+typedef struct {
+	policy_update_rec_t rec;  /* as enabled by the agent */
+	uint32_t flags;           /* none defined */
+	uint32_t reserved;
+	uint64_t access_count;    /* policy hits on all cpus */
+} report_entry_t;
+
+typedef struct {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t entry_size;     /* sizeof(report_entry_t) */
+	uint32_t num_entries;    /* entries in the buffer */
+	uint32_t total_entries;  /* entries in force */
+	uint32_t num_counters;   /* STATS_MAX */
+	uint32_t reserved;
+	uint64_t counter[STATS_MAX];
+	report_entry_t entry[];
+} report_header_t;
+
+#define REPORT_SIZE(num_entries) \
+	(sizeof(report_header_t) + (num_entries) * sizeof(report_entry_t))
+
 /* each page is 4K size */
 #ifndef PAGE_4KB
 #define PAGE_4KB 4096
@@ -216,6 +578,9 @@ typedef union {
 /* two 4K-pages for log data per cpu */
 #define LOG_PAGES_PER_CPU  2
 
+/* v2 records per cpu in LOG_PAGES_PER_CPU */
+#define LOG_RING_RECORDS ((LOG_PAGES_PER_CPU * PAGE_4KB) / sizeof(log_record_t))
+
 /* # of entries per cpu: */
 #define ENTRIES_PER_CPU ((LOG_PAGES_PER_CPU * PAGE_4KB) / sizeof(log_entry_t))
 
@@ -236,7 +601,7 @@ static inline uint64_t get_last_seq_num(log_entry_t cpu_log_buffer_start[])
 
 	meta_entry = &cpu_log_buffer_start[0];
 
-	return meta_entry->meta.head;
+	return __atomic_load_n(&meta_entry->meta.head, __ATOMIC_ACQUIRE);
 }
 
 #endif /* _POLICY_COMMON_H */
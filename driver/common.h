@@ -83,6 +83,23 @@ static inline struct group_node *to_node(struct config_item *item)
 	return count; \
 }
 
+/* as IKGT_UINT32_STORE, refused once the item is locked */
+#define IKGT_UINT32_STORE_LOCKED(__s, __name)	\
+	static ssize_t __s##_store_##__name(struct __s *item, \
+	const char *page, \
+	size_t count) \
+{ \
+	unsigned long value;\
+	\
+	if (item->locked) \
+	return -EPERM; \
+	if (kstrtoul(page, 0, &value)) \
+	return -EINVAL; \
+	item->__name = value; \
+	\
+	return count; \
+}
+
 #define IKGT_ULONG_HEX_SHOW(__s, __name)	\
 	static ssize_t __s##_show_##__name(struct __s *item, \
 	char *page) \
@@ -114,6 +131,8 @@ struct cr0_cfg {
 	bool locked;
 	policy_action_w write;
 	unsigned long sticky_value;
+	uint32_t log_rate;  /* logged events per second, 0 = no limit */
+	uint32_t log_burst;
 };
 
 struct cr4_cfg {
@@ -122,6 +141,8 @@ struct cr4_cfg {
 	bool locked;
 	policy_action_w write;
 	unsigned long sticky_value;
+	uint32_t log_rate;  /* logged events per second, 0 = no limit */
+	uint32_t log_burst;
 };
 
 struct msr_cfg {
@@ -130,6 +151,21 @@ struct msr_cfg {
 	bool locked;
 	policy_action_w write;
 	unsigned long sticky_value;
+	uint32_t log_rate;  /* logged events per second, 0 = no limit */
+	uint32_t log_burst;
+};
+
+struct mem_cfg {
+	struct config_item item;
+	bool enable;
+	bool locked;        /* range settings are in use by the handler */
+	unsigned long addr; /* guest virtual address */
+	unsigned long size;
+	policy_action_r read;
+	policy_action_w write;
+	policy_action_x exec;
+	uint32_t log_rate;  /* logged events per second, 0 = no limit */
+	uint32_t log_burst;
 };
 
 typedef struct _name_value_map {
@@ -141,4 +177,8 @@ typedef struct _name_value_map {
 
 void ikgt_debug(uint64_t parameter);
 
+uint64_t log_rate_to_interval(uint32_t rate);
+
+uint32_t log_interval_to_rate(uint64_t interval);
+
 #endif /* _COMMON_H */
@@ -17,6 +17,7 @@
 #include <linux/slab.h>
 
 #include "common.h"
+#include "policy.h"
 
 
 extern struct configfs_subsystem *create_log_node(void);
@@ -24,6 +25,7 @@ extern struct config_item_type *get_cr0_children_type(void);
 extern struct config_item_type *get_cr4_children_type(void);
 extern struct config_item_type *get_msr_children_type(void);
 extern struct config_item_type *get_log_children_type(void);
+extern struct config_item_type *get_memory_children_type(void);
 
 /* ----------------------------------------------------------------- */
 /* Creates configfs nodes for various cpu assets to enable
@@ -40,6 +42,7 @@ extern struct config_item_type *get_log_children_type(void);
 #define GROUP_NAME_CR4       "cr4"
 #define GROUP_NAME_MSR       "msr"
 #define GROUP_NAME_LOG       "log"
+#define GROUP_NAME_MEMORY    "memory"
 
 static struct config_group *group_children_make_group(struct config_group *group,
 													  const char *name)
@@ -65,6 +68,9 @@ static struct config_group *group_children_make_group(struct config_group *group
 	} else if (strcasecmp(name, GROUP_NAME_LOG) == 0) {
 		config_group_init_type_name(&cfg->group, name,
 			get_log_children_type());
+	} else if (strcasecmp(name, GROUP_NAME_MEMORY) == 0) {
+		config_group_init_type_name(&cfg->group, name,
+			get_memory_children_type());
 	}
 
 	return &cfg->group;
@@ -76,8 +82,16 @@ static struct configfs_attribute group_children_attr_description = {
 	.ca_mode	= S_IRUGO,
 };
 
+/* while 1, enable writes are queued and sent together once 0 is written */
+static struct configfs_attribute group_children_attr_batch = {
+	.ca_owner	= THIS_MODULE,
+	.ca_name	= "batch",
+	.ca_mode	= S_IRUGO | S_IWUSR,
+};
+
 static struct configfs_attribute *group_children_attrs[] = {
 	&group_children_attr_description,
+	&group_children_attr_batch,
 	NULL,
 };
 
@@ -85,14 +99,41 @@ static ssize_t group_children_attr_show(struct config_item *item,
 struct configfs_attribute *attr,
 	char *page)
 {
+	if (attr == &group_children_attr_batch)
+		return sprintf(page, "%u\n", policy_batch_is_open());
+
 	return sprintf(page,
 		DRIVER_NAME"\n"
 		"These file subsystem allows to create groups for various cpu assets.\n"
-		"These groups can be cr0, cr4, msr, log, etc.\n");
+		"These groups can be cr0, cr4, msr, memory, log, etc.\n");
+}
+
+static ssize_t group_children_attr_store(struct config_item *item,
+struct configfs_attribute *attr,
+	const char *page, size_t count)
+{
+	unsigned long value;
+
+	if (attr != &group_children_attr_batch)
+		return -EINVAL;
+
+	if (kstrtoul(page, 0, &value))
+		return -EINVAL;
+
+	if (value) {
+		if (!policy_batch_begin())
+			return -ENOMEM;
+	} else {
+		if (!policy_batch_end())
+			return -EIO;
+	}
+
+	return count;
 }
 
 static struct configfs_item_operations group_children_item_ops = {
 	.show_attribute = group_children_attr_show,
+	.store_attribute = group_children_attr_store,
 };
 
 
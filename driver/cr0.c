@@ -15,6 +15,7 @@
 #include <linux/module.h>
 #include "ikgt_api.h"
 #include "common.h"
+#include "policy.h"
 
 static name_value_map cr0_bits[] = {
 	{ "PE", PE, RESOURCE_ID_CR0_PE},
@@ -55,16 +56,24 @@ CONFIGFS_ATTR_STRUCT(cr0_cfg);
 IKGT_UINT32_SHOW(cr0_cfg, enable);
 IKGT_UINT32_HEX_SHOW(cr0_cfg, write);
 IKGT_ULONG_HEX_SHOW(cr0_cfg, sticky_value);
+IKGT_UINT32_SHOW(cr0_cfg, log_rate);
+IKGT_UINT32_SHOW(cr0_cfg, log_burst);
+IKGT_UINT32_STORE_LOCKED(cr0_cfg, log_rate);
+IKGT_UINT32_STORE_LOCKED(cr0_cfg, log_burst);
 
 /* attributes */
 IKGT_CONFIGFS_ATTR_RW(cr0_cfg, enable);
 IKGT_CONFIGFS_ATTR_RW(cr0_cfg, write);
 IKGT_CONFIGFS_ATTR_RW(cr0_cfg, sticky_value);
+IKGT_CONFIGFS_ATTR_RW(cr0_cfg, log_rate);
+IKGT_CONFIGFS_ATTR_RW(cr0_cfg, log_burst);
 
 static struct configfs_attribute *cr0_cfg_attrs[] = {
 	&cr0_cfg_attr_enable.attr,
 	&cr0_cfg_attr_write.attr,
 	&cr0_cfg_attr_sticky_value.attr,
+	&cr0_cfg_attr_log_rate.attr,
+	&cr0_cfg_attr_log_burst.attr,
 	NULL,
 };
 
@@ -84,6 +93,23 @@ static int valid_cr0_attr(const char *name)
 	return -1;
 }
 
+/* the settings are taken once the handler applied them */
+static void cr0_cfg_done(struct config_item *item, uint32_t command,
+						 const policy_update_rec_t *rec, bool accepted)
+{
+	struct cr0_cfg *cr0_cfg = to_cr0_cfg(item);
+
+	if (!accepted) {
+		PRINTK_ERROR("%s: not applied by the handler\n", item->ci_name);
+		return;
+	}
+
+	cr0_cfg->enable = (POLICY_ENTRY_ENABLE == command);
+
+	if (POLICY_GET_WRITE_ACTION(rec) & POLICY_ACT_STICKY)
+		cr0_cfg->locked = true;
+}
+
 /*-------------------------------------------------------*
 *  Function      : policy_set_cr0()
 *  Purpose: send the CR0 policy settings to handler
@@ -92,24 +118,14 @@ static int valid_cr0_attr(const char *name)
 *-------------------------------------------------------*/
 static bool policy_set_cr0(struct cr0_cfg *cr0_cfg, bool enable)
 {
-	policy_message_t *msg = NULL;
-	policy_update_rec_t *entry = NULL;
-	ikgt_result_t ret;
-	uint32_t size;
+	policy_update_rec_t rec;
+	policy_update_rec_t *entry = &rec;
 	int idx = valid_cr0_attr(cr0_cfg->item.ci_name);
 
 	if (idx < 0)
 		return false;
 
-	size = sizeof(policy_message_t);
-	msg = (policy_message_t *) kzalloc(size, GFP_KERNEL);
-	if (msg == NULL)
-		return false;
-
-	msg->command = enable?POLICY_ENTRY_ENABLE:POLICY_ENTRY_DISABLE;
-	msg->count = 1;
-
-	entry = &msg->policy_data[0];
+	memset(&rec, 0, sizeof(rec));
 
 	POLICY_SET_RESOURCE_ID(entry, cr0_bits[idx].res_id);
 	POLICY_SET_WRITE_ACTION(entry, cr0_cfg->write);
@@ -120,14 +136,14 @@ static bool policy_set_cr0(struct cr0_cfg *cr0_cfg, bool enable)
 	POLICY_INFO_SET_CPU_MASK_1(entry, -1);
 	POLICY_INFO_SET_CPU_MASK_2(entry, -1);
 
+	POLICY_INFO_SET_LOG_INTERVAL(entry, log_rate_to_interval(cr0_cfg->log_rate));
+	POLICY_INFO_SET_LOG_BURST(entry, cr0_cfg->log_burst);
+
 	PRINTK_INFO("cpumask: %llx, %llx\n",
 		POLICY_INFO_GET_CPU_MASK_1(entry), POLICY_INFO_GET_CPU_MASK_2(entry));
 
-	ret = ikgt_hypercall(IKGT_POLICY_MSG, (char *)msg, NULL);
-
-	kfree(msg);
-
-	return (ret == SUCCESS)?true:false;
+	return policy_send_record(enable?POLICY_ENTRY_ENABLE:POLICY_ENTRY_DISABLE,
+		&rec, &cr0_cfg->item, cr0_cfg_done);
 }
 
 static ssize_t cr0_cfg_store_write(struct cr0_cfg *cr0_cfg,
@@ -169,7 +185,6 @@ static ssize_t cr0_cfg_store_enable(struct cr0_cfg *cr0_cfg,
 									size_t count)
 {
 	unsigned long value;
-	bool ret = false;
 
 	if (kstrtoul(page, 0, &value))
 		return -EINVAL;
@@ -179,14 +194,8 @@ static ssize_t cr0_cfg_store_enable(struct cr0_cfg *cr0_cfg,
 		return -EPERM;
 	}
 
-	ret = policy_set_cr0(cr0_cfg, value);
-
-	if (ret) {
-		cr0_cfg->enable = value;
-	}
-
-	if (ret && (cr0_cfg->write & POLICY_ACT_STICKY))
-		cr0_cfg->locked = true;
+	if (!policy_set_cr0(cr0_cfg, value))
+		return -EIO;
 
 	return count;
 }
@@ -213,6 +222,7 @@ static struct config_item *cr0_make_item(struct config_group *group,
 										 const char *name)
 {
 	struct cr0_cfg *cr0_cfg;
+	policy_update_rec_t rec;
 
 	PRINTK_INFO("create attr name %s\n", name);
 
@@ -229,6 +239,15 @@ static struct config_item *cr0_make_item(struct config_group *group,
 	config_item_init_type_name(&cr0_cfg->item, name,
 		&cr0_cfg_type);
 
+	/* still enabled in the handler from an earlier load of the agent */
+	if (policy_report_restore(cr0_bits[valid_cr0_attr(name)].res_id, &rec,
+		&cr0_cfg->locked)) {
+		cr0_cfg->enable = true;
+		cr0_cfg->write = POLICY_GET_WRITE_ACTION(&rec);
+		cr0_cfg->sticky_value = POLICY_GET_STICKY_VALUE(&rec);
+		cr0_cfg->log_rate = log_interval_to_rate(POLICY_INFO_GET_LOG_INTERVAL(&rec));
+		cr0_cfg->log_burst = POLICY_INFO_GET_LOG_BURST(&rec);
+	}
 
 	return &cr0_cfg->item;
 }
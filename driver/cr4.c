@@ -15,6 +15,7 @@
 #include <linux/module.h>
 #include "ikgt_api.h"
 #include "common.h"
+#include "policy.h"
 
 static name_value_map cr4_bits[] = {
 	{"VME",        VME,        RESOURCE_ID_CR4_VME},
@@ -61,16 +62,24 @@ CONFIGFS_ATTR_STRUCT(cr4_cfg);
 IKGT_UINT32_SHOW(cr4_cfg, enable);
 IKGT_UINT32_HEX_SHOW(cr4_cfg, write);
 IKGT_ULONG_HEX_SHOW(cr4_cfg, sticky_value);
+IKGT_UINT32_SHOW(cr4_cfg, log_rate);
+IKGT_UINT32_SHOW(cr4_cfg, log_burst);
+IKGT_UINT32_STORE_LOCKED(cr4_cfg, log_rate);
+IKGT_UINT32_STORE_LOCKED(cr4_cfg, log_burst);
 
 /* attributes */
 IKGT_CONFIGFS_ATTR_RW(cr4_cfg, enable);
 IKGT_CONFIGFS_ATTR_RW(cr4_cfg, write);
 IKGT_CONFIGFS_ATTR_RW(cr4_cfg, sticky_value);
+IKGT_CONFIGFS_ATTR_RW(cr4_cfg, log_rate);
+IKGT_CONFIGFS_ATTR_RW(cr4_cfg, log_burst);
 
 static struct configfs_attribute *cr4_cfg_attrs[] = {
 	&cr4_cfg_attr_enable.attr,
 	&cr4_cfg_attr_write.attr,
 	&cr4_cfg_attr_sticky_value.attr,
+	&cr4_cfg_attr_log_rate.attr,
+	&cr4_cfg_attr_log_burst.attr,
 	NULL,
 };
 
@@ -90,26 +99,33 @@ static int valid_cr4_attr(const char *name)
 	return -1;
 }
 
+/* the settings are taken once the handler applied them */
+static void cr4_cfg_done(struct config_item *item, uint32_t command,
+						 const policy_update_rec_t *rec, bool accepted)
+{
+	struct cr4_cfg *cr4_cfg = to_cr4_cfg(item);
+
+	if (!accepted) {
+		PRINTK_ERROR("%s: not applied by the handler\n", item->ci_name);
+		return;
+	}
+
+	cr4_cfg->enable = (POLICY_ENTRY_ENABLE == command);
+
+	if (POLICY_GET_WRITE_ACTION(rec) & POLICY_ACT_STICKY)
+		cr4_cfg->locked = true;
+}
+
 static bool policy_set_cr4(struct cr4_cfg *cr4_cfg, bool enable)
 {
-	policy_message_t *msg = NULL;
-	policy_update_rec_t *entry = NULL;
-	ikgt_result_t ret;
-	uint32_t size;
+	policy_update_rec_t rec;
+	policy_update_rec_t *entry = &rec;
 	int idx = valid_cr4_attr(cr4_cfg->item.ci_name);
 
 	if (idx < 0)
 		return false;
 
-	size = sizeof(policy_message_t);
-	msg = (policy_message_t *) kzalloc(size, GFP_KERNEL);
-	if (msg == NULL)
-		return false;
-
-	msg->command = enable?POLICY_ENTRY_ENABLE:POLICY_ENTRY_DISABLE;
-	msg->count = 1;
-
-	entry = &msg->policy_data[0];
+	memset(&rec, 0, sizeof(rec));
 
 	POLICY_SET_RESOURCE_ID(entry, cr4_bits[idx].res_id);
 	POLICY_SET_WRITE_ACTION(entry, cr4_cfg->write);
@@ -121,14 +137,14 @@ static bool policy_set_cr4(struct cr4_cfg *cr4_cfg, bool enable)
 	POLICY_INFO_SET_CPU_MASK_1(entry, -1);
 	POLICY_INFO_SET_CPU_MASK_2(entry, -1);
 
+	POLICY_INFO_SET_LOG_INTERVAL(entry, log_rate_to_interval(cr4_cfg->log_rate));
+	POLICY_INFO_SET_LOG_BURST(entry, cr4_cfg->log_burst);
+
 	PRINTK_INFO("cpumask: %llx, %llx\n",
 		POLICY_INFO_GET_CPU_MASK_1(entry), POLICY_INFO_GET_CPU_MASK_2(entry));
 
-	ret = ikgt_hypercall(IKGT_POLICY_MSG, (char *)msg, NULL);
-
-	kfree(msg);
-
-	return (ret == SUCCESS)?true:false;
+	return policy_send_record(enable?POLICY_ENTRY_ENABLE:POLICY_ENTRY_DISABLE,
+		&rec, &cr4_cfg->item, cr4_cfg_done);
 }
 
 static ssize_t cr4_cfg_store_write(struct cr4_cfg *cr4_cfg,
@@ -170,7 +186,6 @@ static ssize_t cr4_cfg_store_enable(struct cr4_cfg *cr4_cfg,
 									size_t count)
 {
 	unsigned long value;
-	bool ret = false;
 
 	if (kstrtoul(page, 0, &value))
 		return -EINVAL;
@@ -179,14 +194,8 @@ static ssize_t cr4_cfg_store_enable(struct cr4_cfg *cr4_cfg,
 		return -EPERM;
 	}
 
-	ret = policy_set_cr4(cr4_cfg, value);
-
-	if (ret) {
-		cr4_cfg->enable = value;
-	}
-
-	if (ret && (cr4_cfg->write & POLICY_ACT_STICKY))
-		cr4_cfg->locked = true;
+	if (!policy_set_cr4(cr4_cfg, value))
+		return -EIO;
 
 	return count;
 }
@@ -214,6 +223,7 @@ static struct config_item *cr4_make_item(struct config_group *group,
 										 const char *name)
 {
 	struct cr4_cfg *cr4_cfg;
+	policy_update_rec_t rec;
 
 	PRINTK_INFO("CR4 create attribute file %s\n", name);
 
@@ -230,6 +240,16 @@ static struct config_item *cr4_make_item(struct config_group *group,
 	config_item_init_type_name(&cr4_cfg->item, name,
 		&cr4_cfg_type);
 
+	/* still enabled in the handler from an earlier load of the agent */
+	if (policy_report_restore(cr4_bits[valid_cr4_attr(name)].res_id, &rec,
+		&cr4_cfg->locked)) {
+		cr4_cfg->enable = true;
+		cr4_cfg->write = POLICY_GET_WRITE_ACTION(&rec);
+		cr4_cfg->sticky_value = POLICY_GET_STICKY_VALUE(&rec);
+		cr4_cfg->log_rate = log_interval_to_rate(POLICY_INFO_GET_LOG_INTERVAL(&rec));
+		cr4_cfg->log_burst = POLICY_INFO_GET_LOG_BURST(&rec);
+	}
+
 	return &cr4_cfg->item;
 }
 
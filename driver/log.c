@@ -13,6 +13,10 @@
 */
 
 #include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <asm/tsc.h>
 
 #include "common.h"
 #include "policy_common.h"
@@ -32,10 +36,61 @@ static uint32_t num_of_cpus;
 static bool is_logging_running;
 static log_entry_t *log_data_gva;
 
+/* log buffer in the v2 layout, allocated a page at a time */
+struct log_ring {
+	uint32_t num_pages;
+	uint32_t num_records;  /* per cpu */
+	struct page **pages;
+	uint64_t *page_list;   /* gva of each page, sent to the handler */
+};
+
+/* ring the handler writes, NULL while it writes the v1 layout. A resized
+* ring replaces it, the old one is kept until the next resize as the
+* handler may still be finishing a record in it.
+*/
+static struct log_ring *log_ring;
+static struct log_ring *log_ring_old;
+
+/* serializes readers of the log with a resize */
+static DEFINE_MUTEX(log_lock);
+
+/* bumped by a resize, sequence numbers start again from 0 */
+static uint32_t log_generation;
+
+static int log_pages_per_cpu_set(const char *val, const struct kernel_param *kp);
+
+static struct kernel_param_ops log_pages_per_cpu_ops = {
+	.set = log_pages_per_cpu_set,
+	.get = param_get_uint,
+};
+
+/* size of the v2 ring of each cpu, the rings are resized when written */
+#define LOG_MAX_PAGES_PER_CPU 4096
+static uint log_pages_per_cpu = LOG_PAGES_PER_CPU;
+module_param_cb(log_pages_per_cpu, &log_pages_per_cpu_ops, &log_pages_per_cpu,
+	S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(log_pages_per_cpu, "4K pages of log records per cpu, a power of 2");
+
+/* log rate limit of memory write events */
+static uint mem_log_rate;
+module_param(mem_log_rate, uint, S_IRUGO);
+MODULE_PARM_DESC(mem_log_rate, "logged memory events per second and cpu, 0 = no limit");
+
+static uint mem_log_burst = 64;
+module_param(mem_log_burst, uint, S_IRUGO);
+MODULE_PARM_DESC(mem_log_burst, "memory events logged in a burst above mem_log_rate");
+
+static bool mem_log_once;
+module_param(mem_log_once, bool, S_IRUGO);
+MODULE_PARM_DESC(mem_log_once, "log writes to a page once until log.txt or /dev/ikgt_log is read");
+
 #define MAX_SENTINEL_SIZE  64
 #define MAX_ELLIPSIS_SIZE  4
 #define MAX_CONFIGFS_PAGE_SIZE  (PAGE_4KB - MAX_SENTINEL_SIZE - MAX_ELLIPSIS_SIZE - 1)
 
+/* records read for one page of log.txt, no line is shorter than 12 chars */
+#define LOG_DUMP_MAX_RECORDS  (MAX_CONFIGFS_PAGE_SIZE / 12)
+
 
 static struct configfs_attribute log_children_attr_description = {
 	.ca_owner	= THIS_MODULE,
@@ -53,7 +108,13 @@ static ssize_t log_children_attr_show(struct config_item *item,
 struct configfs_attribute *attr,
 	char *page)
 {
-	return dump_log(page);
+	int ret;
+
+	mutex_lock(&log_lock);
+	ret = dump_log(page);
+	mutex_unlock(&log_lock);
+
+	return ret;
 }
 
 static void log_children_release(struct config_item *item)
@@ -107,6 +168,27 @@ static int log_add_msg_to_configfs(char *configfs_page, char *msg,
 	return 0;
 }
 
+/* copies a v1 entry written before head, false if it is not there or
+* was written over during the copy. See the protocol in policy_common.h.
+*/
+static bool log_entry_copy(log_entry_t *entry, log_entry_t *result, uint64_t head)
+{
+	uint64_t seq_num = smp_load_acquire(&entry->data.seq_num);
+
+	if (seq_num >= head)
+		return false;
+
+	*result = *entry;
+	smp_rmb();
+
+	if (!result->data.valid || (READ_ONCE(entry->data.seq_num) != seq_num))
+		return false;
+
+	result->data.seq_num = seq_num;
+
+	return true;
+}
+
 /*
 *   IN cpu_log_buffer: start of the per cpu log buffer
 *   OUTPUT results: event contents copy to
@@ -116,8 +198,8 @@ static int log_add_msg_to_configfs(char *configfs_page, char *msg,
 *   Note: begin of log to be copied is from the given "start_seq_num" location
 *         trace backward to number of "count".
 */
-uint32_t read_logs(log_entry_t *cpu_log_buffer, log_entry_t results[],
-				   uint64_t start_seq_num, int count)
+static uint32_t read_logs_v1(log_entry_t *cpu_log_buffer, log_entry_t results[],
+							 uint64_t start_seq_num, int count)
 {
 	log_entry_t *entry;
 	uint32_t index;
@@ -138,9 +220,8 @@ uint32_t read_logs(log_entry_t *cpu_log_buffer, log_entry_t results[],
 	while (count) {
 		entry = &cpu_log_buffer[index];
 
-		if (entry->data.valid) {
-			results[num_of_entries_copied++] = *entry;
-		}
+		if (log_entry_copy(entry, &results[num_of_entries_copied], start_seq_num))
+			num_of_entries_copied++;
 
 		if (index >= LOGS_PER_CPU) {
 			index = 1;
@@ -157,6 +238,165 @@ uint32_t read_logs(log_entry_t *cpu_log_buffer, log_entry_t results[],
 	return num_of_entries_copied;
 }
 
+static void *log_ring_ptr(struct log_ring *ring, uint64_t offset)
+{
+	return page_address(ring->pages[offset >> PAGE_SHIFT]) + (offset & ~PAGE_MASK);
+}
+
+static log_ring_header_t *log_ring_header(struct log_ring *ring)
+{
+	return (log_ring_header_t *)page_address(ring->pages[0]);
+}
+
+static log_record_t *log_ring_record(struct log_ring *ring, uint32_t cpu_index,
+									 uint64_t seq_num)
+{
+	return log_ring_ptr(ring, LOG_RING_OFFSET(num_of_cpus)
+		+ ((uint64_t)cpu_index * ring->num_records
+		+ (seq_num & (ring->num_records - 1))) * sizeof(log_record_t));
+}
+
+/* as read_logs_v1(), on the v2 layout. A slot holds the record of
+* start_seq_num - count + i only if it has not been written over since,
+* start_seq_num must be a head loaded with acquire.
+*/
+static uint32_t read_logs_v2(uint32_t cpu_index, log_entry_t results[],
+							 uint64_t start_seq_num, int count)
+{
+	log_record_t *record;
+	log_entry_t *result;
+	uint64_t seq_num;
+	uint32_t num_of_entries_copied = 0;
+
+	if ((-1 == count) || (count > log_ring->num_records))
+		count = log_ring->num_records;
+
+	for (seq_num = start_seq_num - count; seq_num != start_seq_num; seq_num++) {
+		record = log_ring_record(log_ring, cpu_index, seq_num);
+
+		/* the stamp is checked before and after the copy */
+		if (smp_load_acquire(&record->seq_num) != seq_num)
+			continue;
+
+		result = &results[num_of_entries_copied];
+		result->data.seq_num = seq_num;
+		result->data.reason = record->reason;
+		result->data.valid = record->valid;
+		result->data.qualification = record->qualification;
+		result->data.rip = record->rip;
+		result->data.gva = record->gva;
+		smp_rmb();
+
+		/* written over while copied */
+		if (!result->data.valid || (READ_ONCE(record->seq_num) != seq_num))
+			continue;
+
+		num_of_entries_copied++;
+	}
+
+	return num_of_entries_copied;
+}
+
+/*
+*   IN cpu_index: cpu of the log buffer
+*   OUTPUT results: event contents copy to, room for log_capacity() entries
+*   IN start_seq_num: the sequence number to start report.
+*   IN count: the number of log entries counting backwards
+*   RETURN: number of logs actually read
+*/
+uint32_t read_logs(uint32_t cpu_index, log_entry_t results[],
+				   uint64_t start_seq_num, int count)
+{
+	if (log_ring)
+		return read_logs_v2(cpu_index, results, start_seq_num, count);
+
+	return read_logs_v1(get_cpu_log_buffer_start(log_data_gva, cpu_index),
+		results, start_seq_num, count);
+}
+
+/* records a cpu keeps before they are written over */
+uint32_t log_capacity(void)
+{
+	return log_ring ? log_ring->num_records : LOGS_PER_CPU;
+}
+
+uint64_t log_last_seq_num(uint32_t cpu_index)
+{
+	if (log_ring)
+		return smp_load_acquire(&log_ring_header(log_ring)->cpu_head[cpu_index].head);
+
+	return get_last_seq_num(get_cpu_log_buffer_start(log_data_gva, cpu_index));
+}
+
+uint32_t log_num_of_cpus(void)
+{
+	return num_of_cpus;
+}
+
+/*-------------------------------------------------------*
+*  Function      : log_read_begin()
+*  Purpose: keep the rings from being resized until log_read_end()
+*  Parameters: none
+*  Return: generation of the rings, sequence numbers read under another
+*          generation are no longer valid
+*-------------------------------------------------------*/
+uint32_t log_read_begin(void)
+{
+	mutex_lock(&log_lock);
+
+	return log_generation;
+}
+
+void log_read_end(void)
+{
+	mutex_unlock(&log_lock);
+}
+
+/*-------------------------------------------------------*
+*  Function      : log_ring_mmap()
+*  Purpose: map pages of the v2 buffer read-only, from page pgoff on.
+*           The mapping holds a reference on the pages, they outlive a
+*           resize until it is gone.
+*  Parameters: vma, first page of the buffer to map
+*  Return: 0=success, error code otherwise
+*-------------------------------------------------------*/
+int log_ring_mmap(struct vm_area_struct *vma, unsigned long pgoff)
+{
+	unsigned long addr, num_pages;
+	unsigned long i;
+	int ret = 0;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+
+	num_pages = vma_pages(vma);
+
+	mutex_lock(&log_lock);
+
+	if (NULL == log_ring) {
+		ret = -ENODEV;
+	} else if ((pgoff >= log_ring->num_pages)
+		|| (num_pages > log_ring->num_pages - pgoff)) {
+		ret = -EINVAL;
+	} else {
+		addr = vma->vm_start;
+		for (i = 0; (i < num_pages) && !ret; i++, addr += PAGE_SIZE)
+			ret = vm_insert_page(vma, addr, log_ring->pages[pgoff + i]);
+	}
+
+	mutex_unlock(&log_lock);
+
+	return ret;
+}
+
+bool log_is_running(void)
+{
+	return is_logging_running;
+}
+
 /* cpu_log_buffer_start pointers to the beginning of the per cpu
 *  log buffer. cpu_log_buffer_start is multiplexed:
 *  first entry (index=0) stores meta data, entries 1 to (ENTRIES_PER_CPU - 1)
@@ -175,11 +415,31 @@ static void log_buffer_init(log_entry_t cpu_log_buffer_start[])
 #endif
 }
 
+/*-------------------------------------------------------*
+*  Function      : log_advance_epoch()
+*  Purpose: with mem_log_once, let the handler log writes to pages again
+*           once a consumer has read all the rings
+*  Parameters: none
+*  Return: none
+*-------------------------------------------------------*/
+void log_advance_epoch(void)
+{
+	policy_message_t msg;
+
+	if (!mem_log_once)
+		return;
+
+	msg.command = POLICY_LOG_EPOCH;
+	msg.count = 1;
+
+	if (SUCCESS != ikgt_hypercall(IKGT_POLICY_MSG, (char *)&msg, NULL))
+		PRINTK_WARNING("failed to send log epoch message\n");
+}
+
 static int dump_log(char *configfs_page)
 {
 	uint32_t cpu_index = 0;
 	uint32_t log_index = 0;
-	log_entry_t *cpu_log_buffer;
 	int offset = 0;
 	int n, full = 0;
 	char *sz_log_record;
@@ -200,7 +460,8 @@ static int dump_log(char *configfs_page)
 	if (NULL == sz_log_record)
 		return 0;
 
-	results = (log_entry_t *)kzalloc(LOGS_PER_CPU * sizeof(log_entry_t), GFP_KERNEL);
+	results = (log_entry_t *)kcalloc(min_t(uint32_t, log_capacity(), LOG_DUMP_MAX_RECORDS),
+		sizeof(log_entry_t), GFP_KERNEL);
 	if (NULL == results) {
 		kfree(sz_log_record);
 		return 0;
@@ -208,9 +469,7 @@ static int dump_log(char *configfs_page)
 
 	for (cpu_index = 0; cpu_index < num_of_cpus; cpu_index++) {
 
-		cpu_log_buffer = get_cpu_log_buffer_start(log_data_gva, cpu_index);
-
-		last_seq_num = get_last_seq_num(cpu_log_buffer);
+		last_seq_num = log_last_seq_num(cpu_index);
 
 		num_of_logs_to_read = last_seq_num - log_record_seq_num[cpu_index];
 
@@ -219,7 +478,10 @@ static int dump_log(char *configfs_page)
 		if ((0 == num_of_logs_to_read) || (0 == last_seq_num))
 			continue;
 
-		num_of_logs_returned = read_logs(cpu_log_buffer, results, last_seq_num, num_of_logs_to_read);
+		/* the newest records that can fit in the page */
+		num_of_logs_to_read = min_t(uint32_t, num_of_logs_to_read, LOG_DUMP_MAX_RECORDS);
+
+		num_of_logs_returned = read_logs(cpu_index, results, last_seq_num, num_of_logs_to_read);
 
 		for (log_index = 0; log_index < num_of_logs_returned; log_index++) {
 
@@ -242,6 +504,10 @@ static int dump_log(char *configfs_page)
 			break;
 	}
 
+	/* everything logged has been read, pages written from now on are new */
+	if (!full)
+		log_advance_epoch();
+
 	n = snprintf(sz_log_record, MAX_SENTINEL_SIZE - 1, "%u,%u,%d\nEOF\n", offset, num_of_logs_dumped, full);
 	strncpy(configfs_page + offset, sz_log_record, n);
 	offset += n;
@@ -252,18 +518,200 @@ static int dump_log(char *configfs_page)
 	return offset;
 }
 
-char *init_log(uint32_t *log_size)
+/* the handler has no notion of time but the TSC, so log rates are sent as
+* TSC cycles per logged event
+*/
+uint64_t log_rate_to_interval(uint32_t rate)
+{
+	if (0 == rate)
+		return 0;
+
+	return div_u64((uint64_t)tsc_khz * 1000, rate) ? : 1;
+}
+
+uint32_t log_interval_to_rate(uint64_t interval)
 {
-	uint32_t cpu_index = 0;
-	uint32_t size;
-	log_entry_t *log_buffer;
+	if (0 == interval)
+		return 0;
 
-	num_of_cpus = num_online_cpus();
+	return div64_u64((uint64_t)tsc_khz * 1000, interval);
+}
 
-	log_record_seq_num =  kzalloc(num_of_cpus * sizeof(uint64_t), GFP_KERNEL);
-	if (NULL == log_record_seq_num)
+void init_log_limit(log_message_t *log_param)
+{
+	log_param->log_interval = log_rate_to_interval(mem_log_rate);
+	log_param->log_burst = mem_log_burst;
+	log_param->log_flags = mem_log_once ? LOG_FLAG_MEM_WRITE_ONCE : 0;
+}
+
+static void log_ring_free(struct log_ring *ring)
+{
+	uint32_t i;
+
+	if (NULL == ring)
+		return;
+
+	for (i = 0; i < ring->num_pages; i++) {
+		if (ring->pages[i])
+			__free_page(ring->pages[i]);
+	}
+
+	vfree(ring->pages);
+	vfree(ring->page_list);
+	kfree(ring);
+}
+
+/* a v2 buffer of pages_per_cpu pages per cpu, none of them need to be
+* next to each other
+*/
+static struct log_ring *log_ring_alloc(uint32_t pages_per_cpu)
+{
+	struct log_ring *ring;
+	uint32_t i;
+
+	ring = kzalloc(sizeof(struct log_ring), GFP_KERNEL);
+	if (NULL == ring)
 		return NULL;
 
+	ring->num_records = pages_per_cpu * PAGE_4KB / sizeof(log_record_t);
+	ring->num_pages = LOG_RING_SIZE(num_of_cpus, ring->num_records) >> PAGE_SHIFT;
+
+	ring->pages = vzalloc(ring->num_pages * sizeof(struct page *));
+	ring->page_list = vzalloc(ring->num_pages * sizeof(uint64_t));
+	if ((NULL == ring->pages) || (NULL == ring->page_list)) {
+		log_ring_free(ring);
+		return NULL;
+	}
+
+	for (i = 0; i < ring->num_pages; i++) {
+		ring->pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (NULL == ring->pages[i]) {
+			log_ring_free(ring);
+			return NULL;
+		}
+
+		ring->page_list[i] = (uint64_t)page_address(ring->pages[i]);
+	}
+
+	return ring;
+}
+
+static void log_ring_fill_param(struct log_ring *ring, log_message_t *log_param)
+{
+	log_param->log_addr = NULL;
+	log_param->log_size = ring->num_pages * PAGE_4KB;
+	log_param->log_version = LOG_RING_VERSION;
+	log_param->log_num_of_cpus = num_of_cpus;
+	log_param->log_num_records = ring->num_records;
+	log_param->log_num_pages = ring->num_pages;
+	log_param->log_page_list = (char *)ring->page_list;
+}
+
+/* the handler writes the header of a ring it accepted, signature last */
+static bool log_ring_accepted(struct log_ring *ring)
+{
+	log_ring_header_t *header = log_ring_header(ring);
+
+	if ((LOG_RING_SIGNATURE != READ_ONCE(header->signature))
+		|| (LOG_RING_VERSION != header->version)
+		|| (sizeof(log_record_t) != header->record_size)
+		|| (ring->num_records != header->num_records)
+		|| (num_of_cpus != header->num_of_cpus))
+		return false;
+
+	smp_rmb();
+
+	return true;
+}
+
+/*-------------------------------------------------------*
+*  Function      : log_ring_resize()
+*  Purpose: switch the handler to rings of another size, records not yet
+*           read from the old rings are lost
+*  Parameters: pages per cpu
+*  Return: 0=success, error code otherwise
+*-------------------------------------------------------*/
+static int log_ring_resize(uint32_t pages_per_cpu)
+{
+	policy_message_t *msg;
+	struct log_ring *ring;
+	ikgt_result_t ret;
+
+	ring = log_ring_alloc(pages_per_cpu);
+	if (NULL == ring)
+		return -ENOMEM;
+
+	msg = kzalloc(sizeof(policy_message_t), GFP_KERNEL);
+	if (NULL == msg) {
+		log_ring_free(ring);
+		return -ENOMEM;
+	}
+
+	msg->command = POLICY_INIT_LOG;
+	msg->count = 1;
+	init_log_limit(&msg->log_param);
+	log_ring_fill_param(ring, &msg->log_param);
+
+	mutex_lock(&log_lock);
+
+	ret = ikgt_hypercall(IKGT_POLICY_MSG, (char *)msg, NULL);
+
+	if ((SUCCESS != ret) || !log_ring_accepted(ring)) {
+		mutex_unlock(&log_lock);
+		kfree(msg);
+		log_ring_free(ring);
+		return -EIO;
+	}
+
+	/* tells mmap() consumers of the old rings to map the new ones */
+	WRITE_ONCE(log_ring_header(log_ring)->signature, 0);
+
+	log_ring_free(log_ring_old);
+	log_ring_old = log_ring;
+	log_ring = ring;
+
+	memset(log_record_seq_num, 0, num_of_cpus * sizeof(uint64_t));
+	log_generation++;
+
+	mutex_unlock(&log_lock);
+
+	kfree(msg);
+
+	PRINTK_INFO("log rings resized to %u records per cpu\n", ring->num_records);
+
+	return 0;
+}
+
+static int log_pages_per_cpu_set(const char *val, const struct kernel_param *kp)
+{
+	unsigned int pages;
+	int ret;
+
+	if (kstrtouint(val, 0, &pages))
+		return -EINVAL;
+
+	if ((0 == pages) || (pages & (pages - 1)) || (pages > LOG_MAX_PAGES_PER_CPU))
+		return -EINVAL;
+
+	/* applied by init_log() if the agent is not running yet */
+	if (log_ring && (pages != log_ring->num_records * sizeof(log_record_t) / PAGE_4KB)) {
+		ret = log_ring_resize(pages);
+		if (ret)
+			return ret;
+	}
+
+	log_pages_per_cpu = pages;
+
+	return 0;
+}
+
+/* the v1 layout in one physically contiguous allocation */
+static char *init_log_v1(uint32_t *log_size)
+{
+	uint32_t cpu_index = 0;
+	uint32_t size;
+	log_entry_t *log_buffer;
+
 	size = num_of_cpus * LOG_PAGES_PER_CPU * PAGE_4KB;
 
 	if (log_size) {
@@ -274,7 +722,6 @@ char *init_log(uint32_t *log_size)
 	log_data_gva = kzalloc(size, GFP_KERNEL);
 	if (log_data_gva == NULL) {
 		PRINTK_ERROR("failed to allocate memory for log data pages\n");
-		kfree(log_record_seq_num);
 		return NULL;
 	}
 
@@ -287,9 +734,75 @@ char *init_log(uint32_t *log_size)
 		log_buffer_init(log_buffer);
 	}
 
+	return (char *)log_data_gva;
+}
+
+/*-------------------------------------------------------*
+*  Function      : init_log()
+*  Purpose: allocate the log buffer in the v2 layout and describe it in
+*           the POLICY_INIT_LOG message
+*  Parameters: log parameters of the message
+*  Return: true=success, false=failure
+*-------------------------------------------------------*/
+bool init_log(log_message_t *log_param)
+{
+	num_of_cpus = num_online_cpus();
+
+	log_record_seq_num =  kzalloc(num_of_cpus * sizeof(uint64_t), GFP_KERNEL);
+	if (NULL == log_record_seq_num)
+		return false;
+
+	log_ring = log_ring_alloc(log_pages_per_cpu);
+	if (NULL == log_ring) {
+		PRINTK_ERROR("failed to allocate log pages\n");
+		kfree(log_record_seq_num);
+		log_record_seq_num = NULL;
+		return false;
+	}
+
+	log_ring_fill_param(log_ring, log_param);
+
+	return true;
+}
+
+/*-------------------------------------------------------*
+*  Function      : start_log()
+*  Purpose: called once POLICY_INIT_LOG is sent. A handler that does not
+*           know the v2 layout gets a v1 buffer in another message.
+*  Parameters: the message sent
+*  Return: true=success, false=failure
+*-------------------------------------------------------*/
+bool start_log(policy_message_t *msg)
+{
+	if (log_ring_accepted(log_ring)) {
+		PRINTK_INFO("log buffer layout v%u, %u records per cpu\n",
+			LOG_RING_VERSION, log_ring->num_records);
+		is_logging_running = true;
+		return true;
+	}
+
+	/* the handler never mapped the pages */
+	log_ring_free(log_ring);
+	log_ring = NULL;
+
+	PRINTK_INFO("log buffer layout v1\n");
+
+	msg->log_param.log_addr = init_log_v1(&msg->log_param.log_size);
+	if (NULL == msg->log_param.log_addr)
+		return false;
+
+	msg->log_param.log_version = 0;
+	msg->log_param.log_page_list = NULL;
+	msg->log_param.log_num_pages = 0;
+	msg->log_param.cmd_ring_addr = NULL;
+	msg->log_param.cmd_ring_size = 0;
+
+	if (SUCCESS != ikgt_hypercall(IKGT_POLICY_MSG, (char *)msg, NULL))
+		return false;
+
 	is_logging_running = true;
 
-	return (char *)log_data_gva;
+	return true;
 }
 
 #ifdef DEBUG
@@ -297,6 +810,9 @@ void test_log(void)
 {
 	log_entry_t *cpu_log_buffer;
 
+	if (NULL == log_data_gva)
+		return;
+
 	cpu_log_buffer = get_cpu_log_buffer_start(log_data_gva, 0);
 
 	PRINTK_INFO("Before: test=%llx\n",	cpu_log_buffer[0].meta.test);
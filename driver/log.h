@@ -15,7 +15,35 @@
 #ifndef _LOG_H
 #define _LOG_H
 
-char *init_log(uint32_t *log_size);
+bool init_log(log_message_t *log_param);
+
+bool start_log(policy_message_t *msg);
+
+void init_log_limit(log_message_t *log_param);
+
+bool log_is_running(void);
+
+uint32_t log_num_of_cpus(void);
+
+uint32_t log_capacity(void);
+
+uint64_t log_last_seq_num(uint32_t cpu_index);
+
+uint32_t read_logs(uint32_t cpu_index, log_entry_t results[],
+				   uint64_t start_seq_num, int count);
+
+struct vm_area_struct;
+int log_ring_mmap(struct vm_area_struct *vma, unsigned long pgoff);
+
+uint32_t log_read_begin(void);
+
+void log_read_end(void);
+
+void log_advance_epoch(void);
+
+bool init_log_dev(void);
+
+void uninit_log_dev(void);
 
 void test_log(void);
 
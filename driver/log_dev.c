@@ -0,0 +1,465 @@
+/*
+* This is an example ikgt usage driver.
+* Copyright (c) 2015, Intel Corporation.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/workqueue.h>
+
+#include "common.h"
+#include "policy_common.h"
+#include "log.h"
+
+
+/* records converted at a time */
+#define LOG_DEV_CHUNK  64
+
+/* bounds of the interval the rings are checked at while a reader polls */
+#define LOG_DEV_SCAN_MIN_MS  1
+#define LOG_DEV_SCAN_MAX_MS  1000
+
+static uint log_watermark = 50;
+module_param(log_watermark, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(log_watermark, "percent of a cpu ring not read that wakes poll(), 1-100");
+
+/* one open of /dev/ikgt_log. Every reader has its own cursors and gets
+* all the records, as far as they are not written over before it reads.
+*/
+struct log_reader {
+	uint32_t generation;
+	uint32_t next_cpu;   /* cpu read first by the next read() */
+	struct mutex read_lock; /* read() of this reader, records below */
+	log_entry_t results[LOG_DEV_CHUNK];
+	log_dev_record_t records[LOG_DEV_CHUNK];
+	log_dev_cursor_t *cursor; /* next record to read, may be mapped */
+	struct list_head node;    /* in log_readers */
+	wait_queue_head_t wait;   /* poll() of this reader */
+	uint64_t lost[];     /* per cpu, not yet reported in a record */
+};
+
+static bool log_dev_registered;
+
+static LIST_HEAD(log_readers);
+static DEFINE_MUTEX(log_readers_lock);
+
+static void log_dev_scan(struct work_struct *work);
+static DECLARE_DELAYED_WORK(log_dev_scan_work, log_dev_scan);
+
+static uint32_t log_dev_scan_ms = LOG_DEV_SCAN_MAX_MS;
+static uint64_t log_dev_scan_total; /* records logged at the last scan */
+
+
+/* records of a ring not read that make a reader ready */
+static uint64_t log_dev_watermark(void)
+{
+	uint32_t percent = clamp_t(uint32_t, log_watermark, 1, 100);
+
+	return max_t(uint64_t, 1, (uint64_t)log_capacity() * percent / 100);
+}
+
+/* records not read on the fullest ring of the reader. Called under
+* log_read_begin().
+*/
+static uint64_t log_dev_fill(struct log_reader *reader, uint32_t generation)
+{
+	uint64_t head, seq_num, fill = 0;
+	uint32_t cpu_index;
+
+	/* not the num_of_cpus of the cursor page, a consumer can write it */
+	for (cpu_index = 0; cpu_index < log_num_of_cpus(); cpu_index++) {
+		head = log_last_seq_num(cpu_index);
+
+		/* the cursors start again from 0 after a resize */
+		seq_num = (reader->generation == generation)
+			? READ_ONCE(reader->cursor->seq_num[cpu_index]) : 0;
+
+		if (head > seq_num)
+			fill = max_t(uint64_t, fill, head - seq_num);
+	}
+
+	return min_t(uint64_t, fill, log_capacity());
+}
+
+static bool log_dev_ready(struct log_reader *reader)
+{
+	uint32_t generation;
+	bool ready;
+
+	generation = log_read_begin();
+	ready = (log_dev_fill(reader, generation) >= log_dev_watermark());
+	log_read_end();
+
+	return ready;
+}
+
+/*-------------------------------------------------------*
+*  Function      : log_dev_scan()
+*  Purpose: wake the readers waiting in poll() that are past the
+*           watermark. Runs only while one of them is not, sooner while
+*           records come in and backing off to LOG_DEV_SCAN_MAX_MS while
+*           none do.
+*  Parameters: work
+*  Return: none
+*-------------------------------------------------------*/
+static void log_dev_scan(struct work_struct *work)
+{
+	struct log_reader *reader;
+	uint32_t num_of_cpus = log_num_of_cpus();
+	uint32_t generation;
+	uint32_t cpu_index;
+	uint64_t total = 0;
+	uint64_t watermark;
+	bool waiting = false;
+
+	generation = log_read_begin();
+
+	for (cpu_index = 0; cpu_index < num_of_cpus; cpu_index++)
+		total += log_last_seq_num(cpu_index);
+
+	watermark = log_dev_watermark();
+
+	mutex_lock(&log_readers_lock);
+	list_for_each_entry(reader, &log_readers, node) {
+		if (!waitqueue_active(&reader->wait))
+			continue;
+
+		if (log_dev_fill(reader, generation) >= watermark)
+			wake_up_interruptible(&reader->wait);
+		else
+			waiting = true;
+	}
+	mutex_unlock(&log_readers_lock);
+
+	log_read_end();
+
+	if (total != log_dev_scan_total)
+		log_dev_scan_ms = max_t(uint32_t, log_dev_scan_ms / 2, LOG_DEV_SCAN_MIN_MS);
+	else
+		log_dev_scan_ms = min_t(uint32_t, log_dev_scan_ms * 2, LOG_DEV_SCAN_MAX_MS);
+
+	log_dev_scan_total = total;
+
+	/* a woken reader polling again starts the scan itself if needed */
+	if (waiting)
+		schedule_delayed_work(&log_dev_scan_work, msecs_to_jiffies(log_dev_scan_ms));
+}
+
+
+static int log_dev_open(struct inode *inode, struct file *file)
+{
+	struct log_reader *reader;
+	uint32_t num_of_cpus = log_num_of_cpus();
+	uint32_t cpu_index;
+	uint64_t head;
+
+	if (!log_is_running())
+		return -ENODEV;
+
+	reader = kzalloc(sizeof(struct log_reader)
+		+ num_of_cpus * sizeof(uint64_t), GFP_KERNEL);
+	if (NULL == reader)
+		return -ENOMEM;
+
+	reader->cursor = vmalloc_user(LOG_DEV_CURSOR_SIZE(num_of_cpus));
+	if (NULL == reader->cursor) {
+		kfree(reader);
+		return -ENOMEM;
+	}
+
+	reader->cursor->num_of_cpus = num_of_cpus;
+	mutex_init(&reader->read_lock);
+	init_waitqueue_head(&reader->wait);
+
+	/* start from the oldest records still in the rings */
+	reader->generation = log_read_begin();
+
+	for (cpu_index = 0; cpu_index < num_of_cpus; cpu_index++) {
+		head = log_last_seq_num(cpu_index);
+		reader->cursor->seq_num[cpu_index] = head - min_t(uint64_t, head, log_capacity());
+	}
+
+	log_read_end();
+
+	mutex_lock(&log_readers_lock);
+	list_add(&reader->node, &log_readers);
+	mutex_unlock(&log_readers_lock);
+
+	file->private_data = reader;
+
+	return nonseekable_open(inode, file);
+}
+
+static int log_dev_release(struct inode *inode, struct file *file)
+{
+	struct log_reader *reader = file->private_data;
+
+	mutex_lock(&log_readers_lock);
+	list_del(&reader->node);
+	mutex_unlock(&log_readers_lock);
+
+	vfree(reader->cursor);
+	kfree(reader);
+
+	return 0;
+}
+
+/* converts the next records of a cpu, at most max, into reader->records.
+* *end is where its cursor goes once they are copied. Called under
+* log_read_begin(). Returns true if the cpu has more records after them.
+*/
+static bool log_dev_convert(struct log_reader *reader, uint32_t cpu_index,
+							uint32_t max, uint32_t *num, uint64_t *end)
+{
+	log_entry_t *entry;
+	log_dev_record_t *record;
+	uint64_t head, first, next;
+	uint32_t num_of_logs_returned;
+	uint32_t i;
+
+	uint64_t seq_num;
+
+	head = log_last_seq_num(cpu_index);
+	first = head - min_t(uint64_t, head, log_capacity());
+
+	/* a mapped cursor can hold anything */
+	seq_num = READ_ONCE(reader->cursor->seq_num[cpu_index]);
+	if (seq_num > head)
+		seq_num = head;
+
+	if (seq_num > first)
+		first = seq_num;
+	else
+		reader->lost[cpu_index] += first - seq_num;
+
+	*num = 0;
+	*end = first;
+
+	if (first >= head)
+		return false;
+
+	*end = min_t(uint64_t, head, first + min_t(uint32_t, LOG_DEV_CHUNK, max));
+
+	num_of_logs_returned = read_logs(cpu_index, reader->results, *end, *end - first);
+
+	next = first;
+	for (i = 0; i < num_of_logs_returned; i++) {
+		entry = &reader->results[i];
+		record = &reader->records[i];
+
+		record->cpu = cpu_index;
+		record->reason = entry->data.reason;
+		record->seq_num = entry->data.seq_num;
+		record->qualification = entry->data.qualification;
+		record->rip = entry->data.rip;
+		record->gva = entry->data.gva;
+
+		/* written over, or torn while it was copied */
+		record->lost = reader->lost[cpu_index] + (entry->data.seq_num - next);
+		reader->lost[cpu_index] = 0;
+
+		next = entry->data.seq_num + 1;
+	}
+
+	reader->lost[cpu_index] += *end - next;
+	*num = num_of_logs_returned;
+
+	return *end < head;
+}
+
+/*-------------------------------------------------------*
+*  Function      : log_dev_read()
+*  Purpose: read as many log_dev_record_t as fit in buf, the cpus taking
+*           turns to be read first. splice() goes through this as well.
+*           A read that drains all the rings advances the log epoch.
+*           log_lock is dropped around copy_to_user(): a fault there
+*           takes mmap_lock, which mmap() holds when it takes log_lock in
+*           log_ring_mmap().
+*  Parameters: as read()
+*  Return: bytes read, 0 if no record is pending, error code otherwise
+*-------------------------------------------------------*/
+static ssize_t log_dev_read(struct file *file, char __user *buf,
+							size_t count, loff_t *ppos)
+{
+	struct log_reader *reader = file->private_data;
+	uint32_t num_of_cpus = log_num_of_cpus();
+	uint32_t max, num, copied = 0;
+	uint32_t cpu_index, i = 0;
+	uint32_t generation;
+	uint64_t end;
+	bool more, failed;
+	int ret = 0;
+
+	max = min_t(size_t, count, INT_MAX) / sizeof(log_dev_record_t);
+	if (0 == max)
+		return -EINVAL;
+
+	mutex_lock(&reader->read_lock);
+
+	generation = log_read_begin();
+
+	while ((i < num_of_cpus) && (copied < max)) {
+		/* the rings were resized, what was left in the old ones is lost */
+		if (reader->generation != generation) {
+			if (copied)
+				break;
+
+			memset(reader->cursor->seq_num, 0, num_of_cpus * sizeof(uint64_t));
+			memset(reader->lost, 0, num_of_cpus * sizeof(uint64_t));
+			reader->generation = generation;
+		}
+
+		cpu_index = (reader->next_cpu + i) % num_of_cpus;
+		more = log_dev_convert(reader, cpu_index, max - copied, &num, &end);
+
+		if (num) {
+			log_read_end();
+
+			failed = copy_to_user(buf + copied * sizeof(log_dev_record_t),
+				reader->records, num * sizeof(log_dev_record_t));
+
+			generation = log_read_begin();
+
+			if (failed) {
+				ret = -EFAULT;
+				break;
+			}
+
+			copied += num;
+
+			/* resized meanwhile, end is a cursor of the old rings */
+			if (reader->generation != generation)
+				continue;
+		}
+
+		WRITE_ONCE(reader->cursor->seq_num[cpu_index], end);
+
+		if (!more)
+			i++;
+	}
+
+	reader->next_cpu = (reader->next_cpu + 1) % num_of_cpus;
+
+	log_read_end();
+
+	mutex_unlock(&reader->read_lock);
+
+	/* every ring read to its head, pages may be logged again */
+	if (copied && (i == num_of_cpus) && !ret)
+		log_advance_epoch();
+
+	if (copied)
+		return copied * sizeof(log_dev_record_t);
+
+	return ret;
+}
+
+/* a consumer of the mapped rings has read them all, the data is ignored */
+static ssize_t log_dev_write(struct file *file, const char __user *buf,
+							 size_t count, loff_t *ppos)
+{
+	log_advance_epoch();
+
+	return count;
+}
+
+/*-------------------------------------------------------*
+*  Function      : log_dev_mmap()
+*  Purpose: map the cursor page of the reader, or the log rings read-only
+*           for a privileged consumer, see log_dev_cursor_t
+*  Parameters: as mmap()
+*  Return: 0=success, error code otherwise
+*-------------------------------------------------------*/
+static int log_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct log_reader *reader = file->private_data;
+
+	if (vma->vm_pgoff >= LOG_DEV_RING_PGOFF) {
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+
+		return log_ring_mmap(vma, vma->vm_pgoff - LOG_DEV_RING_PGOFF);
+	}
+
+	if ((vma->vm_end - vma->vm_start)
+		> LOG_DEV_CURSOR_SIZE(log_num_of_cpus()))
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, reader->cursor, vma->vm_pgoff);
+}
+
+/* readable once any ring of the reader is filled up to log_watermark */
+static unsigned int log_dev_poll(struct file *file, poll_table *wait)
+{
+	struct log_reader *reader = file->private_data;
+
+	poll_wait(file, &reader->wait, wait);
+
+	if (log_dev_ready(reader))
+		return POLLIN | POLLRDNORM;
+
+	schedule_delayed_work(&log_dev_scan_work, msecs_to_jiffies(log_dev_scan_ms));
+
+	return 0;
+}
+
+/* no splice_read, the default one of the kernel reads through .read into
+* the pipe pages, a page at a time
+*/
+static const struct file_operations log_dev_fops = {
+	.owner   = THIS_MODULE,
+	.open    = log_dev_open,
+	.release = log_dev_release,
+	.read    = log_dev_read,
+	.write   = log_dev_write,
+	.mmap    = log_dev_mmap,
+	.poll    = log_dev_poll,
+	.llseek  = no_llseek,
+};
+
+static struct miscdevice log_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name  = "ikgt_log",
+	.fops  = &log_dev_fops,
+	.mode  = S_IRUSR | S_IWUSR, /* write for the cursors and the log epoch */
+};
+
+/*
+* /dev/ikgt_log returns the records of all cpus in binary, a whole ring in
+* one read() given a large enough buffer. log.txt keeps working alongside.
+*/
+bool init_log_dev(void)
+{
+	if (misc_register(&log_dev)) {
+		PRINTK_WARNING("failed to register /dev/%s\n", log_dev.name);
+		return false;
+	}
+
+	log_dev_registered = true;
+
+	return true;
+}
+
+void uninit_log_dev(void)
+{
+	if (log_dev_registered)
+		misc_deregister(&log_dev);
+
+	cancel_delayed_work_sync(&log_dev_scan_work);
+
+	log_dev_registered = false;
+}
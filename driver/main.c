@@ -27,6 +27,8 @@
 #include "configfs_setup.h"
 #include "log.h"
 #include "debug.h"
+#include "stats.h"
+#include "policy.h"
 
 
 static int __init init_agent(void)
@@ -42,18 +44,44 @@ static int __init init_agent(void)
 
 	msg.command = POLICY_INIT_LOG;
 	msg.count = 1;
-	msg.log_param.log_addr = init_log(&msg.log_param.log_size);
-	if (NULL == msg.log_param.log_addr) {
+	memset(&msg.log_param, 0, sizeof(msg.log_param));
+	if (!init_log(&msg.log_param)) {
 		PRINTK_ERROR("failed to setup iKGT\n");
 		return 1;
 	}
+	init_log_limit(&msg.log_param);
+	msg.log_param.cmd_ring_addr = init_cmd_ring(&msg.log_param.cmd_ring_size);
 	ret = ikgt_hypercall(IKGT_POLICY_MSG, (char *)&msg, NULL);
 	if (SUCCESS != ret) {
 		PRINTK_ERROR("failed to send message");
 		return 1;
 	}
 
-	PRINTK_INFO("log_addr=%p\n", msg.log_param.log_addr);
+	if (msg.log_param.cmd_ring_addr)
+		start_cmd_ring();
+
+	if (!start_log(&msg)) {
+		PRINTK_ERROR("failed to setup the log buffer\n");
+		return 1;
+	}
+
+	/* log.txt is there anyway, the device is optional */
+	init_log_dev();
+
+	/* statistics are optional, the agent works without them */
+	msg.command = POLICY_INIT_STATS;
+	msg.count = 1;
+	msg.stats_param.stats_addr = init_stats(&msg.stats_param.stats_size);
+	if (msg.stats_param.stats_addr) {
+		ret = ikgt_hypercall(IKGT_POLICY_MSG, (char *)&msg, NULL);
+		if (SUCCESS != ret)
+			PRINTK_WARNING("failed to send stats message\n");
+		else
+			init_stats_debugfs();
+	}
+
+	/* pick up the policy of an earlier load, nothing to resend then */
+	init_policy_report();
 
 	init_configfs_setup();
 
@@ -64,6 +92,18 @@ static void __exit exit_agent(void)
 {
 	exit_configfs_setup();
 
+	uninit_log_dev();
+
+	/* records still queued in an open batch */
+	policy_batch_end();
+
+	/* the handler would go on reading the freed ring */
+	stop_cmd_ring();
+
+	uninit_policy_report();
+
+	uninit_stats_debugfs();
+
 #ifdef DEBUG
 	uninit_debug();
 #endif
@@ -0,0 +1,305 @@
+/*
+* This is an example ikgt usage driver.
+* Copyright (c) 2015, Intel Corporation.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <linux/module.h>
+#include "ikgt_api.h"
+#include "common.h"
+#include "policy.h"
+
+
+static ssize_t mem_cfg_store_enable(struct mem_cfg *mem_cfg,
+									const char *page,
+									size_t count);
+
+static ssize_t mem_cfg_store_addr(struct mem_cfg *mem_cfg,
+								  const char *page,
+								  size_t count);
+
+static ssize_t mem_cfg_store_size(struct mem_cfg *mem_cfg,
+								  const char *page,
+								  size_t count);
+
+/* to_mem_cfg() function */
+IKGT_CONFIGFS_TO_CONTAINER(mem_cfg);
+
+/* define attribute structure */
+CONFIGFS_ATTR_STRUCT(mem_cfg);
+
+/* item operations, settings are locked while the range is enabled */
+IKGT_UINT32_SHOW(mem_cfg, enable);
+IKGT_ULONG_HEX_SHOW(mem_cfg, addr);
+IKGT_ULONG_HEX_SHOW(mem_cfg, size);
+IKGT_UINT32_HEX_SHOW(mem_cfg, read);
+IKGT_UINT32_HEX_SHOW(mem_cfg, write);
+IKGT_UINT32_HEX_SHOW(mem_cfg, exec);
+IKGT_UINT32_SHOW(mem_cfg, log_rate);
+IKGT_UINT32_SHOW(mem_cfg, log_burst);
+IKGT_UINT32_STORE_LOCKED(mem_cfg, read);
+IKGT_UINT32_STORE_LOCKED(mem_cfg, write);
+IKGT_UINT32_STORE_LOCKED(mem_cfg, exec);
+IKGT_UINT32_STORE_LOCKED(mem_cfg, log_rate);
+IKGT_UINT32_STORE_LOCKED(mem_cfg, log_burst);
+
+/* attributes */
+IKGT_CONFIGFS_ATTR_RW(mem_cfg, enable);
+IKGT_CONFIGFS_ATTR_RW(mem_cfg, addr);
+IKGT_CONFIGFS_ATTR_RW(mem_cfg, size);
+IKGT_CONFIGFS_ATTR_RW(mem_cfg, read);
+IKGT_CONFIGFS_ATTR_RW(mem_cfg, write);
+IKGT_CONFIGFS_ATTR_RW(mem_cfg, exec);
+IKGT_CONFIGFS_ATTR_RW(mem_cfg, log_rate);
+IKGT_CONFIGFS_ATTR_RW(mem_cfg, log_burst);
+
+static struct configfs_attribute *mem_cfg_attrs[] = {
+	&mem_cfg_attr_enable.attr,
+	&mem_cfg_attr_addr.attr,
+	&mem_cfg_attr_size.attr,
+	&mem_cfg_attr_read.attr,
+	&mem_cfg_attr_write.attr,
+	&mem_cfg_attr_exec.attr,
+	&mem_cfg_attr_log_rate.attr,
+	&mem_cfg_attr_log_burst.attr,
+	NULL,
+};
+
+CONFIGFS_ATTR_OPS(mem_cfg);
+
+
+/* the range is locked while the handler enforces it */
+static void mem_cfg_done(struct config_item *item, uint32_t command,
+						 const policy_update_rec_t *rec, bool accepted)
+{
+	struct mem_cfg *mem_cfg = to_mem_cfg(item);
+
+	if (!accepted) {
+		PRINTK_ERROR("%s: not applied by the handler\n", item->ci_name);
+		return;
+	}
+
+	mem_cfg->enable = (POLICY_ENTRY_ENABLE == command);
+	mem_cfg->locked = mem_cfg->enable;
+}
+
+/* item is NULL while the range is released, no callback is made then */
+static bool policy_set_memory(struct mem_cfg *mem_cfg, bool enable,
+							  struct config_item *item)
+{
+	policy_update_rec_t rec;
+	policy_update_rec_t *entry = &rec;
+
+	if ((mem_cfg->addr == 0) || (mem_cfg->size == 0))
+		return false;
+
+	memset(&rec, 0, sizeof(rec));
+
+	POLICY_SET_RESOURCE_ID(entry, RESOURCE_ID_MEMORY);
+	POLICY_SET_READ_ACTION(entry, mem_cfg->read);
+	POLICY_SET_WRITE_ACTION(entry, mem_cfg->write);
+	POLICY_SET_EXEC_ACTION(entry, mem_cfg->exec);
+
+	POLICY_INFO_SET_ADDR(entry, mem_cfg->addr);
+	POLICY_INFO_SET_SIZE(entry, mem_cfg->size);
+
+	POLICY_INFO_SET_LOG_INTERVAL(entry, log_rate_to_interval(mem_cfg->log_rate));
+	POLICY_INFO_SET_LOG_BURST(entry, mem_cfg->log_burst);
+
+	return policy_send_record(enable?POLICY_ENTRY_ENABLE:POLICY_ENTRY_DISABLE,
+		&rec, item, item ? mem_cfg_done : NULL);
+}
+
+/*-------------------------------------------------------*
+*  Function      : mem_cfg_restore()
+*  Purpose: take over a range still enabled in the handler from an
+*           earlier load of the agent, once addr and size match it. It
+*           can then be disabled like any other range.
+*  Parameters: mem_cfg
+*  Return: none
+*-------------------------------------------------------*/
+static void mem_cfg_restore(struct mem_cfg *mem_cfg)
+{
+	policy_update_rec_t rec;
+
+	if ((mem_cfg->addr == 0) || (mem_cfg->size == 0))
+		return;
+
+	memset(&rec, 0, sizeof(rec));
+	POLICY_INFO_SET_ADDR(&rec, mem_cfg->addr);
+	POLICY_INFO_SET_SIZE(&rec, mem_cfg->size);
+
+	if (!policy_report_restore(RESOURCE_ID_MEMORY, &rec, &mem_cfg->locked))
+		return;
+
+	mem_cfg->enable = true;
+	mem_cfg->read = POLICY_GET_READ_ACTION(&rec);
+	mem_cfg->write = POLICY_GET_WRITE_ACTION(&rec);
+	mem_cfg->exec = POLICY_GET_EXEC_ACTION(&rec);
+	mem_cfg->log_rate = log_interval_to_rate(POLICY_INFO_GET_LOG_INTERVAL(&rec));
+	mem_cfg->log_burst = POLICY_INFO_GET_LOG_BURST(&rec);
+
+	PRINTK_INFO("%s: restored range %#lx, size=%lu\n",
+		mem_cfg->item.ci_name, mem_cfg->addr, mem_cfg->size);
+}
+
+static ssize_t mem_cfg_store_addr(struct mem_cfg *mem_cfg,
+								  const char *page,
+								  size_t count)
+{
+	unsigned long value;
+
+	if (mem_cfg->locked)
+		return -EPERM;
+
+	/* as printed by /proc/kallsyms */
+	if (kstrtoul(page, 16, &value))
+		return -EINVAL;
+
+	mem_cfg->addr = value;
+
+	mem_cfg_restore(mem_cfg);
+
+	return count;
+}
+
+static ssize_t mem_cfg_store_size(struct mem_cfg *mem_cfg,
+								  const char *page,
+								  size_t count)
+{
+	unsigned long value;
+
+	if (mem_cfg->locked)
+		return -EPERM;
+
+	if (kstrtoul(page, 0, &value))
+		return -EINVAL;
+
+	if (value > U32_MAX)
+		return -EINVAL;
+
+	mem_cfg->size = value;
+
+	mem_cfg_restore(mem_cfg);
+
+	return count;
+}
+
+static ssize_t mem_cfg_store_enable(struct mem_cfg *mem_cfg,
+									const char *page,
+									size_t count)
+{
+	unsigned long value;
+
+	if (kstrtoul(page, 0, &value))
+		return -EINVAL;
+
+	if ((value != 0) == mem_cfg->enable)
+		return count;
+
+	if (!policy_set_memory(mem_cfg, value, &mem_cfg->item))
+		return -EIO;
+
+	return count;
+}
+
+
+/* a range removed from configfs is no longer enforced */
+static void mem_cfg_release(struct config_item *item)
+{
+	struct mem_cfg *mem_cfg = to_mem_cfg(item);
+
+	if (mem_cfg->enable && !policy_set_memory(mem_cfg, false, NULL))
+		PRINTK_ERROR("%s: range %#lx still enforced\n",
+			item->ci_name, mem_cfg->addr);
+
+	kfree(mem_cfg);
+}
+
+static struct configfs_item_operations mem_cfg_ops = {
+	.release		= mem_cfg_release,
+	.show_attribute		= mem_cfg_attr_show,
+	.store_attribute	= mem_cfg_attr_store,
+};
+
+static struct config_item_type mem_cfg_type = {
+	.ct_item_ops	= &mem_cfg_ops,
+	.ct_attrs	= mem_cfg_attrs,
+	.ct_owner	= THIS_MODULE,
+};
+
+
+static struct config_item *memory_make_item(struct config_group *group,
+											const char *name)
+{
+	struct mem_cfg *mem_cfg;
+
+	mem_cfg = kzalloc(sizeof(struct mem_cfg), GFP_KERNEL);
+	if (!mem_cfg) {
+		return ERR_PTR(-ENOMEM);
+	}
+
+	config_item_init_type_name(&mem_cfg->item, name,
+		&mem_cfg_type);
+
+	return &mem_cfg->item;
+}
+
+static struct configfs_attribute memory_children_attr_description = {
+	.ca_owner	= THIS_MODULE,
+	.ca_name	= "description",
+	.ca_mode	= S_IRUGO,
+};
+
+static struct configfs_attribute *memory_children_attrs[] = {
+	&memory_children_attr_description,
+	NULL,
+};
+
+static ssize_t memory_children_attr_show(struct config_item *item,
+struct configfs_attribute *attr,
+	char *page)
+{
+	return sprintf(page,
+		"Memory\n"
+		"\n"
+		"Ranges of guest kernel memory to monitor, any item name.\n"
+		"Set addr, size and the read/write/exec actions, then enable.\n"
+		"A range added later overrides the ranges it overlaps.\n"
+		"A range left enabled by an earlier load is taken over once\n"
+		"its addr and size are set, enable then reads 1.\n");
+}
+
+static void memory_children_release(struct config_item *item)
+{
+	kfree(to_node(item));
+}
+
+static struct configfs_item_operations memory_children_item_ops = {
+	.release	= memory_children_release,
+	.show_attribute = memory_children_attr_show,
+};
+
+static struct configfs_group_operations memory_children_group_ops = {
+	.make_item	= memory_make_item,
+};
+
+static struct config_item_type memory_children_type = {
+	.ct_item_ops	= &memory_children_item_ops,
+	.ct_group_ops	= &memory_children_group_ops,
+	.ct_attrs	= memory_children_attrs,
+	.ct_owner	= THIS_MODULE,
+};
+
+struct config_item_type *get_memory_children_type(void)
+{
+	return &memory_children_type;
+}
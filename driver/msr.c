@@ -15,6 +15,7 @@
 #include <linux/module.h>
 #include "ikgt_api.h"
 #include "common.h"
+#include "policy.h"
 
 
 name_value_map msr_regs[] = {
@@ -66,53 +67,68 @@ CONFIGFS_ATTR_STRUCT(msr_cfg);
 IKGT_UINT32_SHOW(msr_cfg, enable);
 IKGT_UINT32_HEX_SHOW(msr_cfg, write);
 IKGT_ULONG_HEX_SHOW(msr_cfg, sticky_value);
+IKGT_UINT32_SHOW(msr_cfg, log_rate);
+IKGT_UINT32_SHOW(msr_cfg, log_burst);
+IKGT_UINT32_STORE_LOCKED(msr_cfg, log_rate);
+IKGT_UINT32_STORE_LOCKED(msr_cfg, log_burst);
 
 /* attributes */
 IKGT_CONFIGFS_ATTR_RW(msr_cfg, enable);
 IKGT_CONFIGFS_ATTR_RW(msr_cfg, write);
 IKGT_CONFIGFS_ATTR_RW(msr_cfg, sticky_value);
+IKGT_CONFIGFS_ATTR_RW(msr_cfg, log_rate);
+IKGT_CONFIGFS_ATTR_RW(msr_cfg, log_burst);
 
 static struct configfs_attribute *msr_cfg_attrs[] = {
 	&msr_cfg_attr_enable.attr,
 	&msr_cfg_attr_write.attr,
 	&msr_cfg_attr_sticky_value.attr,
+	&msr_cfg_attr_log_rate.attr,
+	&msr_cfg_attr_log_burst.attr,
 	NULL,
 };
 
 CONFIGFS_ATTR_OPS(msr_cfg);
 
 
+/* the settings are taken once the handler applied them */
+static void msr_cfg_done(struct config_item *item, uint32_t command,
+						 const policy_update_rec_t *rec, bool accepted)
+{
+	struct msr_cfg *msr_cfg = to_msr_cfg(item);
+
+	if (!accepted) {
+		PRINTK_ERROR("%s: not applied by the handler\n", item->ci_name);
+		return;
+	}
+
+	msr_cfg->enable = (POLICY_ENTRY_ENABLE == command);
+
+	if (POLICY_GET_WRITE_ACTION(rec) & POLICY_ACT_STICKY)
+		msr_cfg->locked = true;
+}
+
 static bool policy_set_msr(struct msr_cfg *msr_cfg, bool enable)
 {
-	policy_message_t *msg = NULL;
-	policy_update_rec_t *entry = NULL;
-	ikgt_result_t ret;
-	uint32_t size;
+	policy_update_rec_t rec;
+	policy_update_rec_t *entry = &rec;
 	int idx = valid_msr_attr(msr_cfg->item.ci_name);
 
 	if (idx < 0)
 		return false;
 
-	size = sizeof(policy_message_t);
-	msg = (policy_message_t *) kzalloc(size, GFP_KERNEL);
-	if (msg == NULL)
-		return false;
-
-	msg->command = enable?POLICY_ENTRY_ENABLE:POLICY_ENTRY_DISABLE;
-	msg->count = 1;
-
-	entry = &msg->policy_data[0];
+	memset(&rec, 0, sizeof(rec));
 
 	POLICY_SET_RESOURCE_ID(entry, msr_regs[idx].res_id);
 	POLICY_SET_WRITE_ACTION(entry, msr_cfg->write);
 
 	POLICY_SET_STICKY_VALUE(entry, msr_cfg->sticky_value);
 
-	ret = ikgt_hypercall(IKGT_POLICY_MSG, (char *)msg, NULL);
-
-	kfree(msg);
+	POLICY_INFO_SET_LOG_INTERVAL(entry, log_rate_to_interval(msr_cfg->log_rate));
+	POLICY_INFO_SET_LOG_BURST(entry, msr_cfg->log_burst);
 
-	return (ret == SUCCESS)?true:false;
+	return policy_send_record(enable?POLICY_ENTRY_ENABLE:POLICY_ENTRY_DISABLE,
+		&rec, &msr_cfg->item, msr_cfg_done);
 }
 
 static ssize_t msr_cfg_store_write(struct msr_cfg *msr_cfg,
@@ -154,7 +170,6 @@ static ssize_t msr_cfg_store_enable(struct msr_cfg *msr_cfg,
 									size_t count)
 {
 	unsigned long value;
-	bool ret = false;
 
 	if (kstrtoul(page, 0, &value))
 		return -EINVAL;
@@ -163,14 +178,8 @@ static ssize_t msr_cfg_store_enable(struct msr_cfg *msr_cfg,
 		return -EPERM;
 	}
 
-	ret = policy_set_msr(msr_cfg, value);
-
-	if (ret) {
-		msr_cfg->enable = value;
-	}
-
-	if (ret && (msr_cfg->write & POLICY_ACT_STICKY))
-		msr_cfg->locked = true;
+	if (!policy_set_msr(msr_cfg, value))
+		return -EIO;
 
 	return count;
 }
@@ -198,6 +207,7 @@ static struct config_item *msr_make_item(struct config_group *group,
 										 const char *name)
 {
 	struct msr_cfg *msr_cfg;
+	policy_update_rec_t rec;
 
 	if (valid_msr_attr(name) == -1) {
 		PRINTK_ERROR("Invalid MSR bit name\n");
@@ -212,6 +222,16 @@ static struct config_item *msr_make_item(struct config_group *group,
 	config_item_init_type_name(&msr_cfg->item, name,
 		&msr_cfg_type);
 
+	/* still enabled in the handler from an earlier load of the agent */
+	if (policy_report_restore(msr_regs[valid_msr_attr(name)].res_id, &rec,
+		&msr_cfg->locked)) {
+		msr_cfg->enable = true;
+		msr_cfg->write = POLICY_GET_WRITE_ACTION(&rec);
+		msr_cfg->sticky_value = POLICY_GET_STICKY_VALUE(&rec);
+		msr_cfg->log_rate = log_interval_to_rate(POLICY_INFO_GET_LOG_INTERVAL(&rec));
+		msr_cfg->log_burst = POLICY_INFO_GET_LOG_BURST(&rec);
+	}
+
 	return &msr_cfg->item;
 }
 
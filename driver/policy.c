@@ -0,0 +1,576 @@
+/*
+* This is an example ikgt usage driver.
+* Copyright (c) 2015, Intel Corporation.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/vmalloc.h>
+#include "ikgt_api.h"
+#include "common.h"
+#include "policy.h"
+
+
+/* Policy records written while a batch is open are queued here and sent
+* to the handler in as few messages as possible when it is closed, one
+* message per run of records with the same command.
+*/
+static DEFINE_MUTEX(policy_batch_lock);
+static bool policy_batch_open;
+static uint32_t policy_batch_count;
+static policy_update_rec_t *policy_batch_recs;
+static uint32_t *policy_batch_cmds;
+static struct policy_pending **policy_batch_pending;
+static bool policy_batch_failed;
+
+/* A record sent or queued, until the handler reports its status. The
+* configfs item is only updated then, see policy_send_record().
+*/
+struct policy_pending {
+	struct list_head list;
+	struct config_item *item;
+	policy_done_fn done;
+	uint32_t command;
+	policy_update_rec_t rec;
+	bool accepted;
+	int *result;  /* of the policy_send_record() call, while it runs */
+};
+
+/* resolved records, their callbacks have not run yet */
+static LIST_HEAD(policy_done_list);
+
+/* Command ring shared with the handler, see cmd_ring_t. Records put on it
+* are picked up on the next exit of any cpu, or right away when the
+* doorbell is rung. The ring is only written under policy_batch_lock.
+*/
+#define POLICY_CMD_RING_SLOTS 256
+
+static cmd_ring_t *policy_cmd_ring;
+static bool policy_cmd_ring_ready;
+static struct policy_pending *policy_cmd_ring_pending[POLICY_CMD_RING_SLOTS];
+static uint64_t policy_cmd_ring_done;  /* records resolved, up to tail */
+
+/* Policy left in force by a previous load of the agent, see POLICY_REPORT.
+* configfs items created for a reported resource start out with its
+* settings instead of being sent to the handler again.
+*/
+static report_header_t *policy_report;
+static DEFINE_MUTEX(policy_report_lock);
+
+/* the policy can change between asking for its size and the report */
+#define POLICY_REPORT_TRIES 3
+
+
+/* resolve a record, its callback runs from policy_run_done() */
+static void policy_resolve(struct policy_pending *pending, bool accepted)
+{
+	if (NULL == pending)
+		return;
+
+	pending->accepted = accepted;
+	if (pending->result)
+		*pending->result = accepted;
+
+	if (!accepted)
+		policy_batch_failed = true;
+
+	list_add_tail(&pending->list, &policy_done_list);
+}
+
+/* the callbacks may drop the last reference of an item, whose release
+* sends records again, so they run without policy_batch_lock
+*/
+static void policy_run_done(void)
+{
+	LIST_HEAD(done);
+	struct policy_pending *pending, *next;
+
+	mutex_lock(&policy_batch_lock);
+	list_splice_init(&policy_done_list, &done);
+	mutex_unlock(&policy_batch_lock);
+
+	list_for_each_entry_safe(pending, next, &done, list) {
+		if (pending->done)
+			pending->done(pending->item, pending->command, &pending->rec,
+				pending->accepted);
+
+		if (pending->item)
+			config_item_put(pending->item);
+
+		kfree(pending);
+	}
+}
+
+static bool policy_send(uint32_t command, const policy_update_rec_t recs[],
+						struct policy_pending *pending[], uint32_t count)
+{
+	policy_message_t *msg = NULL;
+	policy_update_rec_t *data;
+	uint32_t *status;
+	ikgt_result_t ret;
+	size_t size;
+	uint32_t i;
+	bool all = true;
+
+	/* the handler writes the status of each record after the records */
+	size = max_t(size_t, POLICY_MSG_SIZE(count) + count * sizeof(uint32_t),
+		sizeof(policy_message_t));
+	msg = (policy_message_t *) kzalloc(size, GFP_KERNEL);
+	if (msg == NULL) {
+		for (i = 0; i < count; i++)
+			policy_resolve(pending[i], false);
+		return false;
+	}
+
+	msg->command = command;
+	msg->count = count | POLICY_MSG_STATUS;
+
+	data = &msg->policy_data[0];
+	memcpy(data, recs, count * sizeof(policy_update_rec_t));
+
+	status = (uint32_t *)((char *)msg + POLICY_MSG_SIZE(count));
+
+	ret = ikgt_hypercall(IKGT_POLICY_MSG, (char *)msg, NULL);
+
+	for (i = 0; i < count; i++) {
+		if ((ret != SUCCESS) || (POLICY_REC_OK != status[i]))
+			all = false;
+
+		policy_resolve(pending[i], (ret == SUCCESS) && (POLICY_REC_OK == status[i]));
+	}
+
+	kfree(msg);
+
+	return all;
+}
+
+/* resolve the records the handler took off the ring */
+static void policy_cmd_ring_complete(void)
+{
+	uint64_t head = policy_cmd_ring->head;
+	uint64_t tail = smp_load_acquire(&policy_cmd_ring->tail);
+	uint32_t idx;
+
+	if (tail - policy_cmd_ring_done > head - policy_cmd_ring_done)
+		tail = head;
+
+	for (; policy_cmd_ring_done != tail; policy_cmd_ring_done++) {
+		idx = policy_cmd_ring_done & (POLICY_CMD_RING_SLOTS - 1);
+
+		policy_resolve(policy_cmd_ring_pending[idx],
+			POLICY_REC_OK == READ_ONCE(policy_cmd_ring->slot[idx].status));
+		policy_cmd_ring_pending[idx] = NULL;
+	}
+}
+
+/* the records still on the ring are never applied */
+static void policy_cmd_ring_fail(void)
+{
+	uint64_t head = policy_cmd_ring->head;
+	uint32_t idx;
+
+	for (; policy_cmd_ring_done != head; policy_cmd_ring_done++) {
+		idx = policy_cmd_ring_done & (POLICY_CMD_RING_SLOTS - 1);
+
+		policy_resolve(policy_cmd_ring_pending[idx], false);
+		policy_cmd_ring_pending[idx] = NULL;
+	}
+}
+
+static bool policy_cmd_ring_doorbell(void)
+{
+	policy_message_t msg;
+	ikgt_result_t ret;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.command = POLICY_CMD_DOORBELL;
+
+	ret = ikgt_hypercall(IKGT_POLICY_MSG, (char *)&msg, NULL);
+	if (ret != SUCCESS)
+		return false;
+
+	policy_cmd_ring_complete();
+
+	/* a handler without ring support leaves the records alone */
+	if (policy_cmd_ring_done != policy_cmd_ring->head) {
+		PRINTK_ERROR("command ring not drained, sending messages\n");
+		policy_cmd_ring_fail();
+		policy_cmd_ring_ready = false;
+		return false;
+	}
+
+	return true;
+}
+
+static bool policy_cmd_ring_put(uint32_t command, const policy_update_rec_t *rec,
+								struct policy_pending *pending)
+{
+	cmd_ring_slot_t *slot;
+	uint64_t head = policy_cmd_ring->head;
+	uint32_t idx = head & (POLICY_CMD_RING_SLOTS - 1);
+
+	/* a slot is reused once the status of its last record is read, the
+	* handler drains the whole ring on the doorbell
+	*/
+	policy_cmd_ring_complete();
+
+	if (head - policy_cmd_ring_done >= POLICY_CMD_RING_SLOTS) {
+		policy_cmd_ring_doorbell();
+
+		if (!policy_cmd_ring_ready
+			|| (head - policy_cmd_ring_done >= POLICY_CMD_RING_SLOTS))
+			return false;
+	}
+
+	slot = &policy_cmd_ring->slot[idx];
+	slot->command = command;
+	slot->status = POLICY_REC_PENDING;
+	slot->rec = *rec;
+
+	policy_cmd_ring_pending[idx] = pending;
+
+	smp_store_release(&policy_cmd_ring->head, head + 1);
+
+	return true;
+}
+
+static bool policy_batch_flush(void)
+{
+	uint32_t start, end;
+	bool ret = true;
+
+	for (start = 0; start < policy_batch_count; start = end) {
+		for (end = start + 1; end < policy_batch_count; end++) {
+			if (policy_batch_cmds[end] != policy_batch_cmds[start])
+				break;
+		}
+
+		if (!policy_send(policy_batch_cmds[start], &policy_batch_recs[start],
+			&policy_batch_pending[start], end - start))
+			ret = false;
+	}
+
+	policy_batch_count = 0;
+
+	return ret;
+}
+
+/*-------------------------------------------------------*
+*  Function      : policy_send_record()
+*  Purpose: send a POLICY_ENTRY_ENABLE or POLICY_ENTRY_DISABLE record to
+*           the handler, or queue it while a batch is open. done is
+*           called once the handler applied or refused the record, the
+*           item is held until then.
+*  Parameters: command, record, configfs item, completion callback
+*  Return: true=applied or queued, false=the handler refused the record
+*-------------------------------------------------------*/
+bool policy_send_record(uint32_t command, const policy_update_rec_t *rec,
+						struct config_item *item, policy_done_fn done)
+{
+	struct policy_pending *pending;
+	int result = -1;
+
+	pending = kzalloc(sizeof(struct policy_pending), GFP_KERNEL);
+	if (NULL == pending)
+		return false;
+
+	pending->item = item ? config_item_get(item) : NULL;
+	pending->done = done;
+	pending->command = command;
+	pending->rec = *rec;
+	pending->result = &result;
+
+	mutex_lock(&policy_batch_lock);
+
+	if (policy_cmd_ring_ready && policy_cmd_ring_put(command, rec, pending)) {
+		/* a batch rings the doorbell once, when it is closed */
+		if (!policy_batch_open)
+			policy_cmd_ring_doorbell();
+	} else if (!policy_batch_open) {
+		policy_send(command, rec, &pending, 1);
+	} else {
+		if (policy_batch_count == POLICY_MSG_MAX_RECORDS)
+			policy_batch_flush();
+
+		policy_batch_recs[policy_batch_count] = *rec;
+		policy_batch_cmds[policy_batch_count] = command;
+		policy_batch_pending[policy_batch_count] = pending;
+		policy_batch_count++;
+	}
+
+	/* a queued record is resolved by a later call */
+	pending->result = NULL;
+
+	mutex_unlock(&policy_batch_lock);
+
+	policy_run_done();
+
+	return (result != 0);
+}
+
+bool policy_batch_begin(void)
+{
+	mutex_lock(&policy_batch_lock);
+
+	if (!policy_batch_open) {
+		policy_batch_recs = kcalloc(POLICY_MSG_MAX_RECORDS,
+			sizeof(policy_update_rec_t), GFP_KERNEL);
+		policy_batch_cmds = kcalloc(POLICY_MSG_MAX_RECORDS,
+			sizeof(uint32_t), GFP_KERNEL);
+		policy_batch_pending = kcalloc(POLICY_MSG_MAX_RECORDS,
+			sizeof(struct policy_pending *), GFP_KERNEL);
+
+		if (policy_batch_recs && policy_batch_cmds && policy_batch_pending) {
+			policy_batch_count = 0;
+			policy_batch_failed = false;
+			policy_batch_open = true;
+		} else {
+			kfree(policy_batch_recs);
+			kfree(policy_batch_cmds);
+			kfree(policy_batch_pending);
+			policy_batch_recs = NULL;
+			policy_batch_cmds = NULL;
+			policy_batch_pending = NULL;
+		}
+	}
+
+	mutex_unlock(&policy_batch_lock);
+
+	return policy_batch_open;
+}
+
+/* send the queued records, the return value tells whether all of them
+* were applied by the handler. configfs items are updated by the
+* callbacks of the records that were.
+*/
+bool policy_batch_end(void)
+{
+	bool ret = true;
+
+	mutex_lock(&policy_batch_lock);
+
+	if (policy_batch_open) {
+		ret = policy_batch_flush();
+
+		if (policy_cmd_ring_ready && !policy_cmd_ring_doorbell())
+			ret = false;
+
+		if (policy_batch_failed)
+			ret = false;
+
+		kfree(policy_batch_recs);
+		kfree(policy_batch_cmds);
+		kfree(policy_batch_pending);
+		policy_batch_recs = NULL;
+		policy_batch_cmds = NULL;
+		policy_batch_pending = NULL;
+
+		policy_batch_open = false;
+	}
+
+	mutex_unlock(&policy_batch_lock);
+
+	policy_run_done();
+
+	return ret;
+}
+
+bool policy_batch_is_open(void)
+{
+	return policy_batch_open;
+}
+
+/*-------------------------------------------------------*
+*  Function      : init_cmd_ring()
+*  Purpose: allocate the command ring registered with POLICY_INIT_LOG
+*  Parameters: ring size returned
+*  Return: ring address, NULL if policy records are sent in messages
+*-------------------------------------------------------*/
+char *init_cmd_ring(uint32_t *ring_size)
+{
+	*ring_size = 0;
+
+	policy_cmd_ring = kzalloc(CMD_RING_SIZE(POLICY_CMD_RING_SLOTS), GFP_KERNEL);
+	if (NULL == policy_cmd_ring)
+		return NULL;
+
+	policy_cmd_ring->signature = CMD_RING_SIGNATURE;
+	policy_cmd_ring->version = CMD_RING_VERSION;
+	policy_cmd_ring->num_slots = POLICY_CMD_RING_SLOTS;
+	policy_cmd_ring->slot_size = sizeof(cmd_ring_slot_t);
+	policy_cmd_ring_done = 0;
+
+	*ring_size = CMD_RING_SIZE(POLICY_CMD_RING_SLOTS);
+
+	return (char *)policy_cmd_ring;
+}
+
+/* the handler accepted the ring, records are queued from now on */
+void start_cmd_ring(void)
+{
+	mutex_lock(&policy_batch_lock);
+
+	if (policy_cmd_ring)
+		policy_cmd_ring_ready = true;
+
+	mutex_unlock(&policy_batch_lock);
+}
+
+/*-------------------------------------------------------*
+*  Function      : stop_cmd_ring()
+*  Purpose: unregister the command ring from the handler and free it
+*  Parameters: none
+*  Return: none
+*-------------------------------------------------------*/
+void stop_cmd_ring(void)
+{
+	policy_message_t msg;
+
+	mutex_lock(&policy_batch_lock);
+
+	if (policy_cmd_ring) {
+		memset(&msg, 0, sizeof(msg));
+		msg.command = POLICY_CMD_RING_STOP;
+
+		/* the handler may still read a ring it did not let go of */
+		if (SUCCESS == ikgt_hypercall(IKGT_POLICY_MSG, (char *)&msg, NULL)) {
+			/* what was left was applied first */
+			policy_cmd_ring_complete();
+			policy_cmd_ring_fail();
+			kfree(policy_cmd_ring);
+		} else {
+			PRINTK_ERROR("failed to unregister the command ring\n");
+			policy_cmd_ring_fail();
+		}
+
+		policy_cmd_ring = NULL;
+		policy_cmd_ring_ready = false;
+	}
+
+	mutex_unlock(&policy_batch_lock);
+
+	policy_run_done();
+}
+
+/*-------------------------------------------------------*
+*  Function      : init_policy_report()
+*  Purpose: get the policy in force from the handler
+*  Parameters: none
+*  Return: true=success, false=no report
+*-------------------------------------------------------*/
+bool init_policy_report(void)
+{
+	policy_message_t msg;
+	report_header_t *report = NULL;
+	ikgt_result_t ret;
+	uint32_t num_entries = RESOURCE_ID_END;
+	int tries;
+
+	/* memory ranges come after the CR and MSR entries, ask again with
+	* room for all of them if they did not fit
+	*/
+	for (tries = 0; tries < POLICY_REPORT_TRIES; tries++) {
+		vfree(report);
+
+		/* mapped page by page by the handler */
+		report = vzalloc(REPORT_SIZE(num_entries));
+		if (NULL == report)
+			return false;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.command = POLICY_REPORT;
+		msg.count = 1;
+		msg.report_param.report_addr = (char *)report;
+		msg.report_param.report_size = REPORT_SIZE(num_entries);
+
+		ret = ikgt_hypercall(IKGT_POLICY_MSG, (char *)&msg, NULL);
+
+		if ((SUCCESS != ret) || (REPORT_SIGNATURE != report->signature)
+			|| (REPORT_VERSION != report->version)
+			|| (sizeof(report_entry_t) != report->entry_size)) {
+			vfree(report);
+			return false;
+		}
+
+		if (report->num_entries == report->total_entries)
+			break;
+
+		num_entries = report->total_entries;
+	}
+
+	if (report->num_entries < report->total_entries)
+		PRINTK_WARNING("%u policy entries not reported\n",
+			report->total_entries - report->num_entries);
+
+	PRINTK_INFO("policy in force: %u entries, immutable=%u\n",
+		report->total_entries, report->flags & REPORT_FLAG_IMMUTABLE);
+
+	mutex_lock(&policy_report_lock);
+	policy_report = report;
+	mutex_unlock(&policy_report_lock);
+
+	return true;
+}
+
+void uninit_policy_report(void)
+{
+	mutex_lock(&policy_report_lock);
+	vfree(policy_report);
+	policy_report = NULL;
+	mutex_unlock(&policy_report_lock);
+}
+
+/*-------------------------------------------------------*
+*  Function      : policy_report_restore()
+*  Purpose: take the reported settings of a resource, each is handed out
+*           once, to the first configfs item created for it. A memory
+*           range is matched by the address and size already in rec.
+*  Parameters: resource id, record returned, locked returned
+*  Return: true=the resource is enabled in the handler
+*-------------------------------------------------------*/
+bool policy_report_restore(uint32_t resource_id, policy_update_rec_t *rec,
+						   bool *locked)
+{
+	report_entry_t *entry;
+	uint32_t i;
+	bool found = false;
+
+	mutex_lock(&policy_report_lock);
+
+	for (i = 0; policy_report && (i < policy_report->num_entries); i++) {
+		entry = &policy_report->entry[i];
+
+		if (POLICY_GET_RESOURCE_ID(&entry->rec) != resource_id)
+			continue;
+
+		if ((RESOURCE_ID_MEMORY == resource_id)
+			&& ((POLICY_INFO_GET_ADDR(&entry->rec) != POLICY_INFO_GET_ADDR(rec))
+			|| (POLICY_INFO_GET_SIZE(&entry->rec) != POLICY_INFO_GET_SIZE(rec))))
+			continue;
+
+		*rec = entry->rec;
+
+		/* an enabled memory range always is */
+		*locked = (POLICY_GET_WRITE_ACTION(rec) & POLICY_ACT_STICKY)
+			|| (policy_report->flags & REPORT_FLAG_IMMUTABLE)
+			|| (RESOURCE_ID_MEMORY == resource_id);
+
+		POLICY_SET_RESOURCE_ID(&entry->rec, RESOURCE_ID_UNKNOWN);
+		found = true;
+		break;
+	}
+
+	mutex_unlock(&policy_report_lock);
+
+	return found;
+}
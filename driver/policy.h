@@ -0,0 +1,46 @@
+/*
+* This is an example ikgt usage driver.
+* Copyright (c) 2015, Intel Corporation.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#ifndef _POLICY_H
+#define _POLICY_H
+
+struct config_item;
+
+/* called once the handler applied or refused a record */
+typedef void (*policy_done_fn)(struct config_item *item, uint32_t command,
+							   const policy_update_rec_t *rec, bool accepted);
+
+bool policy_send_record(uint32_t command, const policy_update_rec_t *rec,
+						struct config_item *item, policy_done_fn done);
+
+bool policy_batch_begin(void);
+
+bool policy_batch_end(void);
+
+bool policy_batch_is_open(void);
+
+char *init_cmd_ring(uint32_t *ring_size);
+
+void start_cmd_ring(void);
+
+void stop_cmd_ring(void);
+
+bool init_policy_report(void);
+
+void uninit_policy_report(void);
+
+bool policy_report_restore(uint32_t resource_id, policy_update_rec_t *rec,
+						   bool *locked);
+
+#endif /* _POLICY_H */
@@ -0,0 +1,154 @@
+/*
+* This is an example ikgt usage driver.
+* Copyright (c) 2015, Intel Corporation.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/vmalloc.h>
+
+#include "common.h"
+#include "policy_common.h"
+#include "stats.h"
+
+
+/* statistics page filled in by the handler, see stats_page_header_t */
+static char *stats_page;
+static uint32_t stats_size;
+
+static struct dentry *stats_dir;
+static struct debugfs_blob_wrapper stats_blob;
+
+
+char *init_stats(uint32_t *size)
+{
+	stats_size = PAGE_ALIGN(STATS_PAGE_SIZE(num_online_cpus()));
+
+	/* page aligned, the handler maps it page by page */
+	stats_page = vzalloc(stats_size);
+	if (NULL == stats_page) {
+		PRINTK_ERROR("failed to allocate memory for stats page\n");
+		return NULL;
+	}
+
+	PRINTK_INFO("malloc stats page at gva %#llx, size=%u\n",
+		(uint64_t)stats_page, stats_size);
+
+	if (size)
+		*size = stats_size;
+
+	return stats_page;
+}
+
+/*-------------------------------------------------------*
+*  Function      : stats_latency_open()
+*  Purpose: get the latency histograms from the handler, each open of
+*           the file reads one latency_report_t
+*  Parameters: inode, file
+*  Return: 0=success, -errno=failure
+*-------------------------------------------------------*/
+static int stats_latency_open(struct inode *inode, struct file *file)
+{
+	policy_message_t msg;
+	latency_report_t *report;
+	ikgt_result_t ret;
+
+	report = kzalloc(sizeof(latency_report_t), GFP_KERNEL);
+	if (NULL == report)
+		return -ENOMEM;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.command = POLICY_STATS_LATENCY;
+	msg.count = 1;
+	msg.report_param.report_addr = (char *)report;
+	msg.report_param.report_size = sizeof(latency_report_t);
+
+	ret = ikgt_hypercall(IKGT_POLICY_MSG, (char *)&msg, NULL);
+
+	if ((SUCCESS != ret) || (LATENCY_REPORT_SIGNATURE != report->signature)
+		|| (LATENCY_REPORT_VERSION != report->version)) {
+		kfree(report);
+		return -EIO;
+	}
+
+	file->private_data = report;
+
+	return 0;
+}
+
+static ssize_t stats_latency_read(struct file *file, char __user *buf,
+								  size_t count, loff_t *ppos)
+{
+	return simple_read_from_buffer(buf, count, ppos, file->private_data,
+		sizeof(latency_report_t));
+}
+
+static int stats_latency_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+
+	return 0;
+}
+
+static const struct file_operations stats_latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= stats_latency_open,
+	.read		= stats_latency_read,
+	.release	= stats_latency_release,
+	.llseek		= default_llseek,
+};
+
+/*
+* Expose the page as /sys/kernel/debug/ikgt_agent/stats. Readers get the
+* raw stats_page_header_t and the per cpu stats_cpu_t at STATS_CPU_OFFSET(),
+* no hypercall is involved. The latency histograms are in
+* /sys/kernel/debug/ikgt_agent/latency, a latency_report_t.
+*/
+void init_stats_debugfs(void)
+{
+	stats_page_header_t *header = (stats_page_header_t *)stats_page;
+
+	if (NULL == stats_page)
+		return;
+
+	if ((header->signature != STATS_PAGE_SIGNATURE)
+		|| (header->version != STATS_PAGE_VERSION)) {
+		PRINTK_WARNING("stats page not set up by handler, version=%u\n",
+			header->version);
+		return;
+	}
+
+	stats_dir = debugfs_create_dir(DRIVER_NAME, NULL);
+	if (IS_ERR_OR_NULL(stats_dir)) {
+		stats_dir = NULL;
+		return;
+	}
+
+	stats_blob.data = stats_page;
+	stats_blob.size = stats_size;
+
+	debugfs_create_blob("stats", S_IRUSR | S_IRGRP, stats_dir, &stats_blob);
+
+	debugfs_create_file("latency", S_IRUSR | S_IRGRP, stats_dir, NULL,
+		&stats_latency_fops);
+}
+
+void uninit_stats_debugfs(void)
+{
+	debugfs_remove_recursive(stats_dir);
+	stats_dir = NULL;
+
+	/* the handler keeps writing the page, so it is not freed here,
+	* same as the log buffer
+	*/
+}
@@ -0,0 +1,24 @@
+/*
+* This is an example ikgt usage driver.
+* Copyright (c) 2015, Intel Corporation.
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms and conditions of the GNU General Public License,
+* version 2, as published by the Free Software Foundation.
+*
+* This program is distributed in the hope it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+* more details.
+*/
+
+#ifndef _STATS_H
+#define _STATS_H
+
+char *init_stats(uint32_t *size);
+
+void init_stats_debugfs(void);
+
+void uninit_stats_debugfs(void);
+
+#endif /* _STATS_H */
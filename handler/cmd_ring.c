@@ -0,0 +1,285 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#include "handler.h"
+#include "policy.h"
+#include "utils.h"
+#include "stats.h"
+#include "epoch.h"
+#include "cmd_ring.h"
+
+
+/* records applied with one policy update */
+#define CMD_RING_BATCH 64
+
+#define CMD_RING_SLOT_OFFSET(idx) \
+	(__builtin_offsetof(cmd_ring_t, slot) + (uint64_t)(idx) * sizeof(cmd_ring_slot_t))
+
+/* the ring mapped page by page, a slot may cross a page. head and tail are
+* 64 byte aligned and never do.
+*/
+static util_page_map_t *g_cmd_ring;
+static uint32_t g_cmd_ring_slots;
+static uint64_t g_cmd_ring_tail; /* private copy, ring->tail is only written */
+static handler_lock_t g_cmd_ring_lock;
+
+/* records copied out of the ring, the agent may still write to the slots */
+static policy_update_rec_t *g_cmd_ring_recs;
+static uint32_t g_cmd_ring_status[CMD_RING_BATCH];
+
+
+static inline uint64_t *cmd_ring_head(const util_page_map_t *ring)
+{
+	return (uint64_t *)util_page_map_ptr(ring, __builtin_offsetof(cmd_ring_t, head));
+}
+
+static inline uint64_t *cmd_ring_tail(const util_page_map_t *ring)
+{
+	return (uint64_t *)util_page_map_ptr(ring, __builtin_offsetof(cmd_ring_t, tail));
+}
+
+/* command and resource id of the slot of a record */
+static uint32_t cmd_ring_peek(const util_page_map_t *ring, uint64_t seq,
+							  uint32_t *resource_id)
+{
+	uint64_t offset = CMD_RING_SLOT_OFFSET(seq & (g_cmd_ring_slots - 1));
+	uint32_t command;
+
+	util_page_map_read(ring, offset + __builtin_offsetof(cmd_ring_slot_t, rec.resource_id),
+		resource_id, sizeof(uint32_t));
+	util_page_map_read(ring, offset + __builtin_offsetof(cmd_ring_slot_t, command),
+		&command, sizeof(uint32_t));
+
+	return command;
+}
+
+static void cmd_ring_read_rec(const util_page_map_t *ring, uint64_t seq,
+							  policy_update_rec_t *rec)
+{
+	util_page_map_read(ring, CMD_RING_SLOT_OFFSET(seq & (g_cmd_ring_slots - 1))
+		+ __builtin_offsetof(cmd_ring_slot_t, rec), rec, sizeof(policy_update_rec_t));
+}
+
+/* the slots are released to the agent with the tail after this */
+static void cmd_ring_write_status(const util_page_map_t *ring, uint64_t seq,
+								  uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		util_page_map_write(ring, CMD_RING_SLOT_OFFSET((seq + i) & (g_cmd_ring_slots - 1))
+			+ __builtin_offsetof(cmd_ring_slot_t, status),
+			&g_cmd_ring_status[i], sizeof(uint32_t));
+	}
+}
+
+/* Function Name: cmd_ring_apply
+* Purpose: apply the records queued on the command ring. Runs of records
+*          with the same command are applied with one policy update.
+*          Memory ranges are translated with the address space of the
+*          current cpu, outside of a message it can be any process or
+*          mode, they are left on the ring for the doorbell.
+*
+* Input: IKGT Event Info, the ring, TRUE from a message of the agent
+* Return value: none. Called under g_cmd_ring_lock.
+*/
+static void cmd_ring_apply(ikgt_event_info_t *event_info,
+						   util_page_map_t *ring, boolean_t from_agent)
+{
+	uint64_t head, tail, first;
+	uint32_t command, next_command, count, i;
+	uint32_t resource_id;
+
+	head = __atomic_load_n(cmd_ring_head(ring), __ATOMIC_ACQUIRE);
+	tail = g_cmd_ring_tail;
+
+	if (head - tail > g_cmd_ring_slots) {
+		ikgt_printf("Error, command ring head=%llu, tail=%llu\n", head, tail);
+		tail = head;
+	}
+
+	while (tail != head) {
+		command = cmd_ring_peek(ring, tail, &resource_id);
+		if (!from_agent && (RESOURCE_ID_MEMORY == resource_id))
+			break;
+
+		count = 0;
+		first = tail;
+
+		do {
+			cmd_ring_read_rec(ring, tail, &g_cmd_ring_recs[count++]);
+			tail++;
+
+			if ((tail == head) || (CMD_RING_BATCH == count))
+				break;
+
+			next_command = cmd_ring_peek(ring, tail, &resource_id);
+		} while ((next_command == command)
+			&& (from_agent || (RESOURCE_ID_MEMORY != resource_id)));
+
+		STATS_ADD(stats_get_cpu(event_info->thread_id), STATS_CMD_RING, count);
+
+		if (POLICY_ENTRY_ENABLE == command) {
+			handle_msg_policy_enable(event_info, g_cmd_ring_recs, count,
+				g_cmd_ring_status);
+		} else if (POLICY_ENTRY_DISABLE == command) {
+			handle_msg_policy_disable(event_info, g_cmd_ring_recs, count,
+				g_cmd_ring_status);
+		} else {
+			ikgt_printf("Error, command %u on the command ring\n", command);
+			for (i = 0; i < count; i++)
+				g_cmd_ring_status[i] = POLICY_REC_FAILED;
+		}
+
+		cmd_ring_write_status(ring, first, count);
+	}
+
+	g_cmd_ring_tail = tail;
+	__atomic_store_n(cmd_ring_tail(ring), tail, __ATOMIC_RELEASE);
+}
+
+/* Function Name: stop_cmd_ring
+* Purpose: unregister the command ring, what is still queued is applied
+*          first. The agent may free the ring once this returns.
+*
+* Input: IKGT Event Info
+* Return value: none
+*/
+void stop_cmd_ring(ikgt_event_info_t *event_info)
+{
+	util_page_map_t *ring;
+
+	handler_lock(&g_cmd_ring_lock);
+
+	ring = g_cmd_ring;
+	if (ring) {
+		cmd_ring_apply(event_info, ring, TRUE);
+		__atomic_store_n(&g_cmd_ring, NULL, __ATOMIC_RELEASE);
+	}
+
+	handler_unlock(&g_cmd_ring_lock);
+
+	/* other cpus may still be checking its head */
+	if (ring)
+		epoch_retire(ring, NULL);
+}
+
+/* Function Name: start_cmd_ring
+* Purpose: register the command ring of the agent. A ring registered by
+*          an earlier load of the agent is drained and replaced.
+*
+* Input: IKGT Event Info, init message carrying the ring
+* Return value: none
+*/
+void start_cmd_ring(ikgt_event_info_t *event_info, log_message_t *msg)
+{
+	util_page_map_t *ring;
+	cmd_ring_t header;
+
+	if ((NULL == msg) || (NULL == msg->cmd_ring_addr))
+		return;
+
+	if (msg->cmd_ring_size < CMD_RING_SIZE(1))
+		return;
+
+	/* head and tail must not cross a page */
+	if ((uint64_t)msg->cmd_ring_addr & 63)
+		return;
+
+	ring = util_map_gva_range(event_info, (uint64_t)msg->cmd_ring_addr,
+		msg->cmd_ring_size);
+	if (NULL == ring)
+		return;
+
+	util_page_map_read(ring, 0, &header, sizeof(header));
+
+	if ((CMD_RING_SIGNATURE != header.signature)
+		|| (CMD_RING_VERSION != header.version)
+		|| (sizeof(cmd_ring_slot_t) != header.slot_size)
+		|| (0 == header.num_slots)
+		|| (header.num_slots & (header.num_slots - 1))
+		|| (CMD_RING_SIZE((uint64_t)header.num_slots) > msg->cmd_ring_size)) {
+		ikgt_printf("Error, invalid command ring\n");
+		ikgt_free((uint64_t *)ring);
+		return;
+	}
+
+	if (NULL == g_cmd_ring_recs) {
+		g_cmd_ring_recs = (policy_update_rec_t *)ikgt_malloc(
+			CMD_RING_BATCH * sizeof(policy_update_rec_t));
+		if (NULL == g_cmd_ring_recs) {
+			ikgt_free((uint64_t *)ring);
+			return;
+		}
+	}
+
+	/* an agent loaded again without unregistering its last ring */
+	stop_cmd_ring(event_info);
+
+	handler_lock(&g_cmd_ring_lock);
+
+	/* the geometry is not read from the shared page again */
+	g_cmd_ring_slots = header.num_slots;
+	g_cmd_ring_tail = header.tail;
+
+	__atomic_store_n(&g_cmd_ring, ring, __ATOMIC_RELEASE);
+
+	handler_unlock(&g_cmd_ring_lock);
+
+	DPRINTF("%s: ring=%llx, slots=%u, pages=%u\n", __func__,
+		msg->cmd_ring_addr, g_cmd_ring_slots, ring->num_pages);
+}
+
+/* Function Name: cmd_ring_drain
+* Purpose: apply the records queued on the command ring
+*
+* Input: IKGT Event Info, TRUE on POLICY_CMD_DOORBELL, FALSE on other exits
+* Return value: none
+*/
+void cmd_ring_drain(ikgt_event_info_t *event_info, boolean_t doorbell)
+{
+	util_page_map_t *ring;
+
+	ring = __atomic_load_n(&g_cmd_ring, __ATOMIC_ACQUIRE);
+	if (NULL == ring)
+		return;
+
+	/* the common case on every exit, nothing queued */
+	if (__atomic_load_n(cmd_ring_head(ring), __ATOMIC_RELAXED) == g_cmd_ring_tail)
+		return;
+
+	/* the doorbell waits for a cpu already draining the ring */
+	if (doorbell)
+		handler_lock(&g_cmd_ring_lock);
+	else if (!handler_trylock(&g_cmd_ring_lock))
+		return;
+
+	/* replaced or stopped meanwhile */
+	if (ring == g_cmd_ring)
+		cmd_ring_apply(event_info, ring, doorbell);
+
+	handler_unlock(&g_cmd_ring_lock);
+}
+
+void cmd_ring_debug(uint64_t command_code)
+{
+	ikgt_printf("%s(%u)\n", __func__, command_code);
+
+	ikgt_printf("cmd_ring=%p, slots=%u, tail=%llu\n",
+		g_cmd_ring, g_cmd_ring_slots, g_cmd_ring_tail);
+	ikgt_printf("cmd_ring_records=%llu\n", stats_sum(STATS_CMD_RING));
+
+	ikgt_printf("\n");
+}
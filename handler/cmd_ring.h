@@ -0,0 +1,28 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+#ifndef _CMD_RING_H_
+#define _CMD_RING_H_
+
+void start_cmd_ring(ikgt_event_info_t *event_info, log_message_t *msg);
+
+void stop_cmd_ring(ikgt_event_info_t *event_info);
+
+void cmd_ring_drain(ikgt_event_info_t *event_info, boolean_t doorbell);
+
+void cmd_ring_debug(uint64_t command_code);
+
+#endif /* _CMD_RING_H_ */
@@ -17,10 +17,46 @@
 #include "handler.h"
 #include "policy.h"
 #include "log.h"
+#include "stats.h"
+#include "utils.h"
 
 
-static uint64_t g_cpu_reg_count;
-static uint64_t g_cpu_msr_count;
+/* per cpu control register shadows, see cr_shadow_t */
+typedef struct {
+	cr_shadow_t cr0;
+	cr_shadow_t cr4;
+} CACHE_ALIGNED cpu_cr_shadow_t;
+
+static cpu_cr_shadow_t *g_cr_shadow;
+static uint16_t g_cr_shadow_num_of_cpus;
+
+
+boolean_t cpu_initialize(uint16_t num_of_cpus)
+{
+	g_cr_shadow = util_alloc_percpu(num_of_cpus, sizeof(cpu_cr_shadow_t));
+	if (NULL == g_cr_shadow)
+		return FALSE;
+
+	g_cr_shadow_num_of_cpus = num_of_cpus;
+
+	return TRUE;
+}
+
+cr_shadow_t *cpu_get_cr0_shadow(uint16_t cpu_id)
+{
+	if (cpu_id >= g_cr_shadow_num_of_cpus)
+		return NULL;
+
+	return &g_cr_shadow[cpu_id].cr0;
+}
+
+cr_shadow_t *cpu_get_cr4_shadow(uint16_t cpu_id)
+{
+	if (cpu_id >= g_cr_shadow_num_of_cpus)
+		return NULL;
+
+	return &g_cr_shadow[cpu_id].cr4;
+}
 
 
 /* Function name: handle_cpu_event
@@ -35,6 +71,13 @@ static uint64_t g_cpu_msr_count;
 void handle_cpu_event(ikgt_event_info_t *event_info)
 {
 	ikgt_cpu_event_info_t *cpuinfo;
+	stats_cpu_t *stats;
+	stats_latency_t *latency;
+	uint64_t tsc;
+
+	tsc = stats_rdtsc();
+	stats = stats_get_cpu(event_info->thread_id);
+	latency = stats_get_latency(event_info->thread_id);
 
 	cpuinfo = (ikgt_cpu_event_info_t *)(event_info->event_specific_data);
 
@@ -44,15 +87,17 @@ void handle_cpu_event(ikgt_event_info_t *event_info)
 		break;
 
 	case IKGT_CPU_EVENT_OP_REG:
-		g_cpu_reg_count++;
+		STATS_INC(stats, STATS_CPU_REG);
 
 		switch (cpuinfo->event_reg) {
 		case IKGT_CPU_REG_CR0:
 			handle_cr0_event(event_info);
+			stats_latency(latency, STATS_EVENT_CR0, STATS_PHASE_TOTAL, &tsc);
 			break;
 
 		case IKGT_CPU_REG_CR4:
 			handle_cr4_event(event_info);
+			stats_latency(latency, STATS_EVENT_CR4, STATS_PHASE_TOTAL, &tsc);
 			break;
 
 		default:
@@ -62,8 +107,9 @@ void handle_cpu_event(ikgt_event_info_t *event_info)
 
 	/* MSR Write */
 	case IKGT_CPU_EVENT_OP_MSR:
-		g_cpu_msr_count++;
+		STATS_INC(stats, STATS_CPU_MSR);
 		handle_msr_event(event_info);
+		stats_latency(latency, STATS_EVENT_MSR, STATS_PHASE_TOTAL, &tsc);
 		break;
 
 	default:
@@ -75,7 +121,7 @@ void cpu_debug(uint64_t command_code)
 {
 	ikgt_printf("%s(%u)\n", __func__, command_code);
 
-	ikgt_printf("g_cpu_reg_count=%u\n", g_cpu_reg_count);
+	ikgt_printf("cpu_reg_count=%llu\n", stats_sum(STATS_CPU_REG));
 
-	ikgt_printf("g_cpu_msr_count=%u\n", g_cpu_msr_count);
+	ikgt_printf("cpu_msr_count=%llu\n", stats_sum(STATS_CPU_MSR));
 }
\ No newline at end of file
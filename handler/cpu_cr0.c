@@ -17,20 +17,19 @@
 #include "utils.h"
 #include "policy.h"
 #include "log.h"
-
-/* for debugging purpose */
-static uint64_t g_cr0_count;
-static uint64_t g_cr0_allow_count;
-static uint64_t g_cr0_skip_count;
-static uint64_t g_cr0_sticky_count_allow;
-static uint64_t g_cr0_sticky_count_skip;
+#include "stats.h"
 
 
 typedef struct _policy_cr0_ctx {
 	ikgt_event_info_t *event_info;
+	const policy_snapshot_t *snap;
+	stats_cpu_t *stats;
 	uint64_t new_cr0_value;
 	uint64_t cur_cr0_value;
-	uint64_t diff;
+	uint64_t changed; /* changing bits covered by the policy */
+	uint64_t skip;
+	uint64_t sticky;
+	uint64_t sticky_skip; /* sticky bits forced back */
 	boolean_t log;
 } policy_cr0_ctx;
 
@@ -54,7 +53,7 @@ static cr0_res_id_mask_map cr0_res_id_mask_table[] = {
 };
 
 
-static uint64_t cr0_res_id_to_mask(RESOURCE_ID resource_id)
+uint64_t cr0_res_id_to_mask(RESOURCE_ID resource_id)
 {
 	int i;
 	int num_entries;
@@ -70,37 +69,43 @@ static uint64_t cr0_res_id_to_mask(RESOURCE_ID resource_id)
 	return 0;
 }
 
-static boolean_t process_cr0_policy(policy_entry_t *entry,
-									policy_cr0_ctx *ctx)
+static void process_cr0_policy(const policy_cr_masks_t *masks,
+								policy_cr0_ctx *ctx)
 {
-	uint64_t mask;
-
-	mask = cr0_res_id_to_mask(entry->resource_id);
-	if (0 == (mask & ctx->diff))
-		return FALSE;
-
-	if (POLICY_ENTRY_W_HAS_LOG(entry))
-		ctx->log = TRUE;
-
-	if (POLICY_ENTRY_HAS_STICKY(entry)) {
-		if (((ctx->new_cr0_value & mask) && (0 == (POLICY_GET_STICKY_VALUE(entry) & 1)))
-			|| ((0 == (ctx->new_cr0_value & mask)) && (POLICY_GET_STICKY_VALUE(entry) & 1))
-			) {
-				ctx->new_cr0_value ^= mask;
-				g_cr0_sticky_count_skip++;
-		} else {
-			g_cr0_sticky_count_allow++;
-		}
-	} else if (POLICY_ENTRY_W_HAS_SKIP(entry)) {
-		ctx->new_cr0_value ^= mask;
-		g_cr0_skip_count++;
-	} else {
-		g_cr0_allow_count++;
-	}
+	uint64_t skip, sticky;
+
+	skip = ctx->changed & masks->skip_mask;
+	sticky = ctx->changed & masks->sticky_mask;
 
-	POLICY_ENTRY_INC_ACCESS_COUNT(entry);
+	ctx->skip = skip;
+	ctx->sticky = sticky;
+	ctx->sticky_skip = sticky & (ctx->new_cr0_value ^ masks->sticky_value);
 
-	return TRUE;
+	/* skipped bits keep their current value, sticky bits their sticky value */
+	ctx->new_cr0_value = (ctx->new_cr0_value & ~skip) | (ctx->cur_cr0_value & skip);
+	ctx->new_cr0_value = (ctx->new_cr0_value & ~sticky) | (masks->sticky_value & sticky);
+
+	ctx->log = (ctx->changed & masks->log_mask) ? TRUE : FALSE;
+}
+
+/* counts the outcome of process_cr0_policy(), once the decision is final */
+static void account_cr0_policy(policy_cr0_ctx *ctx)
+{
+	uint64_t bits;
+	policy_entry_t *entry, *last_entry = NULL;
+
+	STATS_ADD(ctx->stats, STATS_CR0_ALLOW, bit_count(ctx->changed & ~(ctx->skip | ctx->sticky)));
+	STATS_ADD(ctx->stats, STATS_CR0_SKIP, bit_count(ctx->skip));
+	STATS_ADD(ctx->stats, STATS_CR0_STICKY_SKIP, bit_count(ctx->sticky_skip));
+	STATS_ADD(ctx->stats, STATS_CR0_STICKY_ALLOW, bit_count(ctx->sticky & ~ctx->sticky_skip));
+
+	for (bits = ctx->changed; bits; bits &= bits - 1) {
+		entry = policy_get_cr0_entry_by_bit(ctx->snap, __builtin_ctzll(bits));
+		if (entry != last_entry)
+			STATS_INC_ACCESS(ctx->stats, entry);
+
+		last_entry = entry;
+	}
 }
 
 void handle_cr0_event(ikgt_event_info_t *event_info)
@@ -110,13 +115,27 @@ void handle_cr0_event(ikgt_event_info_t *event_info)
 	uint64_t diff;
 	ikgt_cpu_event_info_t *cpuinfo;
 	ikgt_vmcs_guest_state_reg_id_t operand_reg_id;
+	ikgt_vmcs_guest_state_reg_id_t reg_ids[2];
+	uint64_t reg_values[2];
 	ikgt_status_t status;
-	int i;
-	policy_entry_t *entry;
+	const policy_snapshot_t *snap;
+	const policy_cr_masks_t *masks;
+	cr_shadow_t *shadow;
+	boolean_t shadow_valid;
+	uint64_t shadow_value;
+	stats_cpu_t *stats;
+	stats_latency_t *latency;
+	uint64_t tsc;
 	policy_cr0_ctx ctx;
 
 	event_info->response = IKGT_EVENT_RESPONSE_ALLOW;
-	g_cr0_count++;
+
+	stats = stats_get_cpu(event_info->thread_id);
+	STATS_INC(stats, STATS_CR0);
+
+	latency = stats_get_latency(event_info->thread_id);
+
+	tsc = stats_rdtsc();
 
 	cpuinfo = (ikgt_cpu_event_info_t *)(event_info->event_specific_data);
 
@@ -125,58 +144,112 @@ void handle_cr0_event(ikgt_event_info_t *event_info)
 		return;
 	}
 
-	status = read_guest_reg(VMCS_GUEST_STATE_CR0, &cur_cr0_value);
-	if (IKGT_STATUS_SUCCESS != status) {
-		return;
-	}
-
 	/* get the VMCS reg ID for the operand */
 	status = get_ikgt_vmcs_guest_reg_id(cpuinfo->operand_reg, &operand_reg_id);
 	if (IKGT_STATUS_SUCCESS != status) {
 		return;
 	}
 
-	/* read the guest register from VMCS
-	* new_cr0_value contains the new value to be written to cr0
+	/* the snapshot stays valid until this exit is over */
+	snap = policy_get_snapshot();
+	masks = policy_get_cr0_masks(snap);
+
+	shadow = cpu_get_cr0_shadow(event_info->thread_id);
+	shadow_valid = cr_shadow_valid(shadow, snap);
+	shadow_value = shadow_valid ? shadow->value : 0;
+
+	/* the guest lets the operand through when the handler bails out,
+	* the shadow is no longer known until the write is accounted for
 	*/
-	status = read_guest_reg(operand_reg_id, &new_cr0_value);
-	if (IKGT_STATUS_SUCCESS != status) {
-		return;
+	cr_shadow_invalidate(shadow);
+
+	/* The shadow only tells whether a monitored bit changes. It can be
+	* stale after an INIT or a change made by the hypervisor, so the
+	* policy is applied against the value in the VMCS.
+	*/
+	if (shadow_valid) {
+		status = read_guest_reg(event_info->thread_id, operand_reg_id, &new_cr0_value);
+		if (IKGT_STATUS_SUCCESS != status) {
+			return;
+		}
+
+		/* nothing covered by the policy is changing */
+		if (0 == ((shadow_value ^ new_cr0_value) & masks->monitor_mask)) {
+			STATS_INC(stats, STATS_CR0_SHADOW_HIT);
+			cr_shadow_set(shadow, snap, new_cr0_value);
+			stats_latency(latency, STATS_EVENT_CR0, STATS_PHASE_READ, &tsc);
+			return;
+		}
+
+		status = read_guest_reg(event_info->thread_id, VMCS_GUEST_STATE_CR0, &cur_cr0_value);
+		if (IKGT_STATUS_SUCCESS != status) {
+			return;
+		}
+	} else {
+		reg_ids[0] = VMCS_GUEST_STATE_CR0;
+		reg_ids[1] = operand_reg_id;
+
+		status = read_guest_regs(event_info->thread_id, 2, reg_ids, reg_values);
+		if (IKGT_STATUS_SUCCESS != status) {
+			return;
+		}
+
+		cur_cr0_value = reg_values[0];
+		new_cr0_value = reg_values[1];
 	}
 
+	STATS_INC(stats, STATS_CR0_SHADOW_MISS);
+
+	stats_latency(latency, STATS_EVENT_CR0, STATS_PHASE_READ, &tsc);
+
 	diff = cur_cr0_value ^ new_cr0_value;
-	if (0 == diff)
+
+	/* nothing covered by the policy is changing */
+	if (0 == (diff & masks->monitor_mask)) {
+		cr_shadow_set(shadow, snap, new_cr0_value);
+		stats_latency(latency, STATS_EVENT_CR0, STATS_PHASE_EVAL, &tsc);
 		return;
+	}
 
 	ctx.event_info = event_info;
+	ctx.snap = snap;
+	ctx.stats = stats;
 	ctx.new_cr0_value = new_cr0_value;
 	ctx.cur_cr0_value = cur_cr0_value;
-	ctx.diff = diff;
+	ctx.changed = diff & masks->monitor_mask;
 	ctx.log = FALSE;
 
-	for (i = 0; i < POLICY_MAX_ENTRIES; i++) {
-		entry = policy_get_entry_by_index(i);
-		if ((POLICY_GET_RESOURCE_ID(entry) == RESOURCE_ID_UNKNOWN) || !IS_CR0_ENTRY(entry))
-			continue;
+	process_cr0_policy(masks, &ctx);
 
-		process_cr0_policy(entry, &ctx);
-	}
+	account_cr0_policy(&ctx);
+
+	stats_latency(latency, STATS_EVENT_CR0, STATS_PHASE_EVAL, &tsc);
 
 	if (ctx.log) {
-		log_event(event_info);
+		/* rate limited as the lowest logged bit that is changing */
+		log_entry_event(event_info, policy_get_cr0_entry_by_bit(snap,
+			__builtin_ctzll(ctx.changed & masks->log_mask)));
+		stats_latency(latency, STATS_EVENT_CR0, STATS_PHASE_LOG, &tsc);
 	}
 
 	if (ctx.new_cr0_value == cur_cr0_value) {
+		cr_shadow_set(shadow, snap, cur_cr0_value);
 		event_info->response = IKGT_EVENT_RESPONSE_REDIRECT;
+		/* no write, the phase covers the redirect */
+		stats_latency(latency, STATS_EVENT_CR0, STATS_PHASE_WRITE, &tsc);
 		return;
 	}
 
 	/* TODO: preserve the original value */
-	status = write_guest_reg(operand_reg_id, ctx.new_cr0_value);
+	status = write_guest_reg(event_info->thread_id, operand_reg_id, ctx.new_cr0_value);
 	if (IKGT_STATUS_SUCCESS != status) {
 		ikgt_printf("error, write_guest_reg(%u)=%u\n", operand_reg_id, status);
+	} else {
+		cr_shadow_set(shadow, snap, ctx.new_cr0_value);
 	}
 
+	stats_latency(latency, STATS_EVENT_CR0, STATS_PHASE_WRITE, &tsc);
+
 	event_info->response = IKGT_EVENT_RESPONSE_ALLOW;
 }
 
@@ -184,12 +257,15 @@ void policy_cr0_dump(void)
 {
 	ikgt_printf("%s:\n", __func__);
 
-	ikgt_printf("g_cr0_count=%u\n", g_cr0_count);
-	ikgt_printf("g_cr0_allow_count=%u\n", g_cr0_allow_count);
-	ikgt_printf("g_cr0_skip_count=%u\n", g_cr0_skip_count);
+	ikgt_printf("cr0_count=%llu\n", stats_sum(STATS_CR0));
+	ikgt_printf("cr0_allow_count=%llu\n", stats_sum(STATS_CR0_ALLOW));
+	ikgt_printf("cr0_skip_count=%llu\n", stats_sum(STATS_CR0_SKIP));
+
+	ikgt_printf("cr0_sticky_count_allow=%llu\n", stats_sum(STATS_CR0_STICKY_ALLOW));
+	ikgt_printf("cr0_sticky_count_skip=%llu\n", stats_sum(STATS_CR0_STICKY_SKIP));
 
-	ikgt_printf("g_cr0_sticky_count_allow=%u\n", g_cr0_sticky_count_allow);
-	ikgt_printf("g_cr0_sticky_count_skip=%u\n", g_cr0_sticky_count_skip);
+	ikgt_printf("cr0_shadow_hit=%llu\n", stats_sum(STATS_CR0_SHADOW_HIT));
+	ikgt_printf("cr0_shadow_miss=%llu\n", stats_sum(STATS_CR0_SHADOW_MISS));
 
 	ikgt_printf("\n");
 }
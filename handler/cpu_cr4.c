@@ -17,20 +17,19 @@
 #include "utils.h"
 #include "policy.h"
 #include "log.h"
-
-/* for debugging purpose */
-static uint64_t g_cr4_count;
-static uint64_t g_cr4_allow_count;
-static uint64_t g_cr4_skip_count;
-static uint64_t g_cr4_sticky_count_allow;
-static uint64_t g_cr4_sticky_count_skip;
+#include "stats.h"
 
 
 typedef struct _policy_cr4_ctx {
 	ikgt_event_info_t *event_info;
+	const policy_snapshot_t *snap;
+	stats_cpu_t *stats;
 	uint64_t new_cr4_value;
 	uint64_t cur_cr4_value;
-	uint64_t diff;
+	uint64_t changed; /* changing bits covered by the policy */
+	uint64_t skip;
+	uint64_t sticky;
+	uint64_t sticky_skip; /* sticky bits forced back */
 	boolean_t log;
 } policy_cr4_ctx;
 
@@ -60,7 +59,7 @@ static cr4_res_id_mask_map cr4_res_id_mask_table[] = {
 };
 
 
-static uint64_t cr4_res_id_to_mask(RESOURCE_ID resource_id)
+uint64_t cr4_res_id_to_mask(RESOURCE_ID resource_id)
 {
 	int i;
 	int num_entries;
@@ -76,38 +75,43 @@ static uint64_t cr4_res_id_to_mask(RESOURCE_ID resource_id)
 	return 0;
 }
 
-static boolean_t process_cr4_policy(policy_entry_t *entry,
-									policy_cr4_ctx *ctx)
+static void process_cr4_policy(const policy_cr_masks_t *masks,
+								policy_cr4_ctx *ctx)
+{
+	uint64_t skip, sticky;
+
+	skip = ctx->changed & masks->skip_mask;
+	sticky = ctx->changed & masks->sticky_mask;
+
+	ctx->skip = skip;
+	ctx->sticky = sticky;
+	ctx->sticky_skip = sticky & (ctx->new_cr4_value ^ masks->sticky_value);
+
+	/* skipped bits keep their current value, sticky bits their sticky value */
+	ctx->new_cr4_value = (ctx->new_cr4_value & ~skip) | (ctx->cur_cr4_value & skip);
+	ctx->new_cr4_value = (ctx->new_cr4_value & ~sticky) | (masks->sticky_value & sticky);
 
+	ctx->log = (ctx->changed & masks->log_mask) ? TRUE : FALSE;
+}
+
+/* counts the outcome of process_cr4_policy(), once the decision is final */
+static void account_cr4_policy(policy_cr4_ctx *ctx)
 {
-	uint64_t mask;
-
-	mask = cr4_res_id_to_mask(entry->resource_id);
-	if (0 == (mask & ctx->diff))
-		return FALSE;
-
-	if (POLICY_ENTRY_W_HAS_LOG(entry))
-		ctx->log = TRUE;
-
-	if (POLICY_ENTRY_HAS_STICKY(entry)) {
-		if (((ctx->new_cr4_value & mask) && (0 == (POLICY_GET_STICKY_VALUE(entry) & 1)))
-			|| ((0 == (ctx->new_cr4_value & mask)) && (POLICY_GET_STICKY_VALUE(entry) & 1))
-			) {
-				ctx->new_cr4_value ^= mask;
-				g_cr4_sticky_count_skip++;
-		} else {
-			g_cr4_sticky_count_allow++;
-		}
-	} else if (POLICY_ENTRY_W_HAS_SKIP(entry)) {
-		ctx->new_cr4_value ^= mask;
-		g_cr4_skip_count++;
-	} else {
-		g_cr4_allow_count++;
-	}
+	uint64_t bits;
+	policy_entry_t *entry, *last_entry = NULL;
+
+	STATS_ADD(ctx->stats, STATS_CR4_ALLOW, bit_count(ctx->changed & ~(ctx->skip | ctx->sticky)));
+	STATS_ADD(ctx->stats, STATS_CR4_SKIP, bit_count(ctx->skip));
+	STATS_ADD(ctx->stats, STATS_CR4_STICKY_SKIP, bit_count(ctx->sticky_skip));
+	STATS_ADD(ctx->stats, STATS_CR4_STICKY_ALLOW, bit_count(ctx->sticky & ~ctx->sticky_skip));
 
-	POLICY_ENTRY_INC_ACCESS_COUNT(entry);
+	for (bits = ctx->changed; bits; bits &= bits - 1) {
+		entry = policy_get_cr4_entry_by_bit(ctx->snap, __builtin_ctzll(bits));
+		if (entry != last_entry)
+			STATS_INC_ACCESS(ctx->stats, entry);
 
-	return TRUE;
+		last_entry = entry;
+	}
 }
 
 void handle_cr4_event(ikgt_event_info_t *event_info)
@@ -117,72 +121,140 @@ void handle_cr4_event(ikgt_event_info_t *event_info)
 	uint64_t diff;
 	ikgt_cpu_event_info_t *cpuinfo;
 	ikgt_vmcs_guest_state_reg_id_t operand_reg_id;
+	ikgt_vmcs_guest_state_reg_id_t reg_ids[2];
+	uint64_t reg_values[2];
 	ikgt_status_t status;
-	int i;
-	policy_entry_t *entry;
+	const policy_snapshot_t *snap;
+	const policy_cr_masks_t *masks;
+	cr_shadow_t *shadow;
+	boolean_t shadow_valid;
+	uint64_t shadow_value;
+	stats_cpu_t *stats;
+	stats_latency_t *latency;
+	uint64_t tsc;
 	policy_cr4_ctx ctx;
 
 	event_info->response = IKGT_EVENT_RESPONSE_ALLOW;
-	g_cr4_count++;
 
-	cpuinfo = (ikgt_cpu_event_info_t *) (event_info->event_specific_data);
+	stats = stats_get_cpu(event_info->thread_id);
+	STATS_INC(stats, STATS_CR4);
+
+	latency = stats_get_latency(event_info->thread_id);
+
+	tsc = stats_rdtsc();
+
+	cpuinfo = (ikgt_cpu_event_info_t *)(event_info->event_specific_data);
 
 	if (IKGT_CPU_REG_UNKNOWN == cpuinfo->operand_reg) {
 		ikgt_printf("Error, cpuinfo->operand_reg=IKGT_CPU_REG_UNKNOWN\n");
 		return;
 	}
 
-	status = read_guest_reg(VMCS_GUEST_STATE_CR4, &cur_cr4_value);
-	if (IKGT_STATUS_SUCCESS != status) {
-		return;
-	}
-
 	/* get the VMCS reg ID for the operand */
 	status = get_ikgt_vmcs_guest_reg_id(cpuinfo->operand_reg, &operand_reg_id);
 	if (IKGT_STATUS_SUCCESS != status) {
 		return;
 	}
 
-	/* read the guest register from VMCS
-	* new_cr4_value contains the new value to be written to cr4
+	/* the snapshot stays valid until this exit is over */
+	snap = policy_get_snapshot();
+	masks = policy_get_cr4_masks(snap);
+
+	shadow = cpu_get_cr4_shadow(event_info->thread_id);
+	shadow_valid = cr_shadow_valid(shadow, snap);
+	shadow_value = shadow_valid ? shadow->value : 0;
+
+	/* the guest lets the operand through when the handler bails out,
+	* the shadow is no longer known until the write is accounted for
 	*/
-	status = read_guest_reg(operand_reg_id, &new_cr4_value);
-	if (IKGT_STATUS_SUCCESS != status) {
-		return;
+	cr_shadow_invalidate(shadow);
+
+	/* The shadow only tells whether a monitored bit changes. It can be
+	* stale after an INIT or a change made by the hypervisor, so the
+	* policy is applied against the value in the VMCS.
+	*/
+	if (shadow_valid) {
+		status = read_guest_reg(event_info->thread_id, operand_reg_id, &new_cr4_value);
+		if (IKGT_STATUS_SUCCESS != status) {
+			return;
+		}
+
+		/* nothing covered by the policy is changing */
+		if (0 == ((shadow_value ^ new_cr4_value) & masks->monitor_mask)) {
+			STATS_INC(stats, STATS_CR4_SHADOW_HIT);
+			cr_shadow_set(shadow, snap, new_cr4_value);
+			stats_latency(latency, STATS_EVENT_CR4, STATS_PHASE_READ, &tsc);
+			return;
+		}
+
+		status = read_guest_reg(event_info->thread_id, VMCS_GUEST_STATE_CR4, &cur_cr4_value);
+		if (IKGT_STATUS_SUCCESS != status) {
+			return;
+		}
+	} else {
+		reg_ids[0] = VMCS_GUEST_STATE_CR4;
+		reg_ids[1] = operand_reg_id;
+
+		status = read_guest_regs(event_info->thread_id, 2, reg_ids, reg_values);
+		if (IKGT_STATUS_SUCCESS != status) {
+			return;
+		}
+
+		cur_cr4_value = reg_values[0];
+		new_cr4_value = reg_values[1];
 	}
 
+	STATS_INC(stats, STATS_CR4_SHADOW_MISS);
+
+	stats_latency(latency, STATS_EVENT_CR4, STATS_PHASE_READ, &tsc);
+
 	diff = cur_cr4_value ^ new_cr4_value;
-	if (0 == diff)
+
+	/* nothing covered by the policy is changing */
+	if (0 == (diff & masks->monitor_mask)) {
+		cr_shadow_set(shadow, snap, new_cr4_value);
+		stats_latency(latency, STATS_EVENT_CR4, STATS_PHASE_EVAL, &tsc);
 		return;
+	}
 
 	ctx.event_info = event_info;
+	ctx.snap = snap;
+	ctx.stats = stats;
 	ctx.new_cr4_value = new_cr4_value;
 	ctx.cur_cr4_value = cur_cr4_value;
-	ctx.diff = diff;
+	ctx.changed = diff & masks->monitor_mask;
 	ctx.log = FALSE;
 
-	for (i = 0; i < POLICY_MAX_ENTRIES; i++) {
-		entry = policy_get_entry_by_index(i);
-		if ((POLICY_GET_RESOURCE_ID(entry) == RESOURCE_ID_UNKNOWN) || !IS_CR4_ENTRY(entry))
-			continue;
+	process_cr4_policy(masks, &ctx);
 
-		process_cr4_policy(entry, &ctx);
-	}
+	account_cr4_policy(&ctx);
+
+	stats_latency(latency, STATS_EVENT_CR4, STATS_PHASE_EVAL, &tsc);
 
 	if (ctx.log) {
-		log_event(event_info);
+		/* rate limited as the lowest logged bit that is changing */
+		log_entry_event(event_info, policy_get_cr4_entry_by_bit(snap,
+			__builtin_ctzll(ctx.changed & masks->log_mask)));
+		stats_latency(latency, STATS_EVENT_CR4, STATS_PHASE_LOG, &tsc);
 	}
 
 	if (ctx.new_cr4_value == cur_cr4_value) {
+		cr_shadow_set(shadow, snap, cur_cr4_value);
 		event_info->response = IKGT_EVENT_RESPONSE_REDIRECT;
+		/* no write, the phase covers the redirect */
+		stats_latency(latency, STATS_EVENT_CR4, STATS_PHASE_WRITE, &tsc);
 		return;
 	}
 
-	status = write_guest_reg(operand_reg_id, ctx.new_cr4_value);
+	status = write_guest_reg(event_info->thread_id, operand_reg_id, ctx.new_cr4_value);
 	if (IKGT_STATUS_SUCCESS != status) {
 		ikgt_printf("error, write_guest_reg(%u)=%u\n", operand_reg_id, status);
+	} else {
+		cr_shadow_set(shadow, snap, ctx.new_cr4_value);
 	}
 
+	stats_latency(latency, STATS_EVENT_CR4, STATS_PHASE_WRITE, &tsc);
+
 	event_info->response = IKGT_EVENT_RESPONSE_ALLOW;
 }
 
@@ -190,12 +262,15 @@ void policy_cr4_dump(void)
 {
 	ikgt_printf("%s:\n", __func__);
 
-	ikgt_printf("g_cr4_count=%u\n", g_cr4_count);
-	ikgt_printf("g_cr4_allow_count=%u\n", g_cr4_allow_count);
-	ikgt_printf("g_cr4_skip_count=%u\n", g_cr4_skip_count);
+	ikgt_printf("cr4_count=%llu\n", stats_sum(STATS_CR4));
+	ikgt_printf("cr4_allow_count=%llu\n", stats_sum(STATS_CR4_ALLOW));
+	ikgt_printf("cr4_skip_count=%llu\n", stats_sum(STATS_CR4_SKIP));
+
+	ikgt_printf("cr4_sticky_count_allow=%llu\n", stats_sum(STATS_CR4_STICKY_ALLOW));
+	ikgt_printf("cr4_sticky_count_skip=%llu\n", stats_sum(STATS_CR4_STICKY_SKIP));
 
-	ikgt_printf("g_cr4_sticky_count_allow=%u\n", g_cr4_sticky_count_allow);
-	ikgt_printf("g_cr4_sticky_count_skip=%u\n", g_cr4_sticky_count_skip);
+	ikgt_printf("cr4_shadow_hit=%llu\n", stats_sum(STATS_CR4_SHADOW_HIT));
+	ikgt_printf("cr4_shadow_miss=%llu\n", stats_sum(STATS_CR4_SHADOW_MISS));
 
 	ikgt_printf("\n");
 }
@@ -17,20 +17,13 @@
 #include "utils.h"
 #include "policy.h"
 #include "log.h"
-
-
-static uint64_t g_msr_count;
-static uint64_t g_msr_allow_count;
-static uint64_t g_msr_skip_count;
-
-static uint64_t g_msr_sticky_count_allow ;
-static uint64_t g_msr_sticky_count_skip;
+#include "stats.h"
 
 
 typedef struct _policy_msr_ctx {
 	ikgt_event_info_t *event_info;
+	stats_cpu_t *stats;
 	uint64_t new_value;
-	uint64_t cur_value;
 	uint32_t msr_id;
 } policy_msr_ctx;
 
@@ -41,12 +34,62 @@ typedef struct _msr_res_id_map {
 
 static msr_res_id_map msr_res_id_table[] = {
 	{IA32_MSR_EFER,         RESOURCE_ID_MSR_EFER},
+	{IA32_MSR_STAR,         RESOURCE_ID_MSR_STAR},
+	{IA32_MSR_LSTAR,        RESOURCE_ID_MSR_LSTAR},
 	{IA32_MSR_SYSENTER_CS,  RESOURCE_ID_MSR_SYSENTER_CS},
 	{IA32_MSR_SYSENTER_ESP, RESOURCE_ID_MSR_SYSENTER_ESP},
 	{IA32_MSR_SYSENTER_EIP, RESOURCE_ID_MSR_SYSENTER_EIP},
 	{IA32_MSR_SYSENTER_PAT, RESOURCE_ID_MSR_SYSENTER_PAT},
 };
 
+/* open addressed hash from MSR id to msr_res_id_table row. The hash folds
+* the high MSR range (0xC0000000) onto the low one, so the MSRs above land
+* in distinct slots; probing only kicks in if more MSRs are added.
+*/
+#define MSR_HASH_SIZE 32
+#define MSR_HASH(msr) (((msr) ^ ((msr) >> 20)) & (MSR_HASH_SIZE - 1))
+
+static msr_res_id_map *g_msr_hash[MSR_HASH_SIZE];
+
+
+void msr_policy_initialize(void)
+{
+	int i;
+	uint32_t slot;
+	int num_entries;
+
+	num_entries = ARRAY_SIZE(msr_res_id_table);
+
+	for (i = 0; i < num_entries; i++) {
+		slot = MSR_HASH(msr_res_id_table[i].msr_id);
+
+		while (g_msr_hash[slot] != NULL)
+			slot = (slot + 1) & (MSR_HASH_SIZE - 1);
+
+		g_msr_hash[slot] = &msr_res_id_table[i];
+	}
+}
+
+static msr_res_id_map *msr_lookup(uint64_t msr_id)
+{
+	uint32_t slot;
+	int i;
+
+	slot = MSR_HASH(msr_id);
+
+	for (i = 0; i < MSR_HASH_SIZE; i++) {
+		if (NULL == g_msr_hash[slot])
+			break;
+
+		if (g_msr_hash[slot]->msr_id == msr_id)
+			return g_msr_hash[slot];
+
+		slot = (slot + 1) & (MSR_HASH_SIZE - 1);
+	}
+
+	return NULL;
+}
+
 
 uint32_t res_id_to_msr(RESOURCE_ID resource_id)
 {
@@ -67,119 +110,100 @@ uint32_t res_id_to_msr(RESOURCE_ID resource_id)
 static boolean_t process_msr_policy(policy_entry_t *entry,
 									policy_msr_ctx *ctx)
 {
-	if (POLICY_ENTRY_W_HAS_LOG(entry))
-		log_event(ctx->event_info);
-
 	if (POLICY_ENTRY_HAS_STICKY(entry)) {
 		if (ctx->new_value == POLICY_GET_STICKY_VALUE(entry)) {
 			ctx->event_info->response = IKGT_EVENT_RESPONSE_ALLOW;
-			g_msr_sticky_count_allow++;
+			STATS_INC(ctx->stats, STATS_MSR_STICKY_ALLOW);
 		} else {
 			ctx->event_info->response = IKGT_EVENT_RESPONSE_REDIRECT;
-			g_msr_sticky_count_skip++;
+			STATS_INC(ctx->stats, STATS_MSR_STICKY_SKIP);
 		}
 	} else if (POLICY_ENTRY_W_HAS_SKIP(entry)) {
 		ctx->event_info->response = IKGT_EVENT_RESPONSE_REDIRECT;
-		g_msr_skip_count++;
+		STATS_INC(ctx->stats, STATS_MSR_SKIP);
 	} else {
 		ctx->event_info->response = IKGT_EVENT_RESPONSE_ALLOW;
-		g_msr_allow_count++;
+		STATS_INC(ctx->stats, STATS_MSR_ALLOW);
 	}
 
-	POLICY_ENTRY_INC_ACCESS_COUNT(entry);
+	STATS_INC_ACCESS(ctx->stats, entry);
 
 	return TRUE;
 }
 
 void handle_msr_event(ikgt_event_info_t *event_info)
 {
-	uint64_t rax, rcx, rdx, new_value, cur_value;
+	static const ikgt_vmcs_guest_state_reg_id_t msr_reg_ids[] = {
+		IA32_GP_RAX, IA32_GP_RCX, IA32_GP_RDX
+	};
+	uint64_t reg_values[ARRAY_SIZE(msr_reg_ids)];
+	uint64_t rax, rcx, rdx, new_value;
 	ikgt_cpu_event_info_t *cpuinfo;
 	ikgt_status_t status;
-	int i;
+	msr_res_id_map *msr_map;
 	policy_entry_t *entry;
+	stats_cpu_t *stats;
+	stats_latency_t *latency;
+	uint64_t tsc;
 	policy_msr_ctx ctx;
 
 	event_info->response = IKGT_EVENT_RESPONSE_ALLOW;
-	g_msr_count++;
+
+	stats = stats_get_cpu(event_info->thread_id);
+	STATS_INC(stats, STATS_MSR);
+
+	latency = stats_get_latency(event_info->thread_id);
+
+	tsc = stats_rdtsc();
 
 	cpuinfo = (ikgt_cpu_event_info_t *) (event_info->event_specific_data);
 
-	status = read_guest_reg(IA32_GP_RAX, &rax);
+	status = read_guest_regs(event_info->thread_id, ARRAY_SIZE(msr_reg_ids),
+		msr_reg_ids, reg_values);
 	if (IKGT_STATUS_SUCCESS != status)
 		return;
 
-	status = read_guest_reg(IA32_GP_RCX, &rcx);
-	if (IKGT_STATUS_SUCCESS != status)
-		return;
+	stats_latency(latency, STATS_EVENT_MSR, STATS_PHASE_READ, &tsc);
 
-	status = read_guest_reg(IA32_GP_RDX, &rdx);
-	if (IKGT_STATUS_SUCCESS != status)
-		return;
+	rax = reg_values[0];
+	rcx = reg_values[1];
+	rdx = reg_values[2];
 
 #define MAKE_U64(hi, lo) ((((hi) & 0xffffffff) << 32) | ((lo) & 0xffffffff))
 
 	new_value = MAKE_U64(rdx, rax);
 
 	/* rcx = msrid */
-	switch (rcx) {
-	case IA32_MSR_EFER:
-		status = read_guest_reg(VMCS_GUEST_STATE_EFER, &cur_value);
-		if (IKGT_STATUS_SUCCESS != status)
-			return;
-		break;
-
-	case IA32_MSR_SYSENTER_CS:
-		status = read_guest_reg(VMCS_GUEST_STATE_SYSENTER_CS, &cur_value);
-		if (IKGT_STATUS_SUCCESS != status)
-			return;
-		break;
-
-	case IA32_MSR_SYSENTER_ESP:
-		status = read_guest_reg(VMCS_GUEST_STATE_SYSENTER_ESP, &cur_value);
-		if (IKGT_STATUS_SUCCESS != status)
-			return;
-		break;
-
-	case IA32_MSR_SYSENTER_EIP:
-		status = read_guest_reg(VMCS_GUEST_STATE_SYSENTER_EIP, &cur_value);
-		if (IKGT_STATUS_SUCCESS != status)
-			return;
-		break;
-
-	case IA32_MSR_SYSENTER_PAT:
-		status = read_guest_reg(VMCS_GUEST_STATE_PAT, &cur_value);
-		if (IKGT_STATUS_SUCCESS != status)
-			return;
-		break;
-
-	default:
+	msr_map = msr_lookup(rcx);
+	entry = msr_map ? policy_get_entry_by_res_id(policy_get_snapshot(),
+		msr_map->resource_id) : NULL;
+	if (NULL == entry) {
+		stats_latency(latency, STATS_EVENT_MSR, STATS_PHASE_EVAL, &tsc);
 		return;
 	}
 
 	ctx.event_info = event_info;
+	ctx.stats = stats;
 	ctx.new_value = new_value;
-	ctx.cur_value = cur_value;
 	ctx.msr_id = rcx;
 
-	for (i = 0; i < POLICY_MAX_ENTRIES; i++) {
-		entry = policy_get_entry_by_index(i);
-		if ((POLICY_GET_RESOURCE_ID(entry) == RESOURCE_ID_UNKNOWN)
-			|| (res_id_to_msr(entry->resource_id) != ctx.msr_id))
-			continue;
+	process_msr_policy(entry, &ctx);
 
-		if (process_msr_policy(entry, &ctx))
-			break;
+	stats_latency(latency, STATS_EVENT_MSR, STATS_PHASE_EVAL, &tsc);
+
+	if (POLICY_ENTRY_W_HAS_LOG(entry)) {
+		log_entry_event(event_info, entry);
+		stats_latency(latency, STATS_EVENT_MSR, STATS_PHASE_LOG, &tsc);
 	}
 }
 
 void policy_msr_dump(void)
 {
-	ikgt_printf("g_msr_count=%u\n", g_msr_count);
-	ikgt_printf("g_msr_allow_count=%u\n", g_msr_allow_count);
-	ikgt_printf("g_msr_skip_count=%u\n", g_msr_skip_count);
-	ikgt_printf("g_msr_sticky_count_allow=%u\n", g_msr_sticky_count_allow);
-	ikgt_printf("g_msr_sticky_count_skip=%u\n", g_msr_sticky_count_skip);
+	ikgt_printf("msr_count=%llu\n", stats_sum(STATS_MSR));
+	ikgt_printf("msr_allow_count=%llu\n", stats_sum(STATS_MSR_ALLOW));
+	ikgt_printf("msr_skip_count=%llu\n", stats_sum(STATS_MSR_SKIP));
+	ikgt_printf("msr_sticky_count_allow=%llu\n", stats_sum(STATS_MSR_STICKY_ALLOW));
+	ikgt_printf("msr_sticky_count_skip=%llu\n", stats_sum(STATS_MSR_STICKY_SKIP));
 }
 
 void policy_msr_debug(uint64_t command_code)
@@ -0,0 +1,187 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#include "ikgt_handler_api.h"
+#include "handler.h"
+#include "utils.h"
+#include "epoch.h"
+
+
+/* Quiescent state based reclamation of data read by the exit path.
+*
+* Exit handlers read a published pointer with a plain load and use it until
+* the exit is over, without locks. Each cpu bumps its own counter in
+* epoch_enter() when an exit starts and in epoch_quiescent() when it is
+* done, so the counter is odd while the cpu is inside the handler. A writer
+* that replaced a published object hands the old one to epoch_retire(),
+* which samples the counters of all cpus; the object is released once every
+* cpu that was inside an exit then has left it. A cpu outside the handler,
+* idle or halted without exiting, holds no reference and is not waited for.
+* Objects are released by the next exit on any cpu that finds them due.
+*/
+
+typedef struct {
+	volatile uint64_t count; /* odd inside an exit */
+} CACHE_ALIGNED epoch_cpu_t;
+
+typedef struct _epoch_retired {
+	struct _epoch_retired *next;
+	void *obj;
+	epoch_release_fn release;
+	uint64_t count[]; /* one per cpu, sampled at retire time */
+} epoch_retired_t;
+
+static epoch_cpu_t *g_epoch_cpu;
+static uint16_t g_epoch_num_of_cpus;
+
+static handler_lock_t g_epoch_lock;
+static epoch_retired_t *g_epoch_retired;
+
+
+boolean_t epoch_initialize(uint16_t num_of_cpus)
+{
+	g_epoch_cpu = util_alloc_percpu(num_of_cpus, sizeof(epoch_cpu_t));
+	if (NULL == g_epoch_cpu)
+		return FALSE;
+
+	g_epoch_num_of_cpus = num_of_cpus;
+
+	return TRUE;
+}
+
+static void epoch_reclaim(void);
+
+/* Function Name: epoch_enter
+* Purpose: note that the cpu is about to read published data
+*
+* Input: cpu id
+* Return value: none
+*/
+void epoch_enter(uint16_t cpu_id)
+{
+	if (cpu_id >= g_epoch_num_of_cpus)
+		return;
+
+	/* a locked instruction: the odd count must be visible before any
+	* published pointer is loaded, epoch_retire() pairs with it
+	*/
+	__atomic_add_fetch(&g_epoch_cpu[cpu_id].count, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Function Name: epoch_quiescent
+* Purpose: note that the cpu holds no reference to published data anymore,
+*          and release what retired objects are due
+*
+* Input: cpu id
+* Return value: none
+*/
+void epoch_quiescent(uint16_t cpu_id)
+{
+	if (cpu_id >= g_epoch_num_of_cpus)
+		return;
+
+	/* x86 does not move earlier loads past this store, only the compiler
+	* has to be kept from doing so
+	*/
+	__asm__ __volatile__("" ::: "memory");
+
+	g_epoch_cpu[cpu_id].count++;
+
+	/* another cpu reclaiming does the job as well */
+	if ((NULL != __atomic_load_n(&g_epoch_retired, __ATOMIC_RELAXED))
+		&& handler_trylock(&g_epoch_lock)) {
+		epoch_reclaim();
+		handler_unlock(&g_epoch_lock);
+	}
+}
+
+static boolean_t epoch_grace_period_over(epoch_retired_t *retired)
+{
+	uint16_t i;
+
+	for (i = 0; i < g_epoch_num_of_cpus; i++) {
+		/* was outside the handler, or has left the exit since */
+		if ((retired->count[i] & 1) && (g_epoch_cpu[i].count == retired->count[i]))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* called with g_epoch_lock held */
+static void epoch_reclaim(void)
+{
+	epoch_retired_t **link = &g_epoch_retired;
+	epoch_retired_t *retired;
+
+	while ((retired = *link) != NULL) {
+		if (!epoch_grace_period_over(retired)) {
+			link = &retired->next;
+			continue;
+		}
+
+		*link = retired->next;
+
+		if (retired->release)
+			retired->release(retired->obj);
+		else
+			ikgt_free((uint64_t *)retired->obj);
+
+		ikgt_free((uint64_t *)retired);
+	}
+}
+
+/* Function Name: epoch_retire
+* Purpose: release an object that is no longer published once no exit can
+*          reference it anymore. Must be called after the replacement has
+*          been published.
+*
+* Input: object, release function (NULL for ikgt_free)
+* Return value: none
+*/
+void epoch_retire(void *obj, epoch_release_fn release)
+{
+	epoch_retired_t *retired;
+	uint16_t i;
+
+	if (NULL == obj)
+		return;
+
+	retired = (epoch_retired_t *)ikgt_malloc(sizeof(epoch_retired_t)
+		+ g_epoch_num_of_cpus * sizeof(uint64_t));
+	if (NULL == retired) {
+		/* leaking is the only safe option left */
+		ikgt_printf("Error, unable to retire %p\n", obj);
+		return;
+	}
+
+	retired->obj = obj;
+	retired->release = release;
+
+	/* the new pointer must be globally visible before sampling */
+	__sync_synchronize();
+
+	for (i = 0; i < g_epoch_num_of_cpus; i++)
+		retired->count[i] = g_epoch_cpu[i].count;
+
+	handler_lock(&g_epoch_lock);
+
+	retired->next = g_epoch_retired;
+	g_epoch_retired = retired;
+
+	epoch_reclaim();
+
+	handler_unlock(&g_epoch_lock);
+}
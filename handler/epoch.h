@@ -0,0 +1,31 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+/* releases a retired object, NULL means ikgt_free() */
+typedef void (*epoch_release_fn)(void *obj);
+
+boolean_t epoch_initialize(uint16_t num_of_cpus);
+
+void epoch_enter(uint16_t cpu_id);
+
+void epoch_quiescent(uint16_t cpu_id);
+
+void epoch_retire(void *obj, epoch_release_fn release);
+
+#endif /* _EPOCH_H_ */
@@ -15,6 +15,12 @@
 *******************************************************************************/
 #include "handler.h"
 #include "policy.h"
+#include "utils.h"
+#include "pool.h"
+#include "epoch.h"
+#include "stats.h"
+#include "log.h"
+#include "cmd_ring.h"
 
 
 static boolean_t g_b_init_status = FALSE;
@@ -31,7 +37,27 @@ boolean_t handler_initialize(uint16_t num_of_cpus)
 	ikgt_printf("HANDLER: Initializing Handler. Num of CPUs = %d\n",
 		num_of_cpus);
 
+	if (!utils_initialize(num_of_cpus))
+		return FALSE;
+
+	if (!pool_initialize(num_of_cpus))
+		return FALSE;
+
+	if (!epoch_initialize(num_of_cpus))
+		return FALSE;
+
+	if (!stats_initialize(num_of_cpus))
+		return FALSE;
+
+	if (!cpu_initialize(num_of_cpus))
+		return FALSE;
+
+	if (!log_initialize(num_of_cpus))
+		return FALSE;
+
 	g_b_init_status = policy_initialize();
+
+	return g_b_init_status;
 }
 
 /* Function name: handler_report_event
@@ -45,16 +71,25 @@ boolean_t handler_initialize(uint16_t num_of_cpus)
 */
 void handler_report_event(ikgt_event_info_t *event_info)
 {
+	uint64_t tsc;
+
 	/* log handler only profiling so allow all other actions by default */
 	event_info->response = IKGT_EVENT_RESPONSE_ALLOW;
 
 	if (!g_b_init_status)
 		return;
 
+	/* from here on this cpu may hold references to published data */
+	epoch_enter(event_info->thread_id);
+
+	tsc = stats_rdtsc();
+
 	/* memory events need special handling for agent */
 	switch (event_info->type) {
 	case IKGT_EVENT_TYPE_MEM:
 		handle_memory_event(event_info);
+		stats_latency(stats_get_latency(event_info->thread_id),
+			STATS_EVENT_MEM, STATS_PHASE_TOTAL, &tsc);
 		break;
 
 	case IKGT_EVENT_TYPE_CPU:
@@ -63,7 +98,15 @@ void handler_report_event(ikgt_event_info_t *event_info)
 
 	case IKGT_EVENT_TYPE_MSG:
 		handle_msg_event(event_info);
+		stats_latency(stats_get_latency(event_info->thread_id),
+			STATS_EVENT_MSG, STATS_PHASE_TOTAL, &tsc);
 		break;
 	}
+
+	/* pick up policy records the agent queued since the last exit */
+	cmd_ring_drain(event_info, FALSE);
+
+	/* this cpu no longer references the policy snapshot */
+	epoch_quiescent(event_info->thread_id);
 }
 
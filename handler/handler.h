@@ -28,6 +28,8 @@
 #endif
 
 #define IA32_MSR_EFER         0xC0000080
+#define IA32_MSR_STAR         0xC0000081
+#define IA32_MSR_LSTAR        0xC0000082
 #define IA32_MSR_SYSENTER_CS  0x174
 #define IA32_MSR_SYSENTER_ESP 0x175
 #define IA32_MSR_SYSENTER_EIP 0x176
@@ -40,8 +42,42 @@
 
 #define BIT(x) (1<<x)
 
+#define CACHE_LINE_SIZE 64
+#define CACHE_ALIGNED   __attribute__((aligned(CACHE_LINE_SIZE)))
+
+/* simple test-and-set spin lock for the rare paths shared by all cpus */
+typedef volatile uint32_t handler_lock_t;
+
+static inline void handler_lock(handler_lock_t *lock)
+{
+	while (__sync_lock_test_and_set(lock, 1)) {
+		while (*lock)
+			__asm__ __volatile__("pause" ::: "memory");
+	}
+}
+
+static inline boolean_t handler_trylock(handler_lock_t *lock)
+{
+	return (0 == __sync_lock_test_and_set(lock, 1)) ? TRUE : FALSE;
+}
+
+static inline void handler_unlock(handler_lock_t *lock)
+{
+	__sync_lock_release(lock);
+}
+
 #define min(X, Y) ((X) < (Y) ? (X) : (Y))
 
+/* number of set bits, without relying on the popcnt instruction */
+static inline uint32_t bit_count(uint64_t x)
+{
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+
+	return (uint32_t)((x * 0x0101010101010101ULL) >> 56);
+}
+
 typedef enum {
 	EXECUTE_VIOLATION,
 	WRITE_VIOLATION,
@@ -51,6 +87,7 @@ typedef enum {
 } violation_type_t;
 
 void *mon_memset(void *dest, int filler, uint64_t count);
+boolean_t cpu_initialize(uint16_t num_of_cpus);
 void handle_cpu_event(ikgt_event_info_t *event_info);
 void handle_memory_event(ikgt_event_info_t *event_info);
 void handle_msg_event(ikgt_event_info_t *event_info);
@@ -58,6 +95,7 @@ void handle_msg_event(ikgt_event_info_t *event_info);
 void handle_msg_debug(ikgt_event_info_t *event_info, debug_message_t *msg);
 
 void memory_debug(uint64_t command_code);
+void pool_debug(uint64_t command_code);
 void cpu_debug(uint64_t command_code);
 void log_debug(uint64_t command_code);
 
@@ -16,6 +16,9 @@
 #include "handler.h"
 #include "utils.h"
 #include "log.h"
+#include "stats.h"
+#include "epoch.h"
+#include "page_walk.h"
 
 
 /* hva to store logging data allocated by agent and passed to handler.
@@ -24,6 +27,24 @@
 */
 static log_entry_t *g_log_data_hva;
 
+/* Buffer in the v2 layout, mapped page by page. A new map replaces the old
+* one when the agent resizes the rings, the old one is released once no
+* exit can be writing through it. The geometry is checked once and not
+* read from the shared header again.
+*/
+typedef struct {
+	uint32_t num_pages;
+	uint32_t num_of_cpus;
+	uint32_t mask;        /* records per cpu - 1 */
+	uint32_t ring_offset;
+	uint64_t *gva;        /* of each page, as sent by the agent */
+	uint64_t *gpa;
+	void *hva[];
+} log_ring_map_t;
+
+static log_ring_map_t *g_log_map;
+static handler_lock_t g_log_map_lock;
+
 /* VMEXIT log mask by VMEXIT reason: each VMEXIT reason uses a bit in the */
 /* mask and set the bit means not recording it */
 static uint64_t g_log_mask = 0x400;
@@ -31,10 +52,262 @@ static uint64_t g_log_mask = 0x400;
 static uint32_t g_log_size;
 static uint64_t g_log_gva;
 
-static void log_buffer_add_record(log_entry_t cpu_log_buffer_start[],
-								  uint64_t rip, uint32_t reason, uint64_t qualification,
-								  uint64_t gva);
+/* log rate limit, a token bucket per cpu and resource id. Bucket 0 is not
+* a resource id and is used for memory events.
+*/
+typedef struct {
+	uint64_t last_tsc; /* last refill, 0 if never used */
+	uint64_t interval; /* of the last suppressed event */
+	uint32_t tokens;
+	uint32_t suppressed; /* events not logged since the last record */
+} log_bucket_t;
+
+/* pages written since the last log epoch, a bloom filter over the guest
+* page number. A false positive leaves the first write to a page unlogged,
+* which with two probes stays rare up to some hundreds of pages per epoch.
+*/
+#define LOG_DEDUP_BITS 8192
+
+typedef struct {
+	uint64_t epoch; /* g_log_epoch the filter was cleared for */
+	uint64_t bits[LOG_DEDUP_BITS / 64];
+} log_dedup_t;
+
+typedef struct {
+	log_bucket_t bucket[RESOURCE_ID_END];
+	uint32_t num_suppressed; /* buckets with suppressed events */
+	log_dedup_t dedup;
+} CACHE_ALIGNED log_cpu_t;
+
+static log_cpu_t *g_log_cpu;
+static uint16_t g_log_num_of_cpus;
+
+/* rate limit of memory events, set by the agent with the log buffer */
+static uint64_t g_mem_log_interval;
+static uint32_t g_mem_log_burst;
+
+static uint32_t g_log_flags;
+
+/* advanced by POLICY_LOG_EPOCH, cpus clear their filter when they see it */
+static uint64_t g_log_epoch = 1;
+
+static boolean_t log_buffer_add_record(uint16_t cpuid,
+									   uint64_t rip, uint32_t reason, uint64_t qualification,
+									   uint64_t gva);
+
+
+static inline boolean_t log_buffer_ready(void)
+{
+	return (g_log_data_hva || g_log_map) ? TRUE : FALSE;
+}
+
+boolean_t log_initialize(uint16_t num_of_cpus)
+{
+	g_log_cpu = util_alloc_percpu(num_of_cpus, sizeof(log_cpu_t));
+	if (NULL == g_log_cpu)
+		return FALSE;
+
+	g_log_num_of_cpus = num_of_cpus;
+
+	return TRUE;
+}
+
+/* take a token from the bucket, refilled by one token per interval up to
+* burst tokens
+*/
+static boolean_t log_bucket_take(log_bucket_t *bucket, uint64_t interval,
+								 uint32_t burst)
+{
+	uint64_t now, refill;
+
+	if (0 == interval)
+		return TRUE;
+
+	if (0 == burst)
+		burst = 1;
+
+	now = stats_rdtsc();
+
+	if (bucket->tokens > burst)
+		bucket->tokens = burst;
+
+	if (0 == bucket->last_tsc) {
+		bucket->tokens = burst;
+		bucket->last_tsc = now;
+	} else if ((now - bucket->last_tsc) >= interval) {
+		refill = (now - bucket->last_tsc) / interval;
+
+		if (refill >= (burst - bucket->tokens)) {
+			bucket->tokens = burst;
+			bucket->last_tsc = now;
+		} else {
+			bucket->tokens += refill;
+			bucket->last_tsc += refill * interval;
+		}
+	}
+
+	if (0 == bucket->tokens)
+		return FALSE;
+
+	bucket->tokens--;
 
+	return TRUE;
+}
+
+/* Function Name: log_flush_suppressed
+* Purpose: add the LOG_REASON_SUPPRESSED record of each bucket of a cpu
+*          that has refilled since it dropped events, whether or not that
+*          resource logs again
+*
+* Input: cpu id
+* Return value: none
+*/
+static void log_flush_suppressed(uint16_t cpuid)
+{
+	log_cpu_t *cpu = &g_log_cpu[cpuid];
+	log_bucket_t *bucket;
+	uint64_t now;
+	uint32_t i;
+
+	if (0 == cpu->num_suppressed)
+		return;
+
+	now = stats_rdtsc();
+
+	for (i = 0; i < RESOURCE_ID_END; i++) {
+		bucket = &cpu->bucket[i];
+
+		if ((0 == bucket->suppressed) || ((now - bucket->last_tsc) < bucket->interval))
+			continue;
+
+		log_buffer_add_record(cpuid,
+			0, LOG_REASON_SUPPRESSED, bucket->suppressed, i);
+
+		bucket->suppressed = 0;
+		cpu->num_suppressed--;
+	}
+}
+
+/* Function Name: log_event_limited
+* Purpose: add event to buffer unless the resource is over its log rate.
+*          Events dropped by the limit are reported by a single
+*          LOG_REASON_SUPPRESSED record once their bucket refills, with
+*          the next event this cpu logs or drops for any resource.
+*
+* Input: IKGT Event Info, bucket (resource id, 0 for memory events),
+*        TSC cycles per log token (0 for no limit), max saved up tokens
+* Return value: none
+*/
+boolean_t log_event_limited(ikgt_event_info_t *event_info, uint32_t bucket_id,
+							uint64_t interval, uint32_t burst)
+{
+	log_bucket_t *bucket;
+	uint16_t cpuid = event_info->thread_id;
+
+	if ((cpuid >= g_log_num_of_cpus) || (bucket_id >= RESOURCE_ID_END)
+		|| !log_buffer_ready()) {
+		log_event(event_info);
+		return TRUE;
+	}
+
+	log_flush_suppressed(cpuid);
+
+	bucket = &g_log_cpu[cpuid].bucket[bucket_id];
+
+	if (!log_bucket_take(bucket, interval, burst)) {
+		/* skips the cost of ikgt_get_vmexit_reason() as well */
+		if (0 == bucket->suppressed++)
+			g_log_cpu[cpuid].num_suppressed++;
+		bucket->interval = interval;
+		STATS_INC(stats_get_cpu(cpuid), STATS_LOG_SUPPRESSED);
+		return FALSE;
+	}
+
+	/* left over if the rate limit was changed meanwhile */
+	if (bucket->suppressed) {
+		log_buffer_add_record(cpuid,
+			0, LOG_REASON_SUPPRESSED, bucket->suppressed, bucket_id);
+
+		bucket->suppressed = 0;
+		g_log_cpu[cpuid].num_suppressed--;
+	}
+
+	log_event(event_info);
+
+	return TRUE;
+}
+
+/* the two filter bits of a guest page, from a multiplicative hash */
+static inline void log_dedup_hash(uint64_t gpa, uint32_t *bit0, uint32_t *bit1)
+{
+	uint64_t hash = (gpa >> PAGE_SHIFT) * 0x9E3779B97F4A7C15ULL;
+
+	*bit0 = (uint32_t)(hash >> 51) & (LOG_DEDUP_BITS - 1);
+	*bit1 = (uint32_t)(hash >> 38) & (LOG_DEDUP_BITS - 1);
+}
+
+#define LOG_DEDUP_TEST(d, b) ((d)->bits[(b) / 64] & (1ULL << ((b) % 64)))
+#define LOG_DEDUP_SET(d, b)  ((d)->bits[(b) / 64] |= (1ULL << ((b) % 64)))
+
+/* Function Name: log_memory_write
+* Purpose: log a write violation within a rate limit. With
+*          LOG_FLAG_MEM_WRITE_ONCE, pages already logged by this cpu in
+*          the current log epoch are not logged again.
+*
+* Input: IKGT Event Info, gpa written, rate limit as log_event_limited()
+* Return value: none
+*/
+void log_memory_write(ikgt_event_info_t *event_info, uint64_t gpa,
+					  uint32_t bucket_id, uint64_t interval, uint32_t burst)
+{
+	log_dedup_t *dedup;
+	uint64_t epoch;
+	uint32_t bit0, bit1;
+	uint16_t cpuid = event_info->thread_id;
+
+	if (!(g_log_flags & LOG_FLAG_MEM_WRITE_ONCE) || (cpuid >= g_log_num_of_cpus)) {
+		log_event_limited(event_info, bucket_id, interval, burst);
+		return;
+	}
+
+	dedup = &g_log_cpu[cpuid].dedup;
+
+	epoch = __atomic_load_n(&g_log_epoch, __ATOMIC_RELAXED);
+	if (dedup->epoch != epoch) {
+		mon_memset(dedup->bits, 0, sizeof(dedup->bits));
+		dedup->epoch = epoch;
+	}
+
+	log_dedup_hash(gpa, &bit0, &bit1);
+
+	if (LOG_DEDUP_TEST(dedup, bit0) && LOG_DEDUP_TEST(dedup, bit1)) {
+		STATS_INC(stats_get_cpu(cpuid), STATS_LOG_DEDUP);
+		return;
+	}
+
+	/* a write dropped by the rate limit is logged on the next one */
+	if (log_event_limited(event_info, bucket_id, interval, burst)) {
+		LOG_DEDUP_SET(dedup, bit0);
+		LOG_DEDUP_SET(dedup, bit1);
+	}
+}
+
+void log_memory_event(ikgt_event_info_t *event_info, uint64_t gpa)
+{
+	log_memory_write(event_info, gpa, 0, g_mem_log_interval, g_mem_log_burst);
+}
+
+/* Function Name: log_advance_epoch
+* Purpose: start a new log epoch, pages are logged once again on their
+*          next write. Sent by the agent once it has read the log.
+*
+* Input: IKGT Event Info
+* Return value: none
+*/
+void log_advance_epoch(ikgt_event_info_t *event_info)
+{
+	__atomic_add_fetch(&g_log_epoch, 1, __ATOMIC_RELAXED);
+}
 
 /* Function Name: log_event
 * Purpose: add event to buffer
@@ -45,8 +318,7 @@ static void log_buffer_add_record(log_entry_t cpu_log_buffer_start[],
 void log_event(ikgt_event_info_t *event_info)
 {
 	ikgt_vmexit_reason_t reason;
-	log_entry_t *cpu_log_buffer; /* per cpu log buffer */
-	uint64_t cpuid = event_info->thread_id;
+	uint16_t cpuid = event_info->thread_id;
 
 	ikgt_get_vmexit_reason(&reason);
 	if ((1L << reason.reason) & g_log_mask) {
@@ -54,16 +326,156 @@ void log_event(ikgt_event_info_t *event_info)
 		return;
 	}
 
-	if (NULL == g_log_data_hva) {
+	if (!log_buffer_ready()) {
+		STATS_INC(stats_get_cpu(cpuid), STATS_LOG_DROP);
 		return;
 	}
 
-	cpu_log_buffer = get_cpu_log_buffer_start(g_log_data_hva, cpuid);
-
-	log_buffer_add_record(cpu_log_buffer,
+	if (log_buffer_add_record(cpuid,
 		event_info->vmcs_guest_state.ia32_reg_rip,
 		reason.reason, reason.qualification,
-		reason.gva);
+		reason.gva)) {
+		STATS_INC(stats_get_cpu(cpuid), STATS_LOG_RECORD);
+	}
+}
+
+static void log_ring_map_free(void *obj)
+{
+	log_ring_map_t *map = (log_ring_map_t *)obj;
+
+	if (map->gva)
+		ikgt_free(map->gva);
+
+	if (map->gpa)
+		ikgt_free(map->gpa);
+
+	ikgt_free((uint64_t *)map);
+}
+
+/* offset into the buffer to hva, a record never crosses a page */
+static inline void *log_ring_ptr(const log_ring_map_t *map, uint64_t offset)
+{
+	return (char *)map->hva[offset >> PAGE_SHIFT] + (offset & (PAGE_4KB - 1));
+}
+
+/* Function Name: log_ring_map
+* Purpose: map the pages of a v2 log buffer sent by the agent
+*
+* Input: IKGT Event Info, init message
+* Return value: page map, NULL on failure
+*/
+static log_ring_map_t *log_ring_map(ikgt_event_info_t *event_info,
+									log_message_t *msg)
+{
+	log_ring_map_t *map;
+	page_walk_t walk;
+	uint64_t num_of_cpus = msg->log_num_of_cpus;
+	uint64_t num_records = msg->log_num_records;
+	uint64_t page_size;
+	uint32_t i, num_pages = msg->log_num_pages;
+
+	if ((0 == num_of_cpus) || (0 == num_records)
+		|| (num_records & (num_records - 1))
+		|| (num_pages > LOG_RING_MAX_PAGES)
+		|| (LOG_RING_SIZE(num_of_cpus, num_records) != (uint64_t)num_pages * PAGE_4KB)) {
+		ikgt_printf("Error, invalid log ring, cpus=%llu, records=%llu, pages=%u\n",
+			num_of_cpus, num_records, num_pages);
+		return NULL;
+	}
+
+	map = (log_ring_map_t *)ikgt_malloc(sizeof(log_ring_map_t) + num_pages * sizeof(void *));
+	if (NULL == map)
+		return NULL;
+
+	map->num_pages = num_pages;
+	map->num_of_cpus = (uint32_t)num_of_cpus;
+	map->mask = (uint32_t)num_records - 1;
+	map->ring_offset = LOG_RING_OFFSET(num_of_cpus);
+	map->gva = ikgt_malloc(num_pages * sizeof(uint64_t));
+	map->gpa = ikgt_malloc(num_pages * sizeof(uint64_t));
+
+	if ((NULL == map->gva) || (NULL == map->gpa))
+		goto fail;
+
+	if (IKGT_STATUS_SUCCESS != ikgt_copy_gva_to_hva((gva_t)msg->log_page_list,
+		num_pages * sizeof(uint64_t), (hva_t)map->gva)) {
+		goto fail;
+	}
+
+	page_walk_init(&walk, event_info);
+
+	for (i = 0; i < num_pages; i++) {
+		if ((map->gva[i] & (PAGE_4KB - 1))
+			|| (IKGT_STATUS_SUCCESS != page_walk_translate(&walk, map->gva[i],
+				&map->gpa[i], &page_size))
+			|| (IKGT_STATUS_SUCCESS != util_gpa_to_hva(event_info,
+				map->gpa[i], &map->hva[i]))) {
+			ikgt_printf("Error, log page %u at %llx\n", i, map->gva[i]);
+			goto fail;
+		}
+	}
+
+	return map;
+
+fail:
+	log_ring_map_free(map);
+
+	return NULL;
+}
+
+/* Function Name: log_ring_start
+* Purpose: start logging to a v2 buffer, or switch to a resized one. The
+*          agent must not reuse the pages of the old buffer before the
+*          next switch.
+*
+* Input: IKGT Event Info, init message
+* Return value: none
+*/
+static void log_ring_start(ikgt_event_info_t *event_info, log_message_t *msg)
+{
+	log_ring_header_t *header;
+	log_ring_map_t *map, *old;
+
+	if (LOG_RING_VERSION != msg->log_version)
+		return;
+
+	map = log_ring_map(event_info, msg);
+	if (NULL == map)
+		return;
+
+	/* the agent only ever reads the buffer */
+	if (IKGT_STATUS_SUCCESS != util_monitor_pages(map->gva, map->gpa,
+		map->num_pages, PERMISSION_READ)) {
+		log_ring_map_free(map);
+		return;
+	}
+
+	header = (log_ring_header_t *)map->hva[0];
+
+	header->version = LOG_RING_VERSION;
+	header->num_of_cpus = map->num_of_cpus;
+	header->num_records = map->mask + 1;
+	header->record_size = sizeof(log_record_t);
+	header->ring_offset = map->ring_offset;
+
+	/* the agent checks the signature before the rest of the header */
+	__asm__ __volatile__("" ::: "memory");
+	header->signature = LOG_RING_SIGNATURE;
+
+	handler_lock(&g_log_map_lock);
+
+	old = g_log_map;
+	__atomic_store_n(&g_log_map, map, __ATOMIC_RELEASE);
+
+	handler_unlock(&g_log_map_lock);
+
+	if (old) {
+		util_monitor_pages(old->gva, old->gpa, old->num_pages, PERMISSION_RWX);
+		epoch_retire(old, log_ring_map_free);
+	}
+
+	DPRINTF("%s: pages=%u, cpus=%u, records=%u\n", __func__,
+		map->num_pages, map->num_of_cpus, map->mask + 1);
 }
 
 /* Function Name: start_log
@@ -74,8 +486,7 @@ void log_event(ikgt_event_info_t *event_info)
 */
 void start_log(ikgt_event_info_t *event_info, log_message_t *msg)
 {
-	ikgt_gva_to_gpa_params_t gva2gpa;
-	ikgt_gpa_to_hva_params_t gpa2hva;
+	void *hva;
 	ikgt_status_t status = IKGT_STATUS_SUCCESS;
 
 	if (NULL == msg)
@@ -86,6 +497,15 @@ void start_log(ikgt_event_info_t *event_info, log_message_t *msg)
 
 	DPRINTF("ENTRIES_PER_CPU=%u\n", ENTRIES_PER_CPU);
 
+	g_mem_log_interval = msg->log_interval;
+	g_mem_log_burst = msg->log_burst;
+	g_log_flags = msg->log_flags;
+
+	if (msg->log_page_list) {
+		log_ring_start(event_info, msg);
+		return;
+	}
+
 	if (NULL == msg->log_addr) {
 		return;
 	}
@@ -94,24 +514,13 @@ void start_log(ikgt_event_info_t *event_info, log_message_t *msg)
 	g_log_size = msg->log_size;
 
 	/* translate the gva pages addr to hva */
-	gva2gpa.guest_virtual_address = g_log_gva;
-	gva2gpa.size = sizeof(ikgt_gva_to_gpa_params_t);
-	gva2gpa.cr3 = 0;
-
-	if (IKGT_STATUS_SUCCESS != ikgt_gva_to_gpa(
-		&gva2gpa)) {
-			return;
-	}
-
-	gpa2hva.view_handle = event_info->view_handle;
-	gpa2hva.guest_physical_address = gva2gpa.guest_physical_address;
-	if (IKGT_STATUS_SUCCESS != ikgt_gpa_to_hva(&gpa2hva)) {
+	if (IKGT_STATUS_SUCCESS != util_gva_to_hva(event_info, g_log_gva, &hva)) {
 		return;
 	}
 
-	g_log_data_hva = (void *)(gpa2hva.host_virtual_address);
+	g_log_data_hva = (log_entry_t *)hva;
 
-	status = util_monitor_memory_ex(g_log_gva, g_log_size, PERMISSION_READ);
+	status = util_monitor_memory(event_info, g_log_gva, g_log_size, PERMISSION_READ);
 }
 
 /* Function Name: stop_log
@@ -123,26 +532,87 @@ void start_log(ikgt_event_info_t *event_info, log_message_t *msg)
 void stop_log(ikgt_event_info_t *event_info)
 {
 	ikgt_status_t status;
+	log_ring_map_t *map;
+
+	handler_lock(&g_log_map_lock);
+
+	map = g_log_map;
+	__atomic_store_n(&g_log_map, NULL, __ATOMIC_RELEASE);
+
+	handler_unlock(&g_log_map_lock);
+
+	if (map) {
+		util_monitor_pages(map->gva, map->gpa, map->num_pages, PERMISSION_RWX);
+		epoch_retire(map, log_ring_map_free);
+	}
 
 	if (NULL == g_log_data_hva)
 		return;
 
 	if (g_log_gva) {
-		status = util_monitor_memory_ex(g_log_gva, g_log_size, PERMISSION_RWX);
+		status = util_monitor_memory(event_info, g_log_gva, g_log_size, PERMISSION_RWX);
 	}
 
 	g_log_data_hva = NULL;
 }
 
-static void log_buffer_add_record(log_entry_t cpu_log_buffer_start[],
-								  uint64_t rip, uint32_t reason, uint64_t qualification,
-								  uint64_t gva)
+static boolean_t log_ring_add_record(const log_ring_map_t *map, uint16_t cpuid,
+									 uint64_t rip, uint32_t reason, uint64_t qualification,
+									 uint64_t gva)
 {
+	log_ring_head_t *head;
+	log_record_t *record;
+	uint64_t seq_num;
+
+	if (cpuid >= map->num_of_cpus) {
+		STATS_INC(stats_get_cpu(cpuid), STATS_LOG_DROP);
+		return FALSE;
+	}
+
+	head = (log_ring_head_t *)log_ring_ptr(map,
+		__builtin_offsetof(log_ring_header_t, cpu_head) + cpuid * sizeof(log_ring_head_t));
+	seq_num = head->head;
+
+	/* a power of 2 ring, indexed without a division */
+	record = (log_record_t *)log_ring_ptr(map, map->ring_offset
+		+ ((uint64_t)cpuid * (map->mask + 1) + (seq_num & map->mask)) * sizeof(log_record_t));
+
+	/* the stamp goes first, see the protocol in policy_common.h */
+	record->seq_num = seq_num;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	record->rip = rip;
+	record->reason = reason;
+	record->qualification = qualification;
+	record->gva = gva;
+	record->valid = 1;
+
+	__atomic_store_n(&head->head, seq_num + 1, __ATOMIC_RELEASE);
+
+	return TRUE;
+}
+
+static boolean_t log_buffer_add_record(uint16_t cpuid,
+									   uint64_t rip, uint32_t reason, uint64_t qualification,
+									   uint64_t gva)
+{
+	const log_ring_map_t *map;
+	log_entry_t *cpu_log_buffer_start;
 	log_entry_t *meta_entry;
 	log_entry_t *data_entry;
 	uint64_t next_seq_num;
 	uint32_t index;
 
+	/* valid until the end of the exit */
+	map = __atomic_load_n(&g_log_map, __ATOMIC_ACQUIRE);
+	if (map)
+		return log_ring_add_record(map, cpuid, rip, reason, qualification, gva);
+
+	if (NULL == g_log_data_hva)
+		return FALSE;
+
+	cpu_log_buffer_start = get_cpu_log_buffer_start(g_log_data_hva, cpuid);
+
 	meta_entry = &cpu_log_buffer_start[0];
 	next_seq_num = meta_entry->meta.head;
 
@@ -150,21 +620,24 @@ static void log_buffer_add_record(log_entry_t cpu_log_buffer_start[],
 
 	data_entry = &cpu_log_buffer_start[index];
 
+	data_entry->data.seq_num = next_seq_num;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
 	data_entry->data.rip = rip;
 	data_entry->data.reason = reason;
 	data_entry->data.qualification = qualification;
 	data_entry->data.gva = gva;
-	data_entry->data.seq_num = next_seq_num;
 	data_entry->data.valid = 1;
 
-	meta_entry->meta.head++;
+	__atomic_store_n(&meta_entry->meta.head, next_seq_num + 1, __ATOMIC_RELEASE);
+
+	return TRUE;
 }
 
 #ifdef DEBUG
 void log_debug_fill(void)
 {
 	int i;
-	log_entry_t *cpu_log_buffer; /* per cpu log buffer */
 
 	ikgt_printf("%s:\n", __func__);
 
@@ -172,17 +645,13 @@ void log_debug_fill(void)
 		return;
 	}
 
-	cpu_log_buffer = get_cpu_log_buffer_start(g_log_data_hva, 3);
-
 	for (i = 0; i < 10000; i++) {
-		log_buffer_add_record(cpu_log_buffer,
+		log_buffer_add_record(3,
 			i,
 			i + 3,
 			i + 5,
 			i + 7);
 	}
-
-	ikgt_printf("get_last_seq_num()=%llu\n", get_last_seq_num(cpu_log_buffer));
 }
 
 void log_debug(uint64_t command_code)
@@ -190,6 +659,10 @@ void log_debug(uint64_t command_code)
 	ikgt_printf("%s(%u)\n", __func__, command_code);
 
 	ikgt_printf("LOGS_PER_CPU=%u\n", LOGS_PER_CPU);
+	if (g_log_map) {
+		ikgt_printf("log_ring pages=%u, cpus=%u, records=%u\n",
+			g_log_map->num_pages, g_log_map->num_of_cpus, g_log_map->mask + 1);
+	}
 
 	/* log_debug_fill(); */
 }
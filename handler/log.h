@@ -17,8 +17,25 @@
 #ifndef _LOG_H_
 #define _LOG_H_
 
+boolean_t log_initialize(uint16_t num_of_cpus);
+
 void log_event(ikgt_event_info_t *event_info);
 
+boolean_t log_event_limited(ikgt_event_info_t *event_info, uint32_t bucket_id,
+							uint64_t interval, uint32_t burst);
+
+/* log an event on a policy entry's resource, within the entry's rate */
+#define log_entry_event(event_info, e) \
+	log_event_limited(event_info, POLICY_GET_RESOURCE_ID(e), \
+		POLICY_INFO_GET_LOG_INTERVAL(e), POLICY_INFO_GET_LOG_BURST(e))
+
+void log_memory_write(ikgt_event_info_t *event_info, uint64_t gpa,
+					  uint32_t bucket_id, uint64_t interval, uint32_t burst);
+
+void log_memory_event(ikgt_event_info_t *event_info, uint64_t gpa);
+
+void log_advance_epoch(ikgt_event_info_t *event_info);
+
 void start_log(ikgt_event_info_t *event_info, log_message_t *msg);
 
 void stop_log(ikgt_event_info_t *event_info);
@@ -15,11 +15,582 @@
 *******************************************************************************/
 #include "handler.h"
 #include "utils.h"
+#include "policy.h"
+#include "epoch.h"
+#include "page_walk.h"
 #include "log.h"
+#include "stats.h"
 
-static uint64_t g_mem_read_count;
-static uint64_t g_mem_write_count;
-static uint64_t g_mem_exec_count;
+/* Memory policy: guest physical ranges with the POLICY_ACT_* semantics of
+* the CR/MSR entries. Ranges are page granular, sorted and never overlap, so
+* a violation is classified with a binary search. Updates build a new array
+* and publish it like the policy snapshot, readers are never blocked.
+*/
+typedef struct {
+	uint64_t start; /* gpa, inclusive */
+	uint64_t end;   /* gpa, exclusive */
+	uint32_t r_action;
+	uint32_t w_action;
+	uint32_t x_action;
+	uint32_t log_burst;
+	uint64_t log_interval;
+} mem_range_t;
+
+typedef struct {
+	uint32_t count;
+	uint32_t capacity;
+	mem_range_t range[];
+} mem_policy_t;
+
+static mem_policy_t *g_mem_policy;
+static handler_lock_t g_mem_policy_lock;
+
+/* the RESOURCE_ID_MEMORY records in force as the agent sent them, for
+* POLICY_REPORT. Under g_mem_policy_lock.
+*/
+static policy_update_rec_t *g_mem_records;
+static uint32_t g_mem_records_count;
+static uint32_t g_mem_records_capacity;
+
+#define MEM_RECORDS_MIN_CAPACITY 16
+
+/* what mem_policy_update() replaced, so a failed add can be undone */
+typedef struct {
+	mem_policy_t *prev; /* ranges before the update */
+	mem_policy_t *next; /* ranges published by it */
+} mem_policy_undo_t;
+
+
+static const mem_range_t *mem_policy_lookup(const mem_policy_t *policy,
+											uint64_t gpa)
+{
+	uint32_t lo = 0, hi, mid;
+
+	if (NULL == policy)
+		return NULL;
+
+	hi = policy->count;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (gpa < policy->range[mid].start)
+			hi = mid;
+		else if (gpa >= policy->range[mid].end)
+			lo = mid + 1;
+		else
+			return &policy->range[mid];
+	}
+
+	return NULL;
+}
+
+static mem_policy_t *mem_policy_alloc(uint32_t capacity)
+{
+	mem_policy_t *policy;
+
+	policy = (mem_policy_t *)ikgt_malloc(sizeof(mem_policy_t) + capacity * sizeof(mem_range_t));
+	if (NULL == policy)
+		return NULL;
+
+	policy->count = 0;
+	policy->capacity = capacity;
+
+	return policy;
+}
+
+static void mem_policy_append(mem_policy_t *policy, const mem_range_t *range,
+							  uint64_t start, uint64_t end)
+{
+	mem_range_t *r = &policy->range[policy->count++];
+
+	r->start = start;
+	r->end = end;
+	r->r_action = range->r_action;
+	r->w_action = range->w_action;
+	r->x_action = range->x_action;
+	r->log_burst = range->log_burst;
+	r->log_interval = range->log_interval;
+}
+
+/* Function Name: mem_policy_cut
+* Purpose: copy old to a new array without [start, end), and with insert in
+*          its place if given. Ranges partly covered are split.
+*
+* Input: current ranges, gpa range, range to insert or NULL
+* Return value: new ranges, NULL if out of memory
+*/
+static mem_policy_t *mem_policy_cut(const mem_policy_t *old, uint64_t start,
+									uint64_t end, const mem_range_t *insert)
+{
+	mem_policy_t *policy;
+	const mem_range_t *r;
+	uint32_t i, count = old ? old->count : 0;
+
+	/* at most one range is split in two, plus the inserted one */
+	policy = mem_policy_alloc(count + 2);
+	if (NULL == policy)
+		return NULL;
+
+	for (i = 0; i < count; i++) {
+		r = &old->range[i];
+
+		if (r->end <= start) {
+			mem_policy_append(policy, r, r->start, r->end);
+			continue;
+		}
+
+		if (r->start < start)
+			mem_policy_append(policy, r, r->start, start);
+
+		if (insert) {
+			mem_policy_append(policy, insert, start, end);
+			insert = NULL;
+		}
+
+		if (r->start >= end)
+			mem_policy_append(policy, r, r->start, r->end);
+		else if (r->end > end)
+			mem_policy_append(policy, r, end, r->end);
+	}
+
+	if (insert)
+		mem_policy_append(policy, insert, start, end);
+
+	return policy;
+}
+
+/* Function Name: mem_policy_update
+* Purpose: apply a policy record to the guest physical pages backing its
+*          guest virtual range. Physically contiguous pages are applied as
+*          one range.
+*
+* Input: policy record, TRUE to add the range, FALSE to remove it, undo
+*        record or NULL. With an undo record the previous ranges are kept
+*        for mem_policy_undo() or mem_policy_keep() instead of retired.
+* Return value: status
+*/
+static ikgt_status_t mem_policy_update(ikgt_event_info_t *event_info,
+									   policy_update_rec_t *msg, boolean_t add,
+									   mem_policy_undo_t *undo)
+{
+	mem_policy_t *old, *cur, *next;
+	mem_range_t range;
+	page_walk_t walk;
+	uint64_t gva, end, gpa = 0, page_size, chunk = 0;
+	uint64_t run_start = 0, run_end = 0;
+	ikgt_status_t status = IKGT_STATUS_SUCCESS;
+
+	gva = POLICY_INFO_GET_ADDR(msg) & ~((uint64_t)PAGE_4KB - 1);
+	end = PAGE_ALIGN_4K(POLICY_INFO_GET_ADDR(msg) + POLICY_INFO_GET_SIZE(msg));
+
+	range.r_action = POLICY_GET_READ_ACTION(msg);
+	range.w_action = POLICY_GET_WRITE_ACTION(msg);
+	range.x_action = POLICY_GET_EXEC_ACTION(msg);
+	range.log_burst = (uint32_t)POLICY_INFO_GET_LOG_BURST(msg);
+	range.log_interval = POLICY_INFO_GET_LOG_INTERVAL(msg);
+
+	handler_lock(&g_mem_policy_lock);
+
+	old = g_mem_policy;
+	cur = old;
+
+	page_walk_init(&walk, event_info);
+
+	while (gva <= end) {
+		if (gva < end) {
+			status = page_walk_translate(&walk, gva, &gpa, &page_size);
+			if (IKGT_STATUS_SUCCESS != status)
+				break;
+
+			/* up to the end of the guest mapping */
+			chunk = min(end, (gva & ~(page_size - 1)) + page_size) - gva;
+			gva += chunk;
+
+			if ((run_end != run_start) && (gpa == run_end)) {
+				run_end += chunk;
+				continue;
+			}
+		} else {
+			gva += PAGE_4KB; /* flush the last run and stop */
+		}
+
+		/* end of a physically contiguous run */
+		if (run_end != run_start) {
+			next = mem_policy_cut(cur, run_start, run_end, add ? &range : NULL);
+			if (NULL == next) {
+				status = IKGT_ALLOCATE_FAILED;
+				break;
+			}
+
+			if (cur != old)
+				ikgt_free((uint64_t *)cur);
+
+			cur = next;
+		}
+
+		run_start = gpa;
+		run_end = gpa + chunk;
+	}
+
+	if (IKGT_STATUS_SUCCESS != status) {
+		if (cur != old)
+			ikgt_free((uint64_t *)cur);
+
+		handler_unlock(&g_mem_policy_lock);
+		return status;
+	}
+
+	__atomic_store_n(&g_mem_policy, cur, __ATOMIC_RELEASE);
+
+	handler_unlock(&g_mem_policy_lock);
+
+	if (undo) {
+		undo->prev = old;
+		undo->next = cur;
+	} else if (old) {
+		epoch_retire(old, NULL);
+	}
+
+	return IKGT_STATUS_SUCCESS;
+}
+
+static void mem_policy_keep(mem_policy_undo_t *undo)
+{
+	if (undo->prev)
+		epoch_retire(undo->prev, NULL);
+}
+
+/* Function Name: mem_policy_undo
+* Purpose: put back the ranges replaced by mem_policy_update(), unless
+*          another update has been published since
+*
+* Input: undo record
+* Return value: TRUE if put back, FALSE if the previous ranges are gone
+*/
+static boolean_t mem_policy_undo(mem_policy_undo_t *undo)
+{
+	handler_lock(&g_mem_policy_lock);
+
+	if (g_mem_policy != undo->next) {
+		handler_unlock(&g_mem_policy_lock);
+		mem_policy_keep(undo);
+		return FALSE;
+	}
+
+	__atomic_store_n(&g_mem_policy, undo->prev, __ATOMIC_RELEASE);
+
+	handler_unlock(&g_mem_policy_lock);
+
+	if (undo->next)
+		epoch_retire(undo->next, NULL);
+
+	return TRUE;
+}
+
+static void mem_record_copy(policy_update_rec_t *dest, const policy_update_rec_t *src)
+{
+	uint32_t i;
+
+	dest->resource_id = src->resource_id;
+	dest->r_action = src->r_action;
+	dest->w_action = src->w_action;
+	dest->x_action = src->x_action;
+	dest->sticky_val = src->sticky_val;
+
+	for (i = 0; i < POLICY_INFO_IDX_MAX; i++)
+		dest->resource_info[i] = src->resource_info[i];
+}
+
+/* Function Name: mem_records_update
+* Purpose: keep the list of memory records in force. A record replaces an
+*          earlier one for the same range, removing a range drops it.
+*
+* Input: policy record, TRUE once added, FALSE once removed
+* Return value: none
+*/
+static void mem_records_update(const policy_update_rec_t *msg, boolean_t add)
+{
+	policy_update_rec_t *records;
+	uint32_t i, capacity;
+
+	handler_lock(&g_mem_policy_lock);
+
+	for (i = 0; i < g_mem_records_count; i++) {
+		if ((POLICY_INFO_GET_ADDR(&g_mem_records[i]) == POLICY_INFO_GET_ADDR(msg))
+			&& (POLICY_INFO_GET_SIZE(&g_mem_records[i]) == POLICY_INFO_GET_SIZE(msg)))
+			break;
+	}
+
+	if (i < g_mem_records_count) {
+		g_mem_records_count--;
+		for (; i < g_mem_records_count; i++)
+			mem_record_copy(&g_mem_records[i], &g_mem_records[i + 1]);
+	}
+
+	if (add && (g_mem_records_count == g_mem_records_capacity)) {
+		capacity = g_mem_records_capacity ? g_mem_records_capacity * 2
+			: MEM_RECORDS_MIN_CAPACITY;
+
+		records = (policy_update_rec_t *)ikgt_malloc(capacity * sizeof(policy_update_rec_t));
+		if (NULL == records) {
+			ikgt_printf("Error, memory range %llx not reported\n",
+				POLICY_INFO_GET_ADDR(msg));
+			handler_unlock(&g_mem_policy_lock);
+			return;
+		}
+
+		for (i = 0; i < g_mem_records_count; i++)
+			mem_record_copy(&records[i], &g_mem_records[i]);
+
+		/* only read under the lock */
+		if (g_mem_records)
+			ikgt_free((uint64_t *)g_mem_records);
+
+		g_mem_records = records;
+		g_mem_records_capacity = capacity;
+	}
+
+	if (add)
+		mem_record_copy(&g_mem_records[g_mem_records_count++], msg);
+
+	handler_unlock(&g_mem_policy_lock);
+}
+
+/* the range must fit util_monitor_memory() */
+static boolean_t mem_policy_valid(policy_update_rec_t *msg)
+{
+	uint64_t addr = POLICY_INFO_GET_ADDR(msg);
+	uint64_t size = POLICY_INFO_GET_SIZE(msg);
+
+	if ((0 == size) || (size > 0xFFFFFFFFULL) || (addr + size < addr))
+		return FALSE;
+
+	return TRUE;
+}
+
+/* EPT permissions letting through the accesses a policy record allows
+* without looking at them. A page cannot be writable and not readable.
+*/
+static uint32_t mem_policy_permission(const policy_update_rec_t *msg)
+{
+	uint32_t permission = PERMISSION_RWX;
+
+	if (POLICY_GET_READ_ACTION(msg))
+		permission &= ~(PERMISSION_READ | PERMISSION_WRITE);
+
+	if (POLICY_GET_WRITE_ACTION(msg))
+		permission &= ~PERMISSION_WRITE;
+
+	if (POLICY_GET_EXEC_ACTION(msg))
+		permission &= ~PERMISSION_EXECUTE;
+
+	return permission;
+}
+
+/* the guest pages a record covers, [*start, *end) */
+static void mem_record_pages(const policy_update_rec_t *rec, uint64_t *start,
+							 uint64_t *end)
+{
+	*start = POLICY_INFO_GET_ADDR(rec) & ~((uint64_t)PAGE_4KB - 1);
+	*end = PAGE_ALIGN_4K(POLICY_INFO_GET_ADDR(rec) + POLICY_INFO_GET_SIZE(rec));
+}
+
+/* EPT permissions of a guest page, allowing only what every record on
+* the page allows. skip is a record being replaced or removed, add one
+* not in the list yet; either may be NULL.
+*/
+static uint32_t mem_page_permission(uint64_t gva, const policy_update_rec_t *add,
+									const policy_update_rec_t *skip)
+{
+	const policy_update_rec_t *rec;
+	uint32_t permission = PERMISSION_RWX;
+	uint64_t start, end;
+	uint32_t i;
+
+	handler_lock(&g_mem_policy_lock);
+
+	for (i = 0; i < g_mem_records_count; i++) {
+		rec = &g_mem_records[i];
+
+		if (skip && (POLICY_INFO_GET_ADDR(rec) == POLICY_INFO_GET_ADDR(skip))
+			&& (POLICY_INFO_GET_SIZE(rec) == POLICY_INFO_GET_SIZE(skip)))
+			continue;
+
+		mem_record_pages(rec, &start, &end);
+		if ((gva >= start) && (gva < end))
+			permission &= mem_policy_permission(rec);
+	}
+
+	handler_unlock(&g_mem_policy_lock);
+
+	if (add)
+		permission &= mem_policy_permission(add);
+
+	return permission;
+}
+
+/* largest run sent to util_monitor_memory() at once */
+#define MEM_APPLY_MAX_RUN 0x80000000ULL
+
+/* Function Name: mem_policy_apply
+* Purpose: set the EPT permissions of the pages of a record's range from
+*          all records on each page, so that a page shared by ranges keeps
+*          the strictest of them. Pages with the same permissions are set
+*          as one run.
+*
+* Input: IKGT Event Info, record whose pages to set, record being added
+*        or NULL, record being replaced or removed or NULL
+* Return value: status
+*/
+static ikgt_status_t mem_policy_apply(ikgt_event_info_t *event_info,
+									  const policy_update_rec_t *msg,
+									  const policy_update_rec_t *add,
+									  const policy_update_rec_t *skip)
+{
+	uint64_t gva, end, run_start;
+	uint32_t permission, run_permission;
+	ikgt_status_t status;
+
+	mem_record_pages(msg, &gva, &end);
+
+	run_start = gva;
+	run_permission = mem_page_permission(gva, add, skip);
+
+	for (gva += PAGE_4KB; gva <= end; gva += PAGE_4KB) {
+		if (gva < end) {
+			permission = mem_page_permission(gva, add, skip);
+			if ((permission == run_permission) && (gva - run_start < MEM_APPLY_MAX_RUN))
+				continue;
+		}
+
+		status = util_monitor_memory(event_info, run_start,
+					(uint32_t)(gva - run_start), run_permission);
+		if (IKGT_STATUS_SUCCESS != status)
+			return status;
+
+		run_start = gva;
+		run_permission = permission;
+	}
+
+	return IKGT_STATUS_SUCCESS;
+}
+
+/* Function Name: memory_policy_add
+* Purpose: start enforcing the policy of a RESOURCE_ID_MEMORY record on
+*          [POLICY_INFO_IDX_ADDR, +POLICY_INFO_IDX_SIZE). Parts of ranges
+*          added earlier that it covers are replaced. If the record fails,
+*          the earlier ranges stay in force as they were.
+*
+* Input: policy record
+* Return value: status
+*/
+ikgt_status_t memory_policy_add(ikgt_event_info_t *event_info,
+								policy_update_rec_t *msg)
+{
+	mem_policy_undo_t undo;
+	ikgt_status_t status;
+
+	if (!mem_policy_valid(msg))
+		return IKGT_STATUS_ERROR;
+
+	status = mem_policy_update(event_info, msg, TRUE, &undo);
+	if (IKGT_STATUS_SUCCESS != status)
+		return status;
+
+	status = mem_policy_apply(event_info, msg, msg, msg);
+	if (IKGT_STATUS_SUCCESS != status) {
+		if (!mem_policy_undo(&undo)) {
+			ikgt_printf("Error, memory range %llx changed meanwhile, removed\n",
+				POLICY_INFO_GET_ADDR(msg));
+			mem_policy_update(event_info, msg, FALSE, NULL);
+		}
+
+		/* pages may be left with the permissions of the failed record */
+		mem_policy_apply(event_info, msg, NULL, NULL);
+		return status;
+	}
+
+	mem_policy_keep(&undo);
+
+	mem_records_update(msg, TRUE);
+
+	return status;
+}
+
+/* Function Name: memory_policy_del
+* Purpose: stop enforcing any policy on the range of a RESOURCE_ID_MEMORY
+*          record. Its pages get back the permissions of the other ranges
+*          on them, or all permissions.
+*
+* Input: policy record
+* Return value: status
+*/
+ikgt_status_t memory_policy_del(ikgt_event_info_t *event_info,
+								policy_update_rec_t *msg)
+{
+	ikgt_status_t status;
+
+	if (!mem_policy_valid(msg))
+		return IKGT_STATUS_ERROR;
+
+	status = mem_policy_apply(event_info, msg, NULL, msg);
+	if (IKGT_STATUS_SUCCESS != status)
+		return status;
+
+	status = mem_policy_update(event_info, msg, FALSE, NULL);
+	if (IKGT_STATUS_SUCCESS == status)
+		mem_records_update(msg, FALSE);
+
+	return status;
+}
+
+static void process_memory_policy(ikgt_event_info_t *event_info,
+								  const mem_range_t *range,
+								  uint64_t gpa,
+								  violation_type_t type,
+								  stats_cpu_t *stats,
+								  stats_latency_t *latency,
+								  uint64_t *tsc)
+{
+	uint32_t action;
+
+	switch (type) {
+	case EXECUTE_VIOLATION:
+		action = range->x_action;
+		break;
+
+	case READ_VIOLATION:
+		action = range->r_action;
+		break;
+
+	case WRITE_VIOLATION:
+		action = range->w_action;
+		break;
+
+	default:
+		action = POLICY_ACT_ALLOW;
+		break;
+	}
+
+	stats_inc_access(stats, RESOURCE_ID_MEMORY);
+
+	event_info->response = (action & POLICY_ACT_SKIP) ?
+		IKGT_EVENT_RESPONSE_REDIRECT : IKGT_EVENT_RESPONSE_ALLOW;
+
+	stats_latency(latency, STATS_EVENT_MEM, STATS_PHASE_EVAL, tsc);
+
+	if (action & POLICY_ACT_LOG) {
+		if (WRITE_VIOLATION == type)
+			log_memory_write(event_info, gpa, RESOURCE_ID_MEMORY,
+				range->log_interval, range->log_burst);
+		else
+			log_event_limited(event_info, RESOURCE_ID_MEMORY,
+				range->log_interval, range->log_burst);
+
+		stats_latency(latency, STATS_EVENT_MEM, STATS_PHASE_LOG, tsc);
+	}
+}
 
 
 /* Function name: handle_memory_event
@@ -36,9 +607,15 @@ void handle_memory_event(ikgt_event_info_t *event_info)
 {
 	ikgt_mem_event_info_t *meminfo;
 	violation_type_t type;
+	const mem_range_t *range;
+	stats_cpu_t *stats;
+	stats_latency_t *latency;
+	uint64_t tsc;
 
 	event_info->response = IKGT_EVENT_RESPONSE_UNSPECIFIED;
 
+	tsc = stats_rdtsc();
+
 	meminfo = (ikgt_mem_event_info_t *)(event_info->event_specific_data);
 
 	/* determine the type of access that caused this event */
@@ -55,20 +632,50 @@ void handle_memory_event(ikgt_event_info_t *event_info)
 		type = UNKNOWN_VIOLATION;
 	}
 
+	stats = stats_get_cpu(event_info->thread_id);
+	latency = stats_get_latency(event_info->thread_id);
+
+	switch (type) {
+	case EXECUTE_VIOLATION:
+		STATS_INC(stats, STATS_MEM_EXEC);
+		break;
+
+	case READ_VIOLATION:
+		STATS_INC(stats, STATS_MEM_READ);
+		break;
+
+	case WRITE_VIOLATION:
+		STATS_INC(stats, STATS_MEM_WRITE);
+		break;
+
+	default:
+		break;
+	}
+
+	/* valid until this exit is over, like the policy snapshot */
+	range = mem_policy_lookup(__atomic_load_n(&g_mem_policy, __ATOMIC_ACQUIRE),
+							  meminfo->gpa);
+	if (range) {
+		process_memory_policy(event_info, range, meminfo->gpa, type, stats,
+			latency, &tsc);
+		return;
+	}
+
+	stats_latency(latency, STATS_EVENT_MEM, STATS_PHASE_EVAL, &tsc);
+
+	/* pages monitored outside of the memory policy, such as the log */
 	switch (type) {
 	case EXECUTE_VIOLATION:
-		g_mem_exec_count++;
 		break;
 
 	case READ_VIOLATION:
-		g_mem_read_count++;
 		event_info->response = IKGT_EVENT_RESPONSE_ALLOW;
 		break;
 
 	case WRITE_VIOLATION:
-		g_mem_write_count++;
 		event_info->response = IKGT_EVENT_RESPONSE_ALLOW;
-		log_event(event_info);
+		log_memory_event(event_info, meminfo->gpa);
+		stats_latency(latency, STATS_EVENT_MEM, STATS_PHASE_LOG, &tsc);
 		break;
 
 	case UNKNOWN_VIOLATION:
@@ -77,9 +684,49 @@ void handle_memory_event(ikgt_event_info_t *event_info)
 	}
 }
 
+/* Function Name: memory_policy_report
+* Purpose: add the memory records in force to a POLICY_REPORT, as the
+*          agent enabled them. Records past max_entries are only counted.
+*
+* Input: mapped report buffer, offset of the first entry to fill, room in
+*        entries
+* Return value: number of records
+*/
+uint32_t memory_policy_report(const util_page_map_t *map, uint64_t offset,
+							  uint32_t max_entries)
+{
+	report_entry_t entry;
+	uint32_t i, count;
+
+	handler_lock(&g_mem_policy_lock);
+
+	count = min(g_mem_records_count, max_entries);
+
+	for (i = 0; i < count; i++) {
+		mon_memset(&entry, 0, sizeof(report_entry_t));
+		mem_record_copy(&entry.rec, &g_mem_records[i]);
+
+		util_page_map_write(map, offset + i * sizeof(report_entry_t),
+			&entry, sizeof(report_entry_t));
+	}
+
+	count = g_mem_records_count;
+
+	handler_unlock(&g_mem_policy_lock);
+
+	return count;
+}
+
 void memory_debug(uint64_t command_code)
 {
 	ikgt_printf("%s(%u)\n", __func__, command_code);
 
-	ikgt_printf("g_mem_write_count=%u\n", g_mem_write_count);
+	ikgt_printf("mem_write_count=%llu\n", stats_sum(STATS_MEM_WRITE));
+	ikgt_printf("mem_write_dedup=%llu\n", stats_sum(STATS_LOG_DEDUP));
+	ikgt_printf("ept_2m_aligned=%llu, ept_2m_partial=%llu\n",
+		stats_sum(STATS_EPT_2M_ALIGNED), stats_sum(STATS_EPT_2M_PARTIAL));
+	ikgt_printf("ept_1g_aligned=%llu, ept_1g_partial=%llu\n",
+		stats_sum(STATS_EPT_1G_ALIGNED), stats_sum(STATS_EPT_1G_PARTIAL));
+	ikgt_printf("mem_range_count=%u\n", g_mem_policy ? g_mem_policy->count : 0);
+	ikgt_printf("mem_policy_count=%llu\n", stats_sum_access_count(RESOURCE_ID_MEMORY));
 }
\ No newline at end of file
@@ -17,11 +17,86 @@
 #include "policy.h"
 #include "log.h"
 #include "utils.h"
+#include "pool.h"
+#include "stats.h"
+#include "cmd_ring.h"
 
 
 void handle_msg_init(ikgt_event_info_t *event_info, log_message_t *msg)
 {
 	start_log(event_info, msg);
+
+	start_cmd_ring(event_info, msg);
+}
+
+/* Function name: handle_msg_policy_records
+*
+* Purpose:
+*         Apply the policy records of an enable or disable message. Records
+*         past the first are copied from the agent in one go. With
+*         POLICY_MSG_STATUS the status of each record is written back after
+*         the records.
+*
+* Input: IKGT Event Info, message with the first record
+* Return: None
+*/
+static void handle_msg_policy_records(ikgt_event_info_t *event_info,
+									  policy_message_t *msg)
+{
+	policy_update_rec_t *recs = &msg->policy_data[0];
+	uint32_t count = msg->count & ~POLICY_MSG_STATUS;
+	uint32_t rec_status_one, *rec_status = &rec_status_one;
+	util_page_map_t *map;
+	ikgt_status_t status;
+
+	if (count > POLICY_MSG_MAX_RECORDS) {
+		ikgt_printf("Error, %u policy records in a message\n", count);
+		return;
+	}
+
+	if (count > 1) {
+		recs = (policy_update_rec_t *)ikgt_malloc(count * sizeof(policy_update_rec_t));
+		if (NULL == recs)
+			return;
+
+		status = ikgt_copy_gva_to_hva((gva_t)event_info->event_specific_data
+			+ POLICY_MSG_SIZE(0), count * sizeof(policy_update_rec_t),
+			(hva_t)recs);
+		if (IKGT_STATUS_SUCCESS != status) {
+			ikgt_free((uint64_t *)recs);
+			return;
+		}
+
+		rec_status = (uint32_t *)ikgt_malloc(count * sizeof(uint32_t));
+		if (NULL == rec_status) {
+			ikgt_free((uint64_t *)recs);
+			return;
+		}
+	} else {
+		/* older agents leave count at 0 */
+		count = 1;
+	}
+
+	if (POLICY_ENTRY_ENABLE == msg->command)
+		handle_msg_policy_enable(event_info, recs, count, rec_status);
+	else
+		handle_msg_policy_disable(event_info, recs, count, rec_status);
+
+	if (msg->count & POLICY_MSG_STATUS) {
+		map = util_map_gva_range(event_info, (uint64_t)event_info->event_specific_data
+			+ POLICY_MSG_SIZE(count), count * sizeof(uint32_t));
+		if (map) {
+			util_page_map_write(map, 0, rec_status, count * sizeof(uint32_t));
+			ikgt_free((uint64_t *)map);
+		} else {
+			ikgt_printf("Error, failed to map the record status\n");
+		}
+	}
+
+	if (recs != &msg->policy_data[0]) {
+		ikgt_free((uint64_t *)recs);
+		ikgt_free((uint64_t *)rec_status);
+	}
 }
 
 /* Function name: handle_msg_event
@@ -37,8 +112,11 @@ void handle_msg_event(ikgt_event_info_t *event_info)
 {
 	policy_message_t *msg = NULL;
 	ikgt_status_t status;
+	uint64_t tsc;
+
+	tsc = stats_rdtsc();
 
-	msg = ikgt_malloc(sizeof(policy_message_t));
+	msg = pool_alloc(POOL_POLICY_MESSAGE);
 	if (NULL == msg) {
 		return;
 	}
@@ -47,10 +125,13 @@ void handle_msg_event(ikgt_event_info_t *event_info)
 		sizeof(policy_message_t), (hva_t)msg);
 
 	if (IKGT_STATUS_SUCCESS != status) {
-		ikgt_free(msg);
+		pool_free(POOL_POLICY_MESSAGE, msg);
 		return;
 	}
 
+	stats_latency(stats_get_latency(event_info->thread_id),
+		STATS_EVENT_MSG, STATS_PHASE_READ, &tsc);
+
 	DPRINTF("%s: command=%d, count=%d\n", __func__, msg->command, msg->count);
 
 	switch (msg->command) {
@@ -58,12 +139,34 @@ void handle_msg_event(ikgt_event_info_t *event_info)
 		handle_msg_init(event_info, &msg->log_param);
 		break;
 
-	case POLICY_ENTRY_ENABLE:
-		handle_msg_policy_enable(event_info, &msg->policy_data[0]);
+	case POLICY_INIT_STATS:
+		if (IKGT_STATUS_SUCCESS != start_stats(event_info, &msg->stats_param))
+			ikgt_printf("Error, statistics page not registered\n");
 		break;
 
+	case POLICY_LOG_EPOCH:
+		log_advance_epoch(event_info);
+		break;
+
+	case POLICY_CMD_DOORBELL:
+		cmd_ring_drain(event_info, TRUE);
+		break;
+
+	case POLICY_CMD_RING_STOP:
+		stop_cmd_ring(event_info);
+		break;
+
+	case POLICY_ENTRY_ENABLE:
 	case POLICY_ENTRY_DISABLE:
-		handle_msg_policy_disable(event_info, &msg->policy_data[0]);
+		handle_msg_policy_records(event_info, msg);
+		break;
+
+	case POLICY_REPORT:
+		handle_msg_policy_report(event_info, &msg->report_param);
+		break;
+
+	case POLICY_STATS_LATENCY:
+		handle_msg_stats_latency(event_info, &msg->report_param);
 		break;
 
 	case POLICY_MAKE_IMMUTABLE:
@@ -77,7 +180,7 @@ void handle_msg_event(ikgt_event_info_t *event_info)
 #endif
 	}
 
-	ikgt_free(msg);
+	pool_free(POOL_POLICY_MESSAGE, msg);
 }
 
 #ifdef DEBUG
@@ -85,11 +188,15 @@ void handle_msg_debug(ikgt_event_info_t *event_info, debug_message_t *msg)
 {
 	memory_debug(msg->parameter);
 
+	pool_debug(msg->parameter);
+
 	cpu_debug(msg->parameter);
 
 	policy_debug(event_info, msg);
 
 	log_debug(msg->parameter);
+
+	cmd_ring_debug(msg->parameter);
 }
 #endif
 
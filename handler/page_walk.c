@@ -0,0 +1,126 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#include "handler.h"
+#include "utils.h"
+#include "page_walk.h"
+
+
+#define PW_ENTRY_PRESENT    0x1ULL
+#define PW_ENTRY_PAGE_SIZE  0x80ULL
+#define PW_ENTRY_ADDR_MASK  0x000FFFFFFFFFF000ULL
+#define PW_ENTRIES          512
+
+#define PW_CR4_LA57         (1ULL << 12)
+#define PW_EFER_LMA         (1ULL << 10)
+
+/* Function Name: page_walk_init
+* Purpose: prepare a walk of the guest page tables of the cpu of the event.
+*          Anything but 4-level paging is left to ikgt_gva_to_gpa().
+*
+* Input: walker, IKGT Event Info
+* Return value: none
+*/
+void page_walk_init(page_walk_t *walk, ikgt_event_info_t *event_info)
+{
+	const ikgt_vmcs_guest_state_reg_id_t reg_ids[3] = {
+		VMCS_GUEST_STATE_CR3, VMCS_GUEST_STATE_CR4, VMCS_GUEST_STATE_EFER
+	};
+	uint64_t values[3];
+	uint32_t level;
+
+	for (level = 0; level < PAGE_WALK_LEVELS; level++) {
+		walk->table_gpa[level] = 0;
+		walk->table_hva[level] = NULL;
+	}
+
+	walk->view_handle = event_info->view_handle;
+	walk->root_gpa = 0;
+
+	if (IKGT_STATUS_SUCCESS != read_guest_regs(event_info->thread_id, 3, reg_ids, values))
+		return;
+
+	if (!(values[2] & PW_EFER_LMA) || (values[1] & PW_CR4_LA57))
+		return;
+
+	walk->root_gpa = values[0] & PW_ENTRY_ADDR_MASK;
+}
+
+static uint64_t *page_walk_table(page_walk_t *walk, uint32_t level,
+								 uint64_t table_gpa)
+{
+	ikgt_gpa_to_hva_params_t gpa2hva;
+
+	if (walk->table_hva[level] && (walk->table_gpa[level] == table_gpa))
+		return walk->table_hva[level];
+
+	gpa2hva.view_handle = walk->view_handle;
+	gpa2hva.guest_physical_address = table_gpa;
+
+	if (IKGT_STATUS_SUCCESS != ikgt_gpa_to_hva(&gpa2hva))
+		return NULL;
+
+	walk->table_gpa[level] = table_gpa;
+	walk->table_hva[level] = (uint64_t *)(gpa2hva.host_virtual_address);
+
+	return walk->table_hva[level];
+}
+
+/* Function Name: page_walk_translate
+* Purpose: translate a guest virtual address
+*
+* Input: walker, gva
+* Output: gpa, size of the guest mapping (4K, 2M or 1G) containing gva
+* Return value: status
+*/
+ikgt_status_t page_walk_translate(page_walk_t *walk, uint64_t gva,
+								  uint64_t *gpa, uint64_t *page_size)
+{
+	uint64_t table_gpa = walk->root_gpa;
+	uint64_t *table, entry, size;
+	uint32_t level, shift;
+
+	if (0 == table_gpa) {
+		*page_size = PAGE_4KB;
+		return util_gva_to_gpa(gva, gpa);
+	}
+
+	for (level = 0; level < PAGE_WALK_LEVELS; level++) {
+		shift = 39 - 9 * level;
+
+		table = page_walk_table(walk, level, table_gpa);
+		if (NULL == table)
+			return IKGT_STATUS_ERROR;
+
+		entry = table[(gva >> shift) & (PW_ENTRIES - 1)];
+		if (!(entry & PW_ENTRY_PRESENT))
+			return IKGT_STATUS_ERROR;
+
+		/* a PDPT or PD entry may map a 1G or 2M page */
+		if ((PAGE_WALK_LEVELS - 1 == level)
+			|| ((level > 0) && (entry & PW_ENTRY_PAGE_SIZE))) {
+			size = 1ULL << shift;
+
+			*gpa = (entry & PW_ENTRY_ADDR_MASK & ~(size - 1)) | (gva & (size - 1));
+			*page_size = size;
+
+			return IKGT_STATUS_SUCCESS;
+		}
+
+		table_gpa = entry & PW_ENTRY_ADDR_MASK;
+	}
+
+	return IKGT_STATUS_ERROR;
+}
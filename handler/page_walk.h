@@ -0,0 +1,38 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+#ifndef _PAGE_WALK_H_
+#define _PAGE_WALK_H_
+
+#define PAGE_WALK_LEVELS 4
+
+/* Guest page table walker for translating a range of guest virtual
+* addresses. Tables of the last walk are remembered, consecutive pages cost
+* one entry read, and a large guest mapping is translated at once.
+*/
+typedef struct {
+	uint64_t view_handle;
+	uint64_t root_gpa; /* PML4, 0 if the walk is left to ikgt_gva_to_gpa() */
+	uint64_t table_gpa[PAGE_WALK_LEVELS];
+	uint64_t *table_hva[PAGE_WALK_LEVELS];
+} page_walk_t;
+
+void page_walk_init(page_walk_t *walk, ikgt_event_info_t *event_info);
+
+ikgt_status_t page_walk_translate(page_walk_t *walk, uint64_t gva,
+								  uint64_t *gpa, uint64_t *page_size);
+
+#endif /* _PAGE_WALK_H_ */
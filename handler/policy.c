@@ -18,12 +18,24 @@
 #include "handler.h"
 #include "utils.h"
 #include "policy.h"
+#include "epoch.h"
+#include "stats.h"
 
 
-static policy_table_t *g_policy_table;
+/* Policy currently seen by the exit path. It is never modified once
+* published: an update copies it, changes the copy and publishes the copy
+* with a single pointer store, and the old snapshot is freed by the epoch
+* code once no exit can be using it anymore.
+*/
+static policy_snapshot_t *g_policy_snapshot;
 static boolean_t g_policy_immutable = FALSE;
 
-static void policy_entry_add(policy_entry_t *entry);
+/* serializes policy updates, never taken on the exit path */
+static handler_lock_t g_policy_update_lock;
+
+static ikgt_status_t policy_entry_add(policy_snapshot_t *snap, policy_entry_t *entry);
+static policy_snapshot_t *policy_update_begin(void);
+static void policy_update_commit(policy_snapshot_t *snap);
 
 
 void add_default_policy(void)
@@ -38,39 +50,54 @@ void add_default_policy(void)
 	};
 
 	int i;
+	policy_snapshot_t *snap;
+
+	snap = policy_update_begin();
+	if (NULL == snap)
+		return;
 
 	for (i = 0; default_policy_table[i].resource_id != RESOURCE_ID_UNKNOWN; i++) {
-		policy_entry_add(&default_policy_table[i]);
+		policy_entry_add(snap, &default_policy_table[i]);
 	}
+
+	policy_update_commit(snap);
 }
 
 boolean_t policy_initialize(void)
 {
 	int i;
+	policy_snapshot_t *snap;
+	policy_table_t *table;
 
-	if (g_policy_table != NULL)
+	if (g_policy_snapshot != NULL)
 		return TRUE;
 
-	g_policy_table = (policy_table_t *) ikgt_malloc(sizeof(policy_table_t));
+	snap = (policy_snapshot_t *) ikgt_malloc(sizeof(policy_snapshot_t));
 
-	if (g_policy_table == NULL) {
-		ikgt_printf("Error, g_policy_table == NULL\n");
+	if (snap == NULL) {
+		ikgt_printf("Error, g_policy_snapshot == NULL\n");
 
 		return FALSE;
 	}
 
-	g_policy_table->version = POLICY_TABLE_VER;
-	g_policy_table->signature = POLICY_TABLE_SIGNATURE;
-	g_policy_table->num_entries = 0;
+	mon_memset(snap, 0, sizeof(policy_snapshot_t));
 
-	for (i = 0; i < POLICY_MAX_ENTRIES; i++) {
+	snap->generation = 1;
 
-		mon_memset(&g_policy_table->policy_entry[i], 0, sizeof(policy_entry_t));
+	table = &snap->table;
+	table->version = POLICY_TABLE_VER;
+	table->signature = POLICY_TABLE_SIGNATURE;
+	table->num_entries = 0;
 
+	for (i = 0; i < POLICY_MAX_ENTRIES; i++) {
 		/* mark as free */
-		POLICY_SET_RESOURCE_ID(&g_policy_table->policy_entry[i], RESOURCE_ID_UNKNOWN);
+		POLICY_SET_RESOURCE_ID(&table->policy_entry[i], RESOURCE_ID_UNKNOWN);
 	}
 
+	g_policy_snapshot = snap;
+
+	msr_policy_initialize();
+
 	/* add_default_policy(); */
 
 	return TRUE;
@@ -119,18 +146,183 @@ static const char *res_id_to_string(uint32_t id)
 		RES_ID_MAP_INIT(RESOURCE_ID_MSR_SYSENTER_ESP),
 		RES_ID_MAP_INIT(RESOURCE_ID_MSR_SYSENTER_EIP),
 		RES_ID_MAP_INIT(RESOURCE_ID_MSR_SYSENTER_PAT),
+
+		RES_ID_MAP_INIT(RESOURCE_ID_MEMORY),
 	};
 
-	if ((id >= RESOURCE_ID_START) && (id < RESOURCE_ID_END))
+	if ((id >= RESOURCE_ID_START) && (id < ARRAY_SIZE(res_id_str_array))
+		&& res_id_str_array[id])
 		return res_id_str_array[id];
 
 	return "";
 }
 #endif
 
-static void policy_entry_add(policy_entry_t *entry)
+/* bits of the control register covered by a CR entry. The mask sent with
+* the policy may cover several bits, otherwise the entry covers the bit
+* named by its resource id.
+*/
+static uint64_t policy_entry_cr_mask(policy_entry_t *entry)
+{
+	if (POLICY_INFO_GET_MASK(entry))
+		return POLICY_INFO_GET_MASK(entry);
+
+	if (IS_CR0_ENTRY(entry))
+		return cr0_res_id_to_mask(POLICY_GET_RESOURCE_ID(entry));
+
+	return cr4_res_id_to_mask(POLICY_GET_RESOURCE_ID(entry));
+}
+
+/* value a sticky entry forces onto its bits. For a single bit entry the
+* sticky value is 0 or 1, for a multi-bit entry it is the register value
+* to keep under the mask.
+*/
+static uint64_t policy_entry_cr_sticky_value(policy_entry_t *entry,
+											 uint64_t mask)
+{
+	if (0 == (mask & (mask - 1)))
+		return (POLICY_GET_STICKY_VALUE(entry) & 1) ? mask : 0;
+
+	return POLICY_GET_STICKY_VALUE(entry) & mask;
+}
+
+static void policy_cr_masks_add(policy_cr_masks_t *masks,
+								policy_entry_t *entry,
+								uint64_t mask)
+{
+	/* a later entry overrides an earlier one on overlapping bits */
+	masks->log_mask &= ~mask;
+	masks->skip_mask &= ~mask;
+	masks->sticky_mask &= ~mask;
+	masks->sticky_value &= ~mask;
+
+	masks->monitor_mask |= mask;
+
+	if (POLICY_ENTRY_W_HAS_LOG(entry))
+		masks->log_mask |= mask;
+
+	if (POLICY_ENTRY_HAS_STICKY(entry)) {
+		masks->sticky_mask |= mask;
+		masks->sticky_value |= policy_entry_cr_sticky_value(entry, mask);
+	} else if (POLICY_ENTRY_W_HAS_SKIP(entry)) {
+		masks->skip_mask |= mask;
+	}
+}
+
+/* rebuild the lookup tables of a snapshot from its policy table */
+static void policy_build_index(policy_snapshot_t *snap)
+{
+	int i;
+	uint32_t bit;
+	uint64_t mask;
+	policy_entry_t *entry;
+	policy_entry_t **bit_entry;
+	policy_cr_masks_t *masks;
+
+	mon_memset(snap->res_id_entry, 0, sizeof(snap->res_id_entry));
+	mon_memset(snap->cr0_bit_entry, 0, sizeof(snap->cr0_bit_entry));
+	mon_memset(snap->cr4_bit_entry, 0, sizeof(snap->cr4_bit_entry));
+	mon_memset(&snap->cr0_masks, 0, sizeof(snap->cr0_masks));
+	mon_memset(&snap->cr4_masks, 0, sizeof(snap->cr4_masks));
+
+	for (i = 0; i < POLICY_MAX_ENTRIES; i++) {
+		entry = &snap->table.policy_entry[i];
+
+		if (POLICY_GET_RESOURCE_ID(entry) >= RESOURCE_ID_END)
+			continue;
+
+		snap->res_id_entry[POLICY_GET_RESOURCE_ID(entry)] = entry;
+
+		if (IS_CR0_ENTRY(entry)) {
+			bit_entry = snap->cr0_bit_entry;
+			masks = &snap->cr0_masks;
+		} else if (IS_CR4_ENTRY(entry)) {
+			bit_entry = snap->cr4_bit_entry;
+			masks = &snap->cr4_masks;
+		} else {
+			continue;
+		}
+
+		mask = policy_entry_cr_mask(entry);
+
+		policy_cr_masks_add(masks, entry, mask);
+
+		for (bit = 0; bit < CR_BIT_MAX; bit++) {
+			if (mask & (1ULL << bit))
+				bit_entry[bit] = entry;
+		}
+	}
+}
+
+/* Function Name: policy_update_begin
+* Purpose: start a policy update by taking a private copy of the
+*          published snapshot. Updates are serialized until
+*          policy_update_commit() or policy_update_abort().
+*
+* Input: none
+* Return value: snapshot to modify, NULL on allocation failure
+*/
+static policy_snapshot_t *policy_update_begin(void)
+{
+	int i;
+	policy_snapshot_t *snap;
+	policy_table_t *cur;
+
+	handler_lock(&g_policy_update_lock);
+
+	snap = (policy_snapshot_t *) ikgt_malloc(sizeof(policy_snapshot_t));
+	if (NULL == snap) {
+		ikgt_printf("Error, unable to allocate policy snapshot\n");
+		handler_unlock(&g_policy_update_lock);
+		return NULL;
+	}
+
+	cur = &g_policy_snapshot->table;
+
+	snap->generation = g_policy_snapshot->generation + 1;
+
+	snap->table.version = cur->version;
+	snap->table.signature = cur->signature;
+	snap->table.num_entries = cur->num_entries;
+
+	for (i = 0; i < POLICY_MAX_ENTRIES; i++)
+		snap->table.policy_entry[i] = cur->policy_entry[i];
+
+	return snap;
+}
+
+/* Function Name: policy_update_commit
+* Purpose: publish an updated snapshot. Exits in flight keep using the
+*          previous one, which is freed after they are all done.
+*
+* Input: snapshot from policy_update_begin()
+* Return value: none
+*/
+static void policy_update_commit(policy_snapshot_t *snap)
+{
+	policy_snapshot_t *old = g_policy_snapshot;
+
+	policy_build_index(snap);
+
+	/* the snapshot must be complete before anyone can see it */
+	__atomic_store_n(&g_policy_snapshot, snap, __ATOMIC_RELEASE);
+
+	handler_unlock(&g_policy_update_lock);
+
+	epoch_retire(old, NULL);
+}
+
+static void policy_update_abort(policy_snapshot_t *snap)
+{
+	handler_unlock(&g_policy_update_lock);
+
+	ikgt_free((uint64_t *)snap);
+}
+
+static ikgt_status_t policy_entry_add(policy_snapshot_t *snap, policy_entry_t *entry)
 {
 	int i;
+	policy_table_t *table = &snap->table;
 
 #ifdef DEBUG
 	ikgt_printf("%s: res_id=%u (%s)\n",
@@ -153,59 +345,144 @@ static void policy_entry_add(policy_entry_t *entry)
 #endif
 
 	for (i = 0; i < POLICY_MAX_ENTRIES ; i++) {
-		if (POLICY_GET_RESOURCE_ID(&g_policy_table->policy_entry[i]) == POLICY_GET_RESOURCE_ID(entry)) {
+		if (POLICY_GET_RESOURCE_ID(&table->policy_entry[i]) == POLICY_GET_RESOURCE_ID(entry)) {
 			/* overwrite the existing entry */
-			g_policy_table->policy_entry[i] = *entry;
-			return;
+			table->policy_entry[i] = *entry;
+			stats_reset_access_count(POLICY_GET_RESOURCE_ID(entry));
+			return IKGT_STATUS_SUCCESS;
 		}
 	}
 
 	for (i = 0; i < POLICY_MAX_ENTRIES; i++) {
-		if (POLICY_GET_RESOURCE_ID(&g_policy_table->policy_entry[i]) == RESOURCE_ID_UNKNOWN) {
+		if (POLICY_GET_RESOURCE_ID(&table->policy_entry[i]) == RESOURCE_ID_UNKNOWN) {
 			/* found a free slot */
-			g_policy_table->policy_entry[i] = *entry;
-			g_policy_table->num_entries++;
-			return;
+			table->policy_entry[i] = *entry;
+			table->num_entries++;
+			stats_reset_access_count(POLICY_GET_RESOURCE_ID(entry));
+			return IKGT_STATUS_SUCCESS;
 		}
 	}
 
 	DPRINTF("Error, policy table is full, unable to add cpu policy entry!\n");
+
+	return IKGT_STATUS_ERROR;
 }
 
-static ikgt_status_t policy_monitor_cpu_events(policy_entry_t *entry,
-											   ikgt_cpu_reg_t reg,
-											   boolean_t enable)
+/* monitoring changes gathered over a policy update, so that entries on
+* the same register and cpus share one xmon call
+*/
+typedef struct {
+	ikgt_cpu_reg_t reg;
+	uint64_t cpu_bitmap[CPU_BITMAP_MAX];
+	uint64_t mask;
+} policy_cr_group_t;
+
+typedef struct {
+	boolean_t enable;
+	ikgt_status_t status; /* of calls made before the flush */
+	uint32_t num_cr_groups;
+	policy_cr_group_t cr_group[POLICY_MAX_ENTRIES];
+	uint32_t num_msrs;
+	uint32_t msr_ids[POLICY_MAX_ENTRIES];
+} policy_monitor_batch_t;
+
+static void policy_batch_add_cr(policy_monitor_batch_t *batch,
+								policy_entry_t *entry,
+								ikgt_cpu_reg_t reg)
 {
-	ikgt_status_t status;
+	policy_cr_group_t *group;
 	uint64_t cpu_bitmap[CPU_BITMAP_MAX];
+	uint32_t i;
 
-	cpu_bitmap[0] = POLICY_INFO_GET_CPU_MASK_1(entry);
-	cpu_bitmap[1] = POLICY_INFO_GET_CPU_MASK_2(entry);
+	for (i = 0; i < batch->num_cr_groups; i++) {
+		group = &batch->cr_group[i];
 
-	status = util_monitor_cpu_events(cpu_bitmap,
-		POLICY_INFO_GET_MASK(entry),
-		reg,
-		enable);
+		if ((group->reg == reg)
+			&& (group->cpu_bitmap[0] == POLICY_INFO_GET_CPU_MASK_1(entry))
+			&& (group->cpu_bitmap[1] == POLICY_INFO_GET_CPU_MASK_2(entry))) {
+			group->mask |= POLICY_INFO_GET_MASK(entry);
+			return;
+		}
+	}
 
-	DPRINTF("%s: status=%u, cpu0=%llx, cpu1=%llx, mask=%llx, enable=%u\n",
-		__func__, status,
-		POLICY_INFO_GET_CPU_MASK_1(entry), POLICY_INFO_GET_CPU_MASK_2(entry),
-		POLICY_INFO_GET_MASK(entry), enable
-		);
+	/* out of groups, only with records on many different cpu sets */
+	if (batch->num_cr_groups == POLICY_MAX_ENTRIES) {
+		cpu_bitmap[0] = POLICY_INFO_GET_CPU_MASK_1(entry);
+		cpu_bitmap[1] = POLICY_INFO_GET_CPU_MASK_2(entry);
 
-	return status;
+		if (IKGT_STATUS_SUCCESS != util_monitor_cpu_events(cpu_bitmap,
+			POLICY_INFO_GET_MASK(entry), reg, batch->enable))
+			batch->status = IKGT_STATUS_ERROR;
+
+		return;
+	}
+
+	group = &batch->cr_group[batch->num_cr_groups++];
+
+	group->reg = reg;
+	group->cpu_bitmap[0] = POLICY_INFO_GET_CPU_MASK_1(entry);
+	group->cpu_bitmap[1] = POLICY_INFO_GET_CPU_MASK_2(entry);
+	group->mask = POLICY_INFO_GET_MASK(entry);
 }
 
-static ikgt_status_t policy_monitor_msr(policy_entry_t *entry,
-										uint32_t msr_id,
-										boolean_t enable)
+static void policy_batch_add(policy_monitor_batch_t *batch,
+							 policy_entry_t *entry)
 {
-	ikgt_status_t status;
+	uint32_t msr_id, i;
+
+	if (IS_CR0_ENTRY(entry)) {
+		policy_batch_add_cr(batch, entry, IKGT_CPU_REG_CR0);
+	} else if (IS_CR4_ENTRY(entry)) {
+		policy_batch_add_cr(batch, entry, IKGT_CPU_REG_CR4);
+	} else {
+		msr_id = res_id_to_msr(POLICY_GET_RESOURCE_ID(entry));
+		if (msr_id == IA32_MSR_INVALID)
+			return;
+
+		for (i = 0; i < batch->num_msrs; i++) {
+			if (batch->msr_ids[i] == msr_id)
+				return;
+		}
+
+		batch->msr_ids[batch->num_msrs++] = msr_id;
+	}
+}
+
+/* Function Name: policy_batch_flush
+* Purpose: issue the monitoring changes of a batch, one xmon call per
+*          register and cpu set, and one for all MSRs
+*
+* Input: batch
+* Return value: status of the last failing call, success otherwise
+*/
+static ikgt_status_t policy_batch_flush(policy_monitor_batch_t *batch)
+{
+	ikgt_status_t status = batch->status;
+	ikgt_status_t ret;
+	policy_cr_group_t *group;
+	uint32_t i;
+
+	for (i = 0; i < batch->num_cr_groups; i++) {
+		group = &batch->cr_group[i];
+
+		ret = util_monitor_cpu_events(group->cpu_bitmap, group->mask,
+			group->reg, batch->enable);
+
+		DPRINTF("%s: status=%u, reg=%u, cpu0=%llx, cpu1=%llx, mask=%llx, enable=%u\n",
+			__func__, ret, group->reg, group->cpu_bitmap[0],
+			group->cpu_bitmap[1], group->mask, batch->enable);
+
+		if (IKGT_STATUS_SUCCESS != ret)
+			status = ret;
+	}
+
+	ret = util_monitor_msrs(batch->num_msrs, batch->msr_ids, batch->enable);
 
-	status = util_monitor_msr(msr_id, enable);
+	DPRINTF("%s: status=%d, num_msrs=%u, enable=%u\n",
+		__func__, ret, batch->num_msrs, batch->enable);
 
-	DPRINTF("%s: status=%d, msr_id=0x%x, enable=%u\n",
-		__func__, status, msr_id, enable);
+	if (IKGT_STATUS_SUCCESS != ret)
+		status = ret;
 
 	return status;
 }
@@ -228,25 +505,24 @@ static void policy_msg_to_entry(policy_update_rec_t *msg,
 	for (i = 0; i < POLICY_INFO_IDX_MAX; i++) {
 		policy_entry->resource_info[i] = msg->resource_info[i];
 	}
-
-	POLICY_ENTRY_INIT_ACCESS_COUNT(policy_entry);
 }
 
-static void policy_entry_del(policy_entry_t *entry)
+static void policy_entry_del(policy_snapshot_t *snap, policy_entry_t *entry)
 {
 	int i;
+	policy_table_t *table = &snap->table;
 
 	DPRINTF("%s (resource_id=%u)\n", __func__, entry->resource_id);
 
 	for (i = 0; i < POLICY_MAX_ENTRIES; i++) {
-		if (POLICY_GET_RESOURCE_ID(&g_policy_table->policy_entry[i]) == POLICY_GET_RESOURCE_ID(entry)) {
+		if (POLICY_GET_RESOURCE_ID(&table->policy_entry[i]) == POLICY_GET_RESOURCE_ID(entry)) {
 			/* mark as free */
-			POLICY_SET_RESOURCE_ID(&g_policy_table->policy_entry[i], RESOURCE_ID_UNKNOWN);
+			POLICY_SET_RESOURCE_ID(&table->policy_entry[i], RESOURCE_ID_UNKNOWN);
 
-			POLICY_ENTRY_INIT_ACCESS_COUNT(&g_policy_table->policy_entry[i]);
+			stats_reset_access_count(POLICY_GET_RESOURCE_ID(entry));
 
-			if (g_policy_table->num_entries)
-				g_policy_table->num_entries--;
+			if (table->num_entries)
+				table->num_entries--;
 
 			break;
 		}
@@ -258,88 +534,170 @@ static ikgt_status_t policy_sanity_check(policy_update_rec_t *msg)
 	return IKGT_STATUS_SUCCESS;
 }
 
-static ikgt_status_t policy_set_monitor(policy_entry_t *entry, boolean_t enable)
+/* Function Name: policy_msg_update
+* Purpose: add or remove policy records in a single snapshot update, and
+*          enable or disable their monitoring in a single batch. Monitoring
+*          is enabled once the entries are published, and disabled before
+*          they are removed.
+*
+* Input: policy records, number of records, TRUE to add, FALSE to remove
+* Output: POLICY_REC_* of each record that is not a memory range
+* Return value: status
+*/
+static ikgt_status_t policy_msg_update(policy_update_rec_t recs[],
+									   uint32_t count, boolean_t enable,
+									   uint32_t rec_status[])
 {
-	ikgt_status_t status = IKGT_STATUS_ERROR;
-	uint32_t  msr_id;
-
-	if (IS_CR0_ENTRY(entry)) {
-		status = policy_monitor_cpu_events(entry, IKGT_CPU_REG_CR0, enable);
-	} else if (IS_CR4_ENTRY(entry)) {
-		status = policy_monitor_cpu_events(entry, IKGT_CPU_REG_CR4, enable);
-	} else {
-		msr_id = res_id_to_msr(POLICY_GET_RESOURCE_ID(entry));
-		if (msr_id != IA32_MSR_INVALID)
-			status = policy_monitor_msr(entry, msr_id, enable);
+	policy_monitor_batch_t *batch;
+	policy_snapshot_t *snap;
+	policy_entry_t entry;
+	ikgt_status_t status = IKGT_STATUS_SUCCESS;
+	ikgt_status_t monitor_status = IKGT_STATUS_SUCCESS;
+	uint32_t i, applied = 0;
+
+	/* until applied */
+	for (i = 0; i < count; i++) {
+		if (RESOURCE_ID_MEMORY != recs[i].resource_id)
+			rec_status[i] = POLICY_REC_FAILED;
 	}
 
-	return status;
-}
+	if (g_policy_snapshot == NULL)
+		return IKGT_STATUS_ERROR;
 
-static ikgt_status_t policy_msg_add(policy_update_rec_t *msg)
-{
-	policy_entry_t entry;
+	batch = (policy_monitor_batch_t *) ikgt_malloc(sizeof(policy_monitor_batch_t));
+	if (NULL == batch)
+		return IKGT_ALLOCATE_FAILED;
 
-	ikgt_status_t status = IKGT_STATUS_ERROR;
+	mon_memset(batch, 0, sizeof(policy_monitor_batch_t));
+	batch->enable = enable;
+	batch->status = IKGT_STATUS_SUCCESS;
 
-	if (g_policy_table == NULL)
+	snap = policy_update_begin();
+	if (NULL == snap) {
+		ikgt_free((uint64_t *)batch);
 		return IKGT_STATUS_ERROR;
+	}
 
-	if (msg->resource_id == RESOURCE_ID_UNKNOWN)
-		return IKGT_STATUS_ERROR;
+	for (i = 0; i < count; i++) {
+		/* memory ranges are not table entries */
+		if (RESOURCE_ID_MEMORY == recs[i].resource_id)
+			continue;
 
-	policy_msg_to_entry(msg, &entry);
+		if ((recs[i].resource_id < RESOURCE_ID_START)
+			|| (recs[i].resource_id >= RESOURCE_ID_END)) {
+			status = IKGT_STATUS_ERROR;
+			continue;
+		}
 
-	policy_entry_add(&entry);
+		policy_msg_to_entry(&recs[i], &entry);
 
-	status = policy_set_monitor(&entry, TRUE);
+		if (enable) {
+			if (IKGT_STATUS_SUCCESS != policy_entry_add(snap, &entry)) {
+				status = IKGT_STATUS_ERROR;
+				continue;
+			}
+		} else {
+			policy_entry_del(snap, &entry);
+		}
 
-	return status;
-}
+		policy_batch_add(batch, &entry);
+		rec_status[i] = POLICY_REC_OK;
+		applied++;
+	}
 
-static ikgt_status_t policy_msg_del(policy_update_rec_t *msg)
-{
-	policy_entry_t entry;
-	uint32_t  msr_id;
-	ikgt_status_t status = IKGT_STATUS_ERROR;
+	if (0 == applied) {
+		policy_update_abort(snap);
+		ikgt_free((uint64_t *)batch);
+		return status;
+	}
 
-	if (g_policy_table == NULL)
-		return IKGT_STATUS_ERROR;
+	if (!enable && (IKGT_STATUS_SUCCESS != policy_batch_flush(batch)))
+		monitor_status = IKGT_STATUS_ERROR;
 
-	if (msg->resource_id == RESOURCE_ID_UNKNOWN)
-		return IKGT_STATUS_ERROR;
+	policy_update_commit(snap);
 
-	policy_msg_to_entry(msg, &entry);
+	if (enable && (IKGT_STATUS_SUCCESS != policy_batch_flush(batch)))
+		monitor_status = IKGT_STATUS_ERROR;
 
-	status = policy_set_monitor(&entry, FALSE);
+	ikgt_free((uint64_t *)batch);
 
-	policy_entry_del(&entry);
+	/* which of the records the failing call was for is not known */
+	if (IKGT_STATUS_SUCCESS != monitor_status) {
+		for (i = 0; i < count; i++) {
+			if (RESOURCE_ID_MEMORY != recs[i].resource_id)
+				rec_status[i] = POLICY_REC_FAILED;
+		}
+
+		status = monitor_status;
+	}
 
 	return status;
 }
 
-void handle_msg_policy_enable(ikgt_event_info_t *event_info, policy_update_rec_t *msg)
+/* Function Name: handle_msg_policy_update
+* Purpose: apply the records of a policy message. Memory ranges are
+*          applied one by one, everything else in a single update. A bad
+*          record fails on its own, the others are applied.
+*
+* Input: IKGT Event Info, records, number of records, TRUE to enable
+* Output: POLICY_REC_* of each record
+* Return value: none
+*/
+static void handle_msg_policy_update(ikgt_event_info_t *event_info,
+									 policy_update_rec_t recs[],
+									 uint32_t count, boolean_t enable,
+									 uint32_t rec_status[])
 {
-	if (g_policy_immutable)
+	uint32_t i, num_table = 0;
+	ikgt_status_t status;
+
+	for (i = 0; i < count; i++)
+		rec_status[i] = POLICY_REC_FAILED;
+
+	if (g_policy_immutable) {
+		ikgt_printf("Error, policy is immutable, %u records not applied\n", count);
 		return;
+	}
 
-	if (IKGT_STATUS_SUCCESS != policy_sanity_check(msg)) {
-		ikgt_printf("Error, policy_sanity_check() failed\n");
-	} else {
-		policy_msg_add(msg);
+	for (i = 0; i < count; i++) {
+		if (IKGT_STATUS_SUCCESS != policy_sanity_check(&recs[i])) {
+			ikgt_printf("Error, policy_sanity_check() failed, resource_id=%u\n",
+				POLICY_GET_RESOURCE_ID(&recs[i]));
+
+			/* left out of the update */
+			POLICY_SET_RESOURCE_ID(&recs[i], RESOURCE_ID_UNKNOWN);
+			continue;
+		}
+
+		if (RESOURCE_ID_MEMORY != POLICY_GET_RESOURCE_ID(&recs[i])) {
+			num_table++;
+			continue;
+		}
+
+		if (enable)
+			status = memory_policy_add(event_info, &recs[i]);
+		else
+			status = memory_policy_del(event_info, &recs[i]);
+
+		rec_status[i] = (IKGT_STATUS_SUCCESS == status) ? POLICY_REC_OK : POLICY_REC_FAILED;
 	}
+
+	if (num_table)
+		policy_msg_update(recs, count, enable, rec_status);
 }
 
-void handle_msg_policy_disable(ikgt_event_info_t *event_info, policy_update_rec_t *msg)
+void handle_msg_policy_enable(ikgt_event_info_t *event_info,
+							  policy_update_rec_t recs[], uint32_t count,
+							  uint32_t rec_status[])
 {
-	if (g_policy_immutable)
-		return;
+	handle_msg_policy_update(event_info, recs, count, TRUE, rec_status);
+}
 
-	if (IKGT_STATUS_SUCCESS != policy_sanity_check(msg)) {
-		ikgt_printf("Error, policy_sanity_check() failed\n");
-	} else {
-		policy_msg_del(msg);
-	}
+void handle_msg_policy_disable(ikgt_event_info_t *event_info,
+							   policy_update_rec_t recs[], uint32_t count,
+							   uint32_t rec_status[])
+{
+	handle_msg_policy_update(event_info, recs, count, FALSE, rec_status);
 }
 
 void handle_msg_policy_make_immutable(ikgt_event_info_t *event_info, policy_update_rec_t *msg)
@@ -352,9 +710,129 @@ void handle_msg_policy_make_immutable(ikgt_event_info_t *event_info, policy_upda
 	g_policy_immutable = TRUE;
 }
 
-policy_entry_t *policy_get_entry_by_index(int index)
+/* Function Name: handle_msg_policy_report
+* Purpose: write the policy in force, the access counts and the counters
+*          to the report buffer of the agent, mapped page by page
+*
+* Input: IKGT Event Info, report buffer message
+* Return value: none
+*/
+void handle_msg_policy_report(ikgt_event_info_t *event_info, report_message_t *msg)
+{
+	const policy_snapshot_t *snap = policy_get_snapshot();
+	const policy_entry_t *entry;
+	util_page_map_t *map;
+	report_header_t header;
+	report_entry_t out;
+	uint32_t i, j, max_entries, count = 0, total = 0;
+
+	if ((NULL == msg) || (NULL == msg->report_addr)
+		|| (msg->report_size < sizeof(report_header_t)))
+		return;
+
+	DPRINTF("%s: report_addr=%llx, size=%u\n",
+		__func__, msg->report_addr, msg->report_size);
+
+	map = util_map_gva_range(event_info, (uint64_t)msg->report_addr, msg->report_size);
+	if (NULL == map)
+		return;
+
+	max_entries = (msg->report_size - sizeof(report_header_t)) / sizeof(report_entry_t);
+
+	for (i = 0; i < POLICY_MAX_ENTRIES; i++) {
+		entry = &snap->table.policy_entry[i];
+		if (POLICY_GET_RESOURCE_ID(entry) == RESOURCE_ID_UNKNOWN)
+			continue;
+
+		total++;
+		if (count == max_entries)
+			continue;
+
+		mon_memset(&out, 0, sizeof(report_entry_t));
+
+		POLICY_SET_RESOURCE_ID(&out.rec, POLICY_GET_RESOURCE_ID(entry));
+		POLICY_SET_READ_ACTION(&out.rec, POLICY_GET_READ_ACTION(entry));
+		POLICY_SET_WRITE_ACTION(&out.rec, POLICY_GET_WRITE_ACTION(entry));
+		POLICY_SET_EXEC_ACTION(&out.rec, POLICY_GET_EXEC_ACTION(entry));
+		POLICY_SET_STICKY_VALUE(&out.rec, POLICY_GET_STICKY_VALUE(entry));
+
+		for (j = 0; j < POLICY_INFO_IDX_MAX; j++)
+			out.rec.resource_info[j] = entry->resource_info[j];
+
+		out.access_count = stats_sum_access_count(POLICY_GET_RESOURCE_ID(entry));
+
+		util_page_map_write(map, REPORT_SIZE(count), &out, sizeof(report_entry_t));
+		count++;
+	}
+
+	i = memory_policy_report(map, REPORT_SIZE(count), max_entries - count);
+	total += i;
+	count += min(i, max_entries - count);
+
+	mon_memset(&header, 0, sizeof(report_header_t));
+
+	for (i = 0; i < STATS_MAX; i++)
+		header.counter[i] = stats_sum(i);
+
+	header.signature = REPORT_SIGNATURE;
+	header.version = REPORT_VERSION;
+	header.flags = g_policy_immutable ? REPORT_FLAG_IMMUTABLE : 0;
+	header.entry_size = sizeof(report_entry_t);
+	header.num_entries = count;
+	header.total_entries = total;
+	header.num_counters = STATS_MAX;
+
+	/* the agent checks the signature before the rest of the header */
+	util_page_map_write(map, sizeof(uint32_t), (char *)&header + sizeof(uint32_t),
+		sizeof(report_header_t) - sizeof(uint32_t));
+	__asm__ __volatile__("" ::: "memory");
+	util_page_map_write(map, 0, &header.signature, sizeof(uint32_t));
+
+	ikgt_free((uint64_t *)map);
+}
+
+/* Function Name: policy_get_snapshot
+* Purpose: get the published policy. An exit handler loads it once and
+*          uses it until the exit is over, it stays valid until then.
+*
+* Input: none
+* Return value: current policy snapshot
+*/
+const policy_snapshot_t *policy_get_snapshot(void)
+{
+	/* a plain load on x86 */
+	return __atomic_load_n(&g_policy_snapshot, __ATOMIC_ACQUIRE);
+}
+
+policy_entry_t *policy_get_entry_by_res_id(const policy_snapshot_t *snap,
+											uint32_t resource_id)
+{
+	if (resource_id >= RESOURCE_ID_END)
+		return NULL;
+
+	return snap->res_id_entry[resource_id];
+}
+
+policy_entry_t *policy_get_cr0_entry_by_bit(const policy_snapshot_t *snap,
+											 uint32_t bit)
+{
+	return snap->cr0_bit_entry[bit];
+}
+
+policy_entry_t *policy_get_cr4_entry_by_bit(const policy_snapshot_t *snap,
+											 uint32_t bit)
+{
+	return snap->cr4_bit_entry[bit];
+}
+
+const policy_cr_masks_t *policy_get_cr0_masks(const policy_snapshot_t *snap)
+{
+	return &snap->cr0_masks;
+}
+
+const policy_cr_masks_t *policy_get_cr4_masks(const policy_snapshot_t *snap)
 {
-	return &g_policy_table->policy_entry[index];
+	return &snap->cr4_masks;
 }
 
 void policy_dump(uint64_t command_code)
@@ -364,13 +842,14 @@ void policy_dump(uint64_t command_code)
 	uint64_t reg_value;
 	ikgt_status_t status;
 	policy_entry_t *entry;
+	const policy_table_t *table = &policy_get_snapshot()->table;
 	int count;
 
 	ikgt_printf("%s:\n", __func__);
 
 	ikgt_printf("POLICY_MAX_ENTRIES=%u\n", POLICY_MAX_ENTRIES);
 
-	ikgt_printf("num_entries=%u\n", g_policy_table->num_entries);
+	ikgt_printf("num_entries=%u\n", table->num_entries);
 	ikgt_printf("sizeof(policy_update_rec_t)=%u\n", sizeof(policy_update_rec_t));
 	ikgt_printf("sizeof(policy_entry_t)=%u\n", sizeof(policy_entry_t));
 	ikgt_printf("sizeof(policy_table_t)=%u\n", sizeof(policy_table_t));
@@ -378,7 +857,7 @@ void policy_dump(uint64_t command_code)
 
 	count = 0;
 	for (i = 0; i < POLICY_MAX_ENTRIES; i++) {
-		entry = &g_policy_table->policy_entry[i];
+		entry = (policy_entry_t *)&table->policy_entry[i];
 		if (POLICY_GET_RESOURCE_ID(entry) == RESOURCE_ID_UNKNOWN)
 			continue;
 
@@ -388,7 +867,7 @@ void policy_dump(uint64_t command_code)
 		ikgt_printf("sticky_val=0x%llx\n", POLICY_GET_STICKY_VALUE(entry));
 		ikgt_printf("rwx=(0x%x, 0x%x, 0x%x)\n",
 			POLICY_GET_READ_ACTION(entry), POLICY_GET_WRITE_ACTION(entry), POLICY_GET_EXEC_ACTION(entry));
-		ikgt_printf("access_count=%u\n", POLICY_ENTRY_GET_ACCESS_COUNT(entry));
+		ikgt_printf("access_count=%llu\n", stats_sum_access_count(POLICY_GET_RESOURCE_ID(entry)));
 
 		for (j = 0; j < POLICY_INFO_IDX_MAX; j++) {
 			if (entry->resource_info[j]) {
@@ -18,16 +18,19 @@
 #define _POLICY_H_
 
 #include "policy_common.h"
+#include "utils.h"
 
 #define POLICY_TABLE_VER        0x1
 #define POLICY_TABLE_SIGNATURE  0x1689a569
 
 #define POLICY_MAX_ENTRIES (RESOURCE_ID_END - RESOURCE_ID_START)
 
+/* number of bit positions in a control register */
+#define CR_BIT_MAX 64
+
 typedef struct {
 	uint32_t	resource_id;
 	uint32_t	flags;
-	uint32_t	access_count;
 	uint32_t	r_action;
 	uint32_t	w_action;
 	uint32_t	x_action;
@@ -35,6 +38,17 @@ typedef struct {
 	uint64_t	resource_info[POLICY_INFO_IDX_MAX];
 } policy_entry_t;
 
+/* aggregate of all policy entries on one control register, so a CR write
+* is evaluated with a few bitwise operations however many bits are covered
+*/
+typedef struct {
+	uint64_t monitor_mask; /* bits covered by any entry */
+	uint64_t log_mask;
+	uint64_t skip_mask;
+	uint64_t sticky_mask;
+	uint64_t sticky_value; /* value forced onto sticky_mask bits */
+} policy_cr_masks_t;
+
 typedef struct _policy_table {
 	uint64_t        version;
 	uint64_t        signature;
@@ -42,6 +56,53 @@ typedef struct _policy_table {
 	policy_entry_t  policy_entry[POLICY_MAX_ENTRIES];
 } policy_table_t;
 
+/* Immutable view of the policy used by the exit path, see
+* policy_get_snapshot(). The lookup tables point into table.
+*/
+typedef struct _policy_snapshot {
+	uint64_t           generation; /* bumped by every update, never 0 */
+	policy_table_t     table;
+	policy_entry_t     *res_id_entry[RESOURCE_ID_END];
+	policy_entry_t     *cr0_bit_entry[CR_BIT_MAX];
+	policy_entry_t     *cr4_bit_entry[CR_BIT_MAX];
+	policy_cr_masks_t  cr0_masks;
+	policy_cr_masks_t  cr4_masks;
+} policy_snapshot_t;
+
+/* Last value of a control register known to the handler on a cpu. Only
+* the bits monitored under the snapshot generation it was taken with are
+* exact, the guest cannot change those without an exit. CR bits changed by
+* the hypervisor itself or by an INIT are not tracked, so the shadow only
+* tells whether a write changes a monitored bit. The policy itself is
+* always applied against the value read from the VMCS.
+*/
+typedef struct {
+	uint64_t value;
+	uint64_t generation; /* policy snapshot generation, 0 if unknown */
+} cr_shadow_t;
+
+static inline boolean_t cr_shadow_valid(const cr_shadow_t *shadow,
+										const policy_snapshot_t *snap)
+{
+	return (shadow && (shadow->generation == snap->generation)) ? TRUE : FALSE;
+}
+
+static inline void cr_shadow_set(cr_shadow_t *shadow,
+								 const policy_snapshot_t *snap,
+								 uint64_t value)
+{
+	if (shadow) {
+		shadow->value = value;
+		shadow->generation = snap->generation;
+	}
+}
+
+static inline void cr_shadow_invalidate(cr_shadow_t *shadow)
+{
+	if (shadow)
+		shadow->generation = 0;
+}
+
 #define IS_CR0_ENTRY(e) (((e)->resource_id >= RESOURCE_ID_CR0_PE) && ((e)->resource_id <= RESOURCE_ID_CR0_PG))
 #define IS_CR4_ENTRY(e) (((e)->resource_id >= RESOURCE_ID_CR4_VME) && ((e)->resource_id <= RESOURCE_ID_CR4_SMAP))
 
@@ -59,25 +120,43 @@ typedef struct _policy_table {
 #define POLICY_ENTRY_X_HAS_ALLOW(e) (0 == ((e)->x_action & POLICY_ACT_SKIP))
 #define POLICY_ENTRY_X_HAS_LOG(e) ((e)->x_action & POLICY_ACT_LOG)
 
-#define POLICY_ENTRY_INC_ACCESS_COUNT(e) ((e)->access_count++)
-#define POLICY_ENTRY_INIT_ACCESS_COUNT(e) ((e)->access_count = 0)
-#define POLICY_ENTRY_GET_ACCESS_COUNT(e) ((e)->access_count)
+void handle_msg_policy_enable(ikgt_event_info_t *event_info,
+							  policy_update_rec_t recs[], uint32_t count,
+							  uint32_t rec_status[]);
+void handle_msg_policy_disable(ikgt_event_info_t *event_info,
+							   policy_update_rec_t recs[], uint32_t count,
+							   uint32_t rec_status[]);
+ikgt_status_t memory_policy_add(ikgt_event_info_t *event_info, policy_update_rec_t *msg);
+ikgt_status_t memory_policy_del(ikgt_event_info_t *event_info, policy_update_rec_t *msg);
+uint32_t memory_policy_report(const util_page_map_t *map, uint64_t offset,
+							  uint32_t max_entries);
 
-void handle_msg_policy_enable(ikgt_event_info_t *event_info, policy_update_rec_t *msg);
-void handle_msg_policy_disable(ikgt_event_info_t *event_info, policy_update_rec_t *msg);
 void handle_msg_policy_make_immutable(ikgt_event_info_t *event_info, policy_update_rec_t *msg);
 
+void handle_msg_policy_report(ikgt_event_info_t *event_info, report_message_t *msg);
+
+cr_shadow_t *cpu_get_cr0_shadow(uint16_t cpu_id);
+cr_shadow_t *cpu_get_cr4_shadow(uint16_t cpu_id);
+
 void handle_cr0_event(ikgt_event_info_t *event_info);
 void handle_cr4_event(ikgt_event_info_t *event_info);
 void handle_msr_event(ikgt_event_info_t *event_info);
 
 boolean_t policy_initialize(void);
+void msr_policy_initialize(void);
 
 void policy_debug(ikgt_event_info_t *event_info, debug_message_t *msg);
 
 uint32_t res_id_to_msr(RESOURCE_ID resource_id);
-
-policy_entry_t *policy_get_entry_by_index(int index);
+uint64_t cr0_res_id_to_mask(RESOURCE_ID resource_id);
+uint64_t cr4_res_id_to_mask(RESOURCE_ID resource_id);
+
+const policy_snapshot_t *policy_get_snapshot(void);
+policy_entry_t *policy_get_entry_by_res_id(const policy_snapshot_t *snap, uint32_t resource_id);
+policy_entry_t *policy_get_cr0_entry_by_bit(const policy_snapshot_t *snap, uint32_t bit);
+policy_entry_t *policy_get_cr4_entry_by_bit(const policy_snapshot_t *snap, uint32_t bit);
+const policy_cr_masks_t *policy_get_cr0_masks(const policy_snapshot_t *snap);
+const policy_cr_masks_t *policy_get_cr4_masks(const policy_snapshot_t *snap);
 
 
 #endif /* _POLICY_H_ */
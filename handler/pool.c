@@ -0,0 +1,177 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#include "ikgt_handler_api.h"
+#include "handler.h"
+#include "pool.h"
+
+
+/* header in front of every object handed out by the pool */
+typedef struct _pool_obj_hdr {
+	struct _pool_obj_hdr *next;
+	uint64_t from_pool; /* FALSE if allocated from the heap on a miss */
+} pool_obj_hdr_t;
+
+typedef struct {
+	handler_lock_t lock;
+	uint32_t obj_size;
+	pool_obj_hdr_t *free_list;
+
+	uint64_t in_use;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t high_water;
+} CACHE_ALIGNED pool_t;
+
+static pool_t g_pools[POOL_TYPE_MAX];
+
+static const uint32_t g_pool_obj_size[POOL_TYPE_MAX] = {
+	[POOL_UPDATE_PAGE_PERMISSION] = sizeof(ikgt_update_page_permission_params_t),
+	[POOL_CPU_EVENT] = sizeof(ikgt_cpu_event_params_t),
+	[POOL_MONITOR_MSR] = sizeof(ikgt_monitor_msr_params_t),
+	[POOL_POLICY_MESSAGE] = sizeof(policy_message_t),
+};
+
+
+static pool_obj_hdr_t *pool_obj_new(pool_t *pool, boolean_t from_pool)
+{
+	pool_obj_hdr_t *hdr;
+
+	hdr = (pool_obj_hdr_t *)ikgt_malloc(sizeof(pool_obj_hdr_t) + pool->obj_size);
+	if (NULL == hdr)
+		return NULL;
+
+	hdr->next = NULL;
+	hdr->from_pool = from_pool;
+
+	return hdr;
+}
+
+/* Function Name: pool_initialize
+* Purpose: preallocate the free list of every pool type
+*
+* Input: num of cpus
+* Return value: TRUE=success, FALSE=failure
+*/
+boolean_t pool_initialize(uint16_t num_of_cpus)
+{
+	pool_t *pool;
+	pool_obj_hdr_t *hdr;
+	uint32_t type, i;
+
+	for (type = 0; type < POOL_TYPE_MAX; type++) {
+		pool = &g_pools[type];
+
+		pool->obj_size = g_pool_obj_size[type];
+
+		for (i = 0; i < num_of_cpus * POOL_OBJS_PER_CPU; i++) {
+			hdr = pool_obj_new(pool, TRUE);
+			if (NULL == hdr) {
+				ikgt_printf("Error, failed to preallocate pool %u\n", type);
+				return FALSE;
+			}
+
+			hdr->next = pool->free_list;
+			pool->free_list = hdr;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Function Name: pool_alloc
+* Purpose: take an object of the given type from its free list, falling
+*          back to the heap when the list is empty
+*
+* Input: pool type
+* Return value: object, NULL on failure. Contents are not initialized.
+*/
+void *pool_alloc(pool_type_t type)
+{
+	pool_t *pool;
+	pool_obj_hdr_t *hdr;
+
+	if (type >= POOL_TYPE_MAX)
+		return NULL;
+
+	pool = &g_pools[type];
+
+	handler_lock(&pool->lock);
+
+	hdr = pool->free_list;
+	if (hdr) {
+		pool->free_list = hdr->next;
+		pool->hits++;
+	} else {
+		pool->misses++;
+	}
+
+	pool->in_use++;
+	if (pool->in_use > pool->high_water)
+		pool->high_water = pool->in_use;
+
+	handler_unlock(&pool->lock);
+
+	if (NULL == hdr) {
+		hdr = pool_obj_new(pool, FALSE);
+		if (NULL == hdr) {
+			handler_lock(&pool->lock);
+			pool->in_use--;
+			handler_unlock(&pool->lock);
+			return NULL;
+		}
+	}
+
+	return hdr + 1;
+}
+
+void pool_free(pool_type_t type, void *obj)
+{
+	pool_t *pool;
+	pool_obj_hdr_t *hdr;
+
+	if ((NULL == obj) || (type >= POOL_TYPE_MAX))
+		return;
+
+	pool = &g_pools[type];
+	hdr = (pool_obj_hdr_t *)obj - 1;
+
+	handler_lock(&pool->lock);
+
+	pool->in_use--;
+
+	if (hdr->from_pool) {
+		hdr->next = pool->free_list;
+		pool->free_list = hdr;
+	}
+
+	handler_unlock(&pool->lock);
+
+	if (!hdr->from_pool)
+		ikgt_free((uint64_t *)hdr);
+}
+
+void pool_debug(uint64_t command_code)
+{
+	uint32_t type;
+
+	ikgt_printf("%s(%u)\n", __func__, command_code);
+
+	for (type = 0; type < POOL_TYPE_MAX; type++) {
+		ikgt_printf("pool[%u]: size=%u, in_use=%llu, hits=%llu, misses=%llu, high_water=%llu\n",
+			type, g_pools[type].obj_size, g_pools[type].in_use,
+			g_pools[type].hits, g_pools[type].misses, g_pools[type].high_water);
+	}
+}
@@ -0,0 +1,39 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+/* fixed size parameter blocks handed to the ikgt API */
+typedef enum {
+	POOL_UPDATE_PAGE_PERMISSION = 0,
+	POOL_CPU_EVENT,
+	POOL_MONITOR_MSR,
+	POOL_POLICY_MESSAGE,
+
+	POOL_TYPE_MAX /* last */
+} pool_type_t;
+
+/* objects preallocated per type for each cpu */
+#define POOL_OBJS_PER_CPU 2
+
+boolean_t pool_initialize(uint16_t num_of_cpus);
+
+void *pool_alloc(pool_type_t type);
+
+void pool_free(pool_type_t type, void *obj);
+
+#endif /* _POOL_H_ */
@@ -0,0 +1,358 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+#include "handler.h"
+#include "utils.h"
+#include "stats.h"
+#include "epoch.h"
+
+
+/* g_stats[num_of_cpus] points to the counters of each cpu, each cpu only
+* touches its own cache lines. They are in handler memory until the agent
+* registers the statistics page, then in that page.
+*/
+static stats_cpu_t **g_stats;
+static uint16_t g_stats_num_of_cpus;
+
+static uint64_t g_stats_gva;
+static uint32_t g_stats_size;
+static util_page_map_t *g_stats_map; /* kept while g_stats points into it */
+static handler_lock_t g_stats_lock; /* registration of the page */
+
+/* g_stats_latency[num_of_cpus], in handler memory only */
+static stats_latency_t *g_stats_latency;
+
+/* current reset generation of the access counts of each resource id,
+* only bumped on policy updates. The cpus compare it with the generation
+* of their own count, nobody writes another cpu's block.
+*/
+static uint32_t g_stats_access_gen[RESOURCE_ID_END];
+
+/* catch updates from an unexpected cpu id, never read */
+static stats_cpu_t g_stats_dummy;
+static stats_latency_t g_stats_latency_dummy;
+
+
+boolean_t stats_initialize(uint16_t num_of_cpus)
+{
+	stats_cpu_t *cpu_stats;
+	uint16_t i;
+
+	cpu_stats = util_alloc_percpu(num_of_cpus, sizeof(stats_cpu_t));
+	g_stats = (stats_cpu_t **)ikgt_malloc(num_of_cpus * sizeof(stats_cpu_t *));
+	if ((NULL == cpu_stats) || (NULL == g_stats)) {
+		ikgt_printf("[ERROR] HANDLER: Failed to allocate statistics\n");
+		return FALSE;
+	}
+
+	for (i = 0; i < num_of_cpus; i++)
+		g_stats[i] = &cpu_stats[i];
+
+	g_stats_latency = util_alloc_percpu(num_of_cpus, sizeof(stats_latency_t));
+	if (NULL == g_stats_latency) {
+		ikgt_printf("[ERROR] HANDLER: Failed to allocate latency histograms\n");
+		return FALSE;
+	}
+
+	g_stats_num_of_cpus = num_of_cpus;
+
+	return TRUE;
+}
+
+/* Function Name: stats_get_cpu
+* Purpose: get the counters of a cpu, to be updated by that cpu only
+*
+* Input: cpu id
+* Return value: per cpu counters, never NULL
+*/
+stats_cpu_t *stats_get_cpu(uint16_t cpu_id)
+{
+	if (cpu_id >= g_stats_num_of_cpus)
+		return &g_stats_dummy;
+
+	/* a plain load on x86 */
+	return __atomic_load_n(&g_stats, __ATOMIC_ACQUIRE)[cpu_id];
+}
+
+/* Function Name: stats_get_latency
+* Purpose: get the latency histograms of a cpu, to be updated by that cpu
+*          only
+*
+* Input: cpu id
+* Return value: per cpu histograms, never NULL
+*/
+stats_latency_t *stats_get_latency(uint16_t cpu_id)
+{
+	if (cpu_id >= g_stats_num_of_cpus)
+		return &g_stats_latency_dummy;
+
+	return &g_stats_latency[cpu_id];
+}
+
+/* Function Name: stats_sum
+* Purpose: add up a counter over all cpus. Concurrent updates may or may
+*          not be included.
+*
+* Input: counter id
+* Return value: total
+*/
+uint64_t stats_sum(stats_id_t id)
+{
+	uint64_t total = 0;
+	uint16_t i;
+
+	for (i = 0; i < g_stats_num_of_cpus; i++)
+		total += ((volatile stats_cpu_t *)g_stats[i])->count[id];
+
+	return total;
+}
+
+/* Function Name: stats_inc_access
+* Purpose: count a policy hit of a resource on the calling cpu, dropping
+*          the count of an older reset generation first
+*
+* Input: counters of the calling cpu, resource id
+* Return value: none
+*/
+void stats_inc_access(stats_cpu_t *stats, uint32_t resource_id)
+{
+	uint32_t gen;
+
+	if (resource_id >= RESOURCE_ID_END)
+		return;
+
+	gen = __atomic_load_n(&g_stats_access_gen[resource_id], __ATOMIC_RELAXED);
+	if (stats->access_gen[resource_id] != gen) {
+		stats->access_count[resource_id] = 0;
+		stats->access_gen[resource_id] = gen;
+	}
+
+	stats->access_count[resource_id]++;
+}
+
+uint64_t stats_sum_access_count(uint32_t resource_id)
+{
+	volatile stats_cpu_t *stats;
+	uint64_t total = 0;
+	uint32_t gen;
+	uint16_t i;
+
+	if (resource_id >= RESOURCE_ID_END)
+		return 0;
+
+	gen = __atomic_load_n(&g_stats_access_gen[resource_id], __ATOMIC_RELAXED);
+
+	/* counts of an older generation are reset on that cpu's next hit */
+	for (i = 0; i < g_stats_num_of_cpus; i++) {
+		stats = g_stats[i];
+		if (stats->access_gen[resource_id] == gen)
+			total += stats->access_count[resource_id];
+	}
+
+	return total;
+}
+
+/* called when a policy entry is added, overwritten or removed. A hit
+* racing with the reset may survive it, which is fine for statistics.
+*/
+void stats_reset_access_count(uint32_t resource_id)
+{
+	if (resource_id >= RESOURCE_ID_END)
+		return;
+
+	__atomic_add_fetch(&g_stats_access_gen[resource_id], 1, __ATOMIC_RELAXED);
+}
+
+static void stats_cpu_copy(stats_cpu_t *dest, volatile stats_cpu_t *src)
+{
+	int i;
+
+	for (i = 0; i < STATS_MAX; i++)
+		dest->count[i] = src->count[i];
+
+	for (i = 0; i < RESOURCE_ID_END; i++) {
+		dest->access_count[i] = src->access_count[i];
+		dest->access_gen[i] = src->access_gen[i];
+	}
+}
+
+/* Function Name: start_stats
+* Purpose: move the counters into the page registered by the agent, so it
+*          can read them without a hypercall. The page is mapped page by
+*          page. A page registered again, e.g. by a reloaded agent,
+*          replaces the previous one, which gets all permissions back.
+*          Updates racing with the move may be lost.
+*
+* Input: IKGT Event Info, statistics page message
+* Return value: status
+*/
+ikgt_status_t start_stats(ikgt_event_info_t *event_info, stats_message_t *msg)
+{
+	stats_page_header_t *header;
+	stats_cpu_t **cpu_stats, **old_stats;
+	util_page_map_t *map, *old_map;
+	uint64_t gva, old_gva;
+	uint32_t size, old_size;
+	uint16_t i;
+
+	if ((NULL == msg) || (NULL == msg->stats_addr))
+		return IKGT_STATUS_ERROR;
+
+	DPRINTF("%s: stats_addr=%llx, size=%u\n",
+		__func__, msg->stats_addr, msg->stats_size);
+
+	gva = (uint64_t)msg->stats_addr;
+	size = STATS_PAGE_SIZE(g_stats_num_of_cpus);
+
+	if ((gva & (PAGE_4KB - 1)) || (msg->stats_size < size)) {
+		ikgt_printf("Error, invalid stats page %llx, size=%u\n",
+			gva, msg->stats_size);
+		return IKGT_STATUS_ERROR;
+	}
+
+	map = util_map_gva_range(event_info, gva, size);
+	if (NULL == map)
+		return IKGT_STATUS_ERROR;
+
+	/* the agent only ever reads the page */
+	if (IKGT_STATUS_SUCCESS != util_monitor_memory(event_info, gva, size, PERMISSION_READ)) {
+		ikgt_free((uint64_t *)map);
+		return IKGT_STATUS_ERROR;
+	}
+
+	cpu_stats = (stats_cpu_t **)ikgt_malloc(g_stats_num_of_cpus * sizeof(stats_cpu_t *));
+	if (NULL == cpu_stats) {
+		util_monitor_memory(event_info, gva, size, PERMISSION_RWX);
+		ikgt_free((uint64_t *)map);
+		return IKGT_ALLOCATE_FAILED;
+	}
+
+	/* neither the header nor a stats_cpu_t crosses a page */
+	header = (stats_page_header_t *)util_page_map_ptr(map, 0);
+
+	handler_lock(&g_stats_lock);
+
+	/* carry over what was counted before, in handler memory or the
+	* previous page
+	*/
+	for (i = 0; i < g_stats_num_of_cpus; i++) {
+		cpu_stats[i] = (stats_cpu_t *)util_page_map_ptr(map, STATS_CPU_OFFSET(i));
+		stats_cpu_copy(cpu_stats[i], g_stats[i]);
+	}
+
+	header->version = STATS_PAGE_VERSION;
+	header->num_of_cpus = g_stats_num_of_cpus;
+	header->cpu_offset = STATS_CPU_OFFSET(0);
+	header->cpu_size = sizeof(stats_cpu_t);
+	header->num_counters = STATS_MAX;
+	header->num_resources = RESOURCE_ID_END;
+	header->cpus_per_page = STATS_CPUS_PER_PAGE;
+
+	/* the agent checks the signature before the rest of the header */
+	__asm__ __volatile__("" ::: "memory");
+	header->signature = STATS_PAGE_SIGNATURE;
+
+	old_stats = g_stats;
+	__atomic_store_n(&g_stats, cpu_stats, __ATOMIC_RELEASE);
+
+	old_map = g_stats_map;
+	old_gva = g_stats_gva;
+	old_size = g_stats_size;
+
+	g_stats_map = map;
+	g_stats_gva = gva;
+	g_stats_size = size;
+
+	handler_unlock(&g_stats_lock);
+
+	/* other cpus may still be looking up their counters in them */
+	epoch_retire(old_stats, NULL);
+	epoch_retire(old_map, NULL);
+
+	/* the pages may be shared with the new range */
+	if (old_gva) {
+		util_monitor_memory(event_info, old_gva, old_size, PERMISSION_RWX);
+		util_monitor_memory(event_info, gva, size, PERMISSION_READ);
+	}
+
+	return IKGT_STATUS_SUCCESS;
+}
+
+static void stats_map_write32(const util_page_map_t *map, uint64_t offset,
+							  uint32_t value)
+{
+	util_page_map_write(map, offset, &value, sizeof(uint32_t));
+}
+
+/* Function Name: handle_msg_stats_latency
+* Purpose: write the latency histograms, added up over all cpus, to the
+*          buffer of the agent. Concurrent updates may or may not be
+*          included.
+*
+* Input: IKGT Event Info, latency_report_t buffer message
+* Return value: none
+*/
+void handle_msg_stats_latency(ikgt_event_info_t *event_info, report_message_t *msg)
+{
+	util_page_map_t *map;
+	uint64_t total;
+	uint32_t event, phase, bucket, offset;
+	uint16_t i;
+
+	if ((NULL == msg) || (NULL == msg->report_addr)
+		|| (msg->report_size < sizeof(latency_report_t)))
+		return;
+
+	map = util_map_gva_range(event_info, (uint64_t)msg->report_addr,
+		sizeof(latency_report_t));
+	if (NULL == map)
+		return;
+
+	offset = __builtin_offsetof(latency_report_t, latency);
+
+	for (event = 0; event < STATS_EVENT_MAX; event++) {
+		for (phase = 0; phase < STATS_PHASE_MAX; phase++) {
+			for (bucket = 0; bucket < STATS_LATENCY_BUCKETS; bucket++) {
+				total = 0;
+				for (i = 0; i < g_stats_num_of_cpus; i++)
+					total += ((volatile stats_latency_t *)&g_stats_latency[i])
+						->latency[event][phase][bucket];
+
+				util_page_map_write(map, offset, &total, sizeof(uint64_t));
+				offset += sizeof(uint64_t);
+			}
+		}
+	}
+
+	/* the report is too large for the stack, the header is written field
+	* by field
+	*/
+	stats_map_write32(map, __builtin_offsetof(latency_report_t, version),
+		LATENCY_REPORT_VERSION);
+	stats_map_write32(map, __builtin_offsetof(latency_report_t, num_events),
+		STATS_EVENT_MAX);
+	stats_map_write32(map, __builtin_offsetof(latency_report_t, num_phases),
+		STATS_PHASE_MAX);
+	stats_map_write32(map, __builtin_offsetof(latency_report_t, num_buckets),
+		STATS_LATENCY_BUCKETS);
+	stats_map_write32(map, __builtin_offsetof(latency_report_t, reserved), 0);
+
+	/* the agent checks the signature before the rest */
+	__asm__ __volatile__("" ::: "memory");
+	stats_map_write32(map, __builtin_offsetof(latency_report_t, signature),
+		LATENCY_REPORT_SIGNATURE);
+
+	ikgt_free((uint64_t *)map);
+}
@@ -0,0 +1,90 @@
+/*******************************************************************************
+* Copyright (c) 2015 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+/* stats_id_t and stats_cpu_t are shared with the agent, see policy_common.h */
+
+/* exit latency histograms of one cpu, only written by that cpu. Not in
+* the statistics page, the agent gets them with POLICY_STATS_LATENCY.
+*/
+typedef struct {
+	uint64_t latency[STATS_EVENT_MAX][STATS_PHASE_MAX][STATS_LATENCY_BUCKETS];
+} CACHE_ALIGNED stats_latency_t;
+
+#define STATS_INC(s, id)        ((s)->count[id]++)
+#define STATS_ADD(s, id, n)     ((s)->count[id] += (n))
+#define STATS_INC_ACCESS(s, e)  stats_inc_access(s, POLICY_GET_RESOURCE_ID(e))
+
+/* not serializing, good enough for a histogram */
+static inline uint64_t stats_rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint32_t stats_latency_bucket(uint64_t cycles)
+{
+	uint32_t bucket;
+
+	if (0 == cycles)
+		return 0;
+
+	bucket = 63 - __builtin_clzll(cycles);
+
+	return min(bucket, STATS_LATENCY_BUCKETS - 1);
+}
+
+/* Function Name: stats_latency
+* Purpose: account the cycles since *tsc to a phase of an event and
+*          restart the measurement, so consecutive calls time consecutive
+*          phases of one exit
+*
+* Input: per cpu histograms, event type, phase, start of the phase
+* Return value: none
+*/
+static inline void stats_latency(stats_latency_t *latency, stats_event_t event,
+								 stats_phase_t phase, uint64_t *tsc)
+{
+	uint64_t now = stats_rdtsc();
+
+	latency->latency[event][phase][stats_latency_bucket(now - *tsc)]++;
+	*tsc = now;
+}
+
+boolean_t stats_initialize(uint16_t num_of_cpus);
+
+stats_cpu_t *stats_get_cpu(uint16_t cpu_id);
+
+stats_latency_t *stats_get_latency(uint16_t cpu_id);
+
+uint64_t stats_sum(stats_id_t id);
+
+void stats_inc_access(stats_cpu_t *stats, uint32_t resource_id);
+
+uint64_t stats_sum_access_count(uint32_t resource_id);
+
+void stats_reset_access_count(uint32_t resource_id);
+
+ikgt_status_t start_stats(ikgt_event_info_t *event_info, stats_message_t *msg);
+
+void handle_msg_stats_latency(ikgt_event_info_t *event_info, report_message_t *msg);
+
+#endif /* _STATS_H_ */
@@ -16,65 +16,143 @@
 #include "ikgt_handler_api.h"
 #include "handler.h"
 #include "utils.h"
+#include "pool.h"
+#include "page_walk.h"
+#include "stats.h"
 
 
-ikgt_status_t read_guest_reg(ikgt_vmcs_guest_state_reg_id_t reg_id, uint64_t *value)
+/* per cpu register request block, so that reading and writing guest
+* registers on the exit path never goes to the heap
+*/
+typedef struct {
+	ikgt_vmcs_guest_guest_register_t reg;
+} CACHE_ALIGNED guest_reg_buf_t;
+
+static guest_reg_buf_t *g_guest_reg_buf;
+static uint16_t g_num_of_cpus;
+
+
+/* Function Name: util_alloc_percpu
+* Purpose: allocate a zeroed array of num_of_cpus elements starting on a
+*          cache line boundary. Element types are expected to be declared
+*          CACHE_ALIGNED so that no two cpus share a cache line.
+*          The array lives as long as the handler and is never freed.
+*
+* Input: num of cpus, size of one element
+* Return value: array base, NULL on failure
+*/
+void *util_alloc_percpu(uint16_t num_of_cpus, uint32_t size)
 {
-	ikgt_vmcs_guest_guest_register_t *reg;
-	ikgt_status_t status;
+	uint64_t base;
+	uint32_t total;
 
-	*value = 0;
+	total = num_of_cpus * size + CACHE_LINE_SIZE;
 
-	reg = (ikgt_vmcs_guest_guest_register_t *)
-		ikgt_malloc(sizeof(ikgt_vmcs_guest_guest_register_t));
+	base = (uint64_t)ikgt_malloc(total);
+	if (0 == base)
+		return NULL;
 
-	if (NULL == reg) {
-		ikgt_printf("[ERROR] HANDLER: Failed to allocate memory in\
-					read_guest_reg()\n");
-		return IKGT_STATUS_ERROR;
+	mon_memset((void *)base, 0, total);
+
+	return (void *)ALIGN(base, CACHE_LINE_SIZE);
+}
+
+boolean_t utils_initialize(uint16_t num_of_cpus)
+{
+	g_guest_reg_buf = util_alloc_percpu(num_of_cpus, sizeof(guest_reg_buf_t));
+	if (NULL == g_guest_reg_buf) {
+		ikgt_printf("[ERROR] HANDLER: Failed to allocate guest register buffers\n");
+		return FALSE;
 	}
 
-	reg->size = sizeof(ikgt_vmcs_guest_guest_register_t);
-	reg->num = 1;
-	reg->reg_ids[0] = reg_id;
+	g_num_of_cpus = num_of_cpus;
 
-	status = ikgt_read_guest_registers(reg);
+	return TRUE;
+}
 
-	if (IKGT_STATUS_SUCCESS == status) {
-		*value = reg->reg_values[0];
-	}
+static ikgt_vmcs_guest_guest_register_t *get_cpu_reg_buf(uint16_t cpu_id,
+														 uint32_t num)
+{
+	ikgt_vmcs_guest_guest_register_t *reg;
 
-	ikgt_free((uint64_t *)reg);
+	if ((NULL == g_guest_reg_buf) || (cpu_id >= g_num_of_cpus))
+		return NULL;
 
-	return status;
+	reg = &g_guest_reg_buf[cpu_id].reg;
+
+	if ((0 == num) || (num > ARRAY_SIZE(reg->reg_ids)))
+		return NULL;
+
+	reg->size = sizeof(ikgt_vmcs_guest_guest_register_t);
+	reg->num = num;
+
+	return reg;
 }
 
-ikgt_status_t write_guest_reg(ikgt_vmcs_guest_state_reg_id_t reg_id, uint64_t value)
+/* Function Name: read_guest_regs
+* Purpose: read several guest registers with a single API call, using the
+*          preallocated request block of the calling cpu
+*
+* Input: cpu id, number of registers, register ids
+* Output: register values
+* Return value: IKGT_STATUS_SUCCESS on success
+*/
+ikgt_status_t read_guest_regs(uint16_t cpu_id, uint32_t num,
+							  const ikgt_vmcs_guest_state_reg_id_t reg_ids[],
+							  uint64_t values[])
 {
 	ikgt_vmcs_guest_guest_register_t *reg;
 	ikgt_status_t status;
+	uint32_t i;
 
-	reg = (ikgt_vmcs_guest_guest_register_t *)
-		ikgt_malloc(sizeof(ikgt_vmcs_guest_guest_register_t));
-
-	if (NULL == reg) {
-		ikgt_printf("[ERROR] HANDLER: Failed to allocate memory in\
-					read_guest_reg()\n");
+	reg = get_cpu_reg_buf(cpu_id, num);
+	if (NULL == reg)
 		return IKGT_STATUS_ERROR;
-	}
 
-	reg->size = sizeof(ikgt_vmcs_guest_guest_register_t);
-	reg->num = 1;
-	reg->reg_ids[0] = reg_id;
-	reg->reg_values[0] = value;
+	for (i = 0; i < num; i++)
+		reg->reg_ids[i] = reg_ids[i];
 
-	status = ikgt_write_guest_registers(reg);
+	status = ikgt_read_guest_registers(reg);
 
-	ikgt_free((uint64_t *)reg);
+	for (i = 0; i < num; i++)
+		values[i] = (IKGT_STATUS_SUCCESS == status) ? reg->reg_values[i] : 0;
 
 	return status;
 }
 
+ikgt_status_t write_guest_regs(uint16_t cpu_id, uint32_t num,
+							   const ikgt_vmcs_guest_state_reg_id_t reg_ids[],
+							   const uint64_t values[])
+{
+	ikgt_vmcs_guest_guest_register_t *reg;
+	uint32_t i;
+
+	reg = get_cpu_reg_buf(cpu_id, num);
+	if (NULL == reg)
+		return IKGT_STATUS_ERROR;
+
+	for (i = 0; i < num; i++) {
+		reg->reg_ids[i] = reg_ids[i];
+		reg->reg_values[i] = values[i];
+	}
+
+	return ikgt_write_guest_registers(reg);
+}
+
+ikgt_status_t read_guest_reg(uint16_t cpu_id,
+							 ikgt_vmcs_guest_state_reg_id_t reg_id,
+							 uint64_t *value)
+{
+	return read_guest_regs(cpu_id, 1, &reg_id, value);
+}
+
+ikgt_status_t write_guest_reg(uint16_t cpu_id,
+							  ikgt_vmcs_guest_state_reg_id_t reg_id,
+							  uint64_t value)
+{
+	return write_guest_regs(cpu_id, 1, &reg_id, &value);
+}
+
 static ikgt_vmcs_guest_state_reg_id_t g_cpu_reg_id_map_table[] = {
 	[IKGT_CPU_REG_RAX] = IA32_GP_RAX,
 	[IKGT_CPU_REG_RBX] = IA32_GP_RBX,
@@ -113,103 +191,353 @@ ikgt_status_t get_ikgt_vmcs_guest_reg_id(ikgt_cpu_reg_t event_reg_id,
 	return status;
 }
 
-ikgt_status_t util_monitor_memory(uint64_t start_addr, uint32_t size,
-								  uint32_t permission)
+/* Function Name: util_gva_to_gpa
+* Purpose: translate a guest virtual address in the current guest
+*          address space to a guest physical address
+*
+* Input: gva
+* Output: gpa
+* Return value: status
+*/
+ikgt_status_t util_gva_to_gpa(uint64_t gva, uint64_t *gpa)
 {
-	ikgt_update_page_permission_params_t *update_params = NULL;
-	ikgt_gva_to_gpa_params_t *gva2gpa = NULL;
-	ikgt_status_t status = IKGT_STATUS_ERROR;
-	uint32_t pages, idx;
+	ikgt_gva_to_gpa_params_t gva2gpa;
+	ikgt_status_t status;
 
-	/* make start_gva align to page boundary */
-	start_addr &= ~((uint64_t)PAGE_4KB - 1);
+	gva2gpa.guest_virtual_address = gva;
+	gva2gpa.size = sizeof(ikgt_gva_to_gpa_params_t);
+	gva2gpa.cr3 = 0;
 
-	/* how many pages */
-	pages = PAGE_ALIGN_4K(size) >> PAGE_SHIFT;
+	status = ikgt_gva_to_gpa(&gva2gpa);
+	if (IKGT_STATUS_SUCCESS != status)
+		return status;
 
-	DPRINTF("%s: start_addr=%llx, size=%u, pages=%u, permission=%u\n",
-		__func__, start_addr, size, pages, permission);
+	*gpa = gva2gpa.guest_physical_address;
 
-	if (pages > IKGT_ADDRINFO_MAX_COUNT) {
-		ikgt_printf("pages > IKGT_ADDRINFO_MAX_COUNT\n");
-		return IKGT_STATUS_ERROR;
+	return IKGT_STATUS_SUCCESS;
+}
+
+/* Function Name: util_gpa_to_hva
+* Purpose: translate a guest physical address to a host virtual address
+*          in the view of the event
+*
+* Input: IKGT Event Info, gpa
+* Output: hva
+* Return value: status
+*/
+ikgt_status_t util_gpa_to_hva(ikgt_event_info_t *event_info, uint64_t gpa,
+							  void **hva)
+{
+	ikgt_gpa_to_hva_params_t gpa2hva;
+	ikgt_status_t status;
+
+	gpa2hva.view_handle = event_info->view_handle;
+	gpa2hva.guest_physical_address = gpa;
+
+	status = ikgt_gpa_to_hva(&gpa2hva);
+	if (IKGT_STATUS_SUCCESS != status)
+		return status;
+
+	*hva = (void *)(gpa2hva.host_virtual_address);
+
+	return IKGT_STATUS_SUCCESS;
+}
+
+/* Function Name: util_gva_to_hva
+* Purpose: translate a guest virtual address of the agent to a host
+*          virtual address in the view of the event
+*
+* Input: IKGT Event Info, gva
+* Output: hva
+* Return value: status
+*/
+ikgt_status_t util_gva_to_hva(ikgt_event_info_t *event_info, uint64_t gva,
+							  void **hva)
+{
+	ikgt_status_t status;
+	uint64_t gpa;
+
+	status = util_gva_to_gpa(gva, &gpa);
+	if (IKGT_STATUS_SUCCESS != status)
+		return status;
+
+	return util_gpa_to_hva(event_info, gpa, hva);
+}
+
+/* Function Name: util_map_gva_range
+* Purpose: map a buffer of the agent a page at a time. The buffer is
+*          contiguous in the guest virtual address space, its pages need
+*          not be contiguous in the host.
+*
+* Input: IKGT Event Info, gva and size of the buffer
+* Return value: page map to release with ikgt_free(), NULL on failure
+*/
+util_page_map_t *util_map_gva_range(ikgt_event_info_t *event_info,
+									uint64_t gva, uint32_t size)
+{
+	util_page_map_t *map;
+	uint64_t offset = gva & (PAGE_4KB - 1);
+	uint64_t num_pages = (offset + size + PAGE_4KB - 1) >> PAGE_SHIFT;
+	uint32_t i;
+
+	if ((0 == size) || (num_pages > UTIL_MAP_MAX_PAGES))
+		return NULL;
+
+	map = (util_page_map_t *)ikgt_malloc(sizeof(util_page_map_t)
+		+ num_pages * sizeof(void *));
+	if (NULL == map)
+		return NULL;
+
+	map->offset = (uint32_t)offset;
+	map->size = size;
+	map->num_pages = (uint32_t)num_pages;
+
+	for (i = 0; i < map->num_pages; i++) {
+		if (IKGT_STATUS_SUCCESS != util_gva_to_hva(event_info,
+			(gva & ~(uint64_t)(PAGE_4KB - 1)) + (uint64_t)i * PAGE_4KB,
+			&map->hva[i])) {
+			ikgt_printf("Error, page %u of the buffer at %llx\n", i, gva);
+			ikgt_free((uint64_t *)map);
+			return NULL;
+		}
 	}
 
-	update_params = (ikgt_update_page_permission_params_t *)
-		ikgt_malloc(sizeof(ikgt_update_page_permission_params_t));
-	if (NULL == update_params) {
-		ikgt_printf("failed to allocate memory for update page\n");
-		status = IKGT_ALLOCATE_FAILED;
-		goto out;
+	return map;
+}
+
+/* Function Name: util_page_map_read
+* Purpose: copy out of a mapped buffer, across its pages
+*
+* Input: page map, offset in the buffer, destination, size
+* Return value: none
+*/
+void util_page_map_read(const util_page_map_t *map, uint64_t offset,
+						void *dst, uint32_t size)
+{
+	volatile const char *src;
+	char *out = (char *)dst;
+	uint32_t i, chunk;
+
+	while (size) {
+		src = (volatile const char *)util_page_map_ptr(map, offset);
+		chunk = PAGE_4KB - ((map->offset + offset) & (PAGE_4KB - 1));
+		if (chunk > size)
+			chunk = size;
+
+		for (i = 0; i < chunk; i++)
+			out[i] = src[i];
+
+		out += chunk;
+		offset += chunk;
+		size -= chunk;
 	}
+}
+
+/* Function Name: util_page_map_write
+* Purpose: copy into a mapped buffer, across its pages
+*
+* Input: page map, offset in the buffer, source, size
+* Return value: none
+*/
+void util_page_map_write(const util_page_map_t *map, uint64_t offset,
+						 const void *src, uint32_t size)
+{
+	volatile char *dst;
+	const char *in = (const char *)src;
+	uint32_t i, chunk;
+
+	while (size) {
+		dst = (volatile char *)util_page_map_ptr(map, offset);
+		chunk = PAGE_4KB - ((map->offset + offset) & (PAGE_4KB - 1));
+		if (chunk > size)
+			chunk = size;
+
+		for (i = 0; i < chunk; i++)
+			dst[i] = in[i];
+
+		in += chunk;
+		offset += chunk;
+		size -= chunk;
+	}
+}
+
+#define PAGE_2MB (1ULL << 21)
+#define PAGE_1GB (1ULL << 30)
+
+/* Function Name: util_count_large_frames
+* Purpose: count the 2M and 1G frames a physically contiguous run of pages
+*          with the same permission covers whole, and the ones it covers in
+*          part. 2M frames inside a whole 1G frame are not counted.
+*
+* Input: per cpu counters, gpa run
+* Return value: none
+*/
+static void util_count_large_frames(stats_cpu_t *stats, uint64_t start,
+									uint64_t end)
+{
+	uint64_t first, last, whole_1g, whole_2m;
+
+	if (end <= start)
+		return;
+
+	first = ALIGN(start, PAGE_1GB);
+	last = end & ~(PAGE_1GB - 1);
+	whole_1g = (last > first) ? (last - first) / PAGE_1GB : 0;
+
+	STATS_ADD(stats, STATS_EPT_1G_ALIGNED, whole_1g);
+	STATS_ADD(stats, STATS_EPT_1G_PARTIAL,
+		((end - 1) / PAGE_1GB) - (start / PAGE_1GB) + 1 - whole_1g);
 
-	gva2gpa = (ikgt_gva_to_gpa_params_t *)ikgt_malloc(sizeof(ikgt_gva_to_gpa_params_t));
-	if (gva2gpa == NULL) {
-		ikgt_printf("failed to allocate memory for gva2gpa\n");
-		status = IKGT_ALLOCATE_FAILED;
-		goto out;
+	first = ALIGN(start, PAGE_2MB);
+	last = end & ~(PAGE_2MB - 1);
+	whole_2m = (last > first) ? (last - first) / PAGE_2MB : 0;
+
+	STATS_ADD(stats, STATS_EPT_2M_ALIGNED, whole_2m - whole_1g * (PAGE_1GB / PAGE_2MB));
+	STATS_ADD(stats, STATS_EPT_2M_PARTIAL,
+		((end - 1) / PAGE_2MB) - (start / PAGE_2MB) + 1 - whole_2m);
+}
+
+/* Function Name: util_monitor_memory
+* Purpose: set the EPT permissions of the pages backing a guest virtual
+*          range. The range is translated in one walk of the guest page
+*          tables and sent in chunks of IKGT_ADDRINFO_MAX_COUNT pages
+*          through a single parameter block. Large frames kept whole or
+*          split by the update are counted in the stats.
+*
+* Input: IKGT Event Info, start gva, size in bytes, PERMISSION_* mask
+* Return value: status
+*/
+ikgt_status_t util_monitor_memory(ikgt_event_info_t *event_info,
+								  uint64_t start_addr, uint32_t size,
+								  uint32_t permission)
+{
+	ikgt_update_page_permission_params_t *update_params = NULL;
+	ikgt_addr_info_t *item;
+	page_walk_t walk;
+	uint64_t gva, end, gpa, page_size, mapping_end;
+	uint64_t run_start = 0, run_end = 0;
+	stats_cpu_t *stats;
+	ikgt_status_t status = IKGT_STATUS_SUCCESS;
+
+	/* make start_gva align to page boundary */
+	gva = start_addr & ~((uint64_t)PAGE_4KB - 1);
+	end = PAGE_ALIGN_4K(start_addr + size);
+
+	DPRINTF("%s: start_addr=%llx, size=%u, permission=%u\n",
+		__func__, start_addr, size, permission);
+
+	update_params = pool_alloc(POOL_UPDATE_PAGE_PERMISSION);
+	if (NULL == update_params) {
+		ikgt_printf("failed to allocate memory for update page\n");
+		return IKGT_ALLOCATE_FAILED;
 	}
-	mon_memset(update_params, 0, sizeof(ikgt_update_page_permission_params_t));
 
 	update_params->handle = 0;
-	update_params->addr_list.count = pages;
+	update_params->addr_list.count = 0;
 
-	gva2gpa->size = sizeof(ikgt_gva_to_gpa_params_t);
-	gva2gpa->cr3 = 0;
-	for (idx = 0; idx < pages; idx++) {
-		gva2gpa->guest_virtual_address = start_addr;
-		gva2gpa->guest_physical_address = start_addr;
+	page_walk_init(&walk, event_info);
 
-		status = ikgt_gva_to_gpa(gva2gpa);
+	stats = stats_get_cpu(event_info->thread_id);
+
+	while (gva < end) {
+		status = page_walk_translate(&walk, gva, &gpa, &page_size);
 		if (IKGT_STATUS_SUCCESS != status) {
 			ikgt_printf("failed to translate gva to gpa\n");
 			goto out;
 		}
 
-		update_params->addr_list.item[idx].perms.all_bits = permission;
-		update_params->addr_list.item[idx].gva = gva2gpa->guest_virtual_address;
-		update_params->addr_list.item[idx].gpa = gva2gpa->guest_physical_address;
+		/* the rest of the guest mapping needs no further translation */
+		mapping_end = min(end, (gva & ~(page_size - 1)) + page_size);
 
-		start_addr += PAGE_4KB;
-	}
+		if (gpa != run_end) {
+			util_count_large_frames(stats, run_start, run_end);
+			run_start = gpa;
+			run_end = gpa;
+		}
 
-	status = ikgt_update_page_permission(update_params);
+		run_end += mapping_end - gva;
 
-	if (IKGT_STATUS_SUCCESS != status) {
-			ikgt_printf("failed to call ikgt_update_page_permission!\n");
-			goto out;
-	}
+		for (; gva < mapping_end; gva += PAGE_4KB, gpa += PAGE_4KB) {
+			item = &update_params->addr_list.item[update_params->addr_list.count++];
 
-out:
-	if (gva2gpa) {
-		ikgt_free((uint64_t *)gva2gpa);
+			item->perms.all_bits = permission;
+			item->gva = gva;
+			item->gpa = gpa;
+
+			if (IKGT_ADDRINFO_MAX_COUNT == update_params->addr_list.count) {
+				status = ikgt_update_page_permission(update_params);
+				if (IKGT_STATUS_SUCCESS != status)
+					goto fail;
+
+				update_params->addr_list.count = 0;
+			}
+		}
 	}
 
-	if (update_params) {
-		ikgt_free((uint64_t *)update_params);
+	if (update_params->addr_list.count) {
+		status = ikgt_update_page_permission(update_params);
+		if (IKGT_STATUS_SUCCESS != status)
+			goto fail;
 	}
 
+	util_count_large_frames(stats, run_start, run_end);
+
+	goto out;
+
+fail:
+	ikgt_printf("failed to call ikgt_update_page_permission!\n");
+
+out:
+	pool_free(POOL_UPDATE_PAGE_PERMISSION, update_params);
+
 	return status;
 }
 
-#define IKGT_MEMORY_MAX_BLOCK_SIZE (IKGT_ADDRINFO_MAX_COUNT * PAGE_4KB)
-ikgt_status_t util_monitor_memory_ex(uint64_t start_addr, uint32_t size,
-									 uint32_t permission)
+/* Function Name: util_monitor_pages
+* Purpose: set the EPT permissions of a list of already translated pages,
+*          in chunks of IKGT_ADDRINFO_MAX_COUNT pages
+*
+* Input: gva and gpa of each page, number of pages, PERMISSION_* mask
+* Return value: status
+*/
+ikgt_status_t util_monitor_pages(const uint64_t gva[], const uint64_t gpa[],
+								 uint32_t num, uint32_t permission)
 {
-	ikgt_status_t status = IKGT_STATUS_ERROR;
+	ikgt_update_page_permission_params_t *update_params = NULL;
+	ikgt_addr_info_t *item;
+	ikgt_status_t status = IKGT_STATUS_SUCCESS;
+	uint32_t i;
 
-	while (size) {
-		uint32_t blksize = min(size, IKGT_MEMORY_MAX_BLOCK_SIZE);
+	update_params = pool_alloc(POOL_UPDATE_PAGE_PERMISSION);
+	if (NULL == update_params) {
+		ikgt_printf("failed to allocate memory for update page\n");
+		return IKGT_ALLOCATE_FAILED;
+	}
 
-		status = util_monitor_memory(start_addr, blksize, permission);
-		if (status != IKGT_STATUS_SUCCESS) {
-			break;
-		}
+	update_params->handle = 0;
+	update_params->addr_list.count = 0;
+
+	for (i = 0; i < num; i++) {
+		item = &update_params->addr_list.item[update_params->addr_list.count++];
+
+		item->perms.all_bits = permission;
+		item->gva = gva[i];
+		item->gpa = gpa[i];
+
+		if ((IKGT_ADDRINFO_MAX_COUNT == update_params->addr_list.count)
+			|| (i + 1 == num)) {
+			status = ikgt_update_page_permission(update_params);
+			if (IKGT_STATUS_SUCCESS != status) {
+				ikgt_printf("failed to call ikgt_update_page_permission!\n");
+				break;
+			}
 
-		start_addr += blksize;
-		size -= blksize;
+			update_params->addr_list.count = 0;
+		}
 	}
 
+	pool_free(POOL_UPDATE_PAGE_PERMISSION, update_params);
+
 	return status;
 }
 
@@ -222,7 +550,7 @@ ikgt_status_t util_monitor_cpu_events(uint64_t cpu_bitmap[],
 	ikgt_cpu_event_params_t *cpu_params;
 	int i;
 
-	cpu_params = (ikgt_cpu_event_params_t *)ikgt_malloc(sizeof(ikgt_cpu_event_params_t));
+	cpu_params = pool_alloc(POOL_CPU_EVENT);
 	if (NULL == cpu_params)
 		return IKGT_ALLOCATE_FAILED;
 
@@ -245,29 +573,53 @@ ikgt_status_t util_monitor_cpu_events(uint64_t cpu_bitmap[],
 
 	status = ikgt_monitor_cpu_events(cpu_params);
 
-	ikgt_free((uint64_t *)cpu_params);
+	pool_free(POOL_CPU_EVENT, cpu_params);
 
 	return status;
 }
 
-ikgt_status_t util_monitor_msr(uint32_t msr_id, boolean_t enable)
+/* Function Name: util_monitor_msrs
+* Purpose: enable or disable monitoring of writes to a set of MSRs, with
+*          as many ids per ikgt_monitor_msr_writes() call as it takes
+*
+* Input: number of MSRs, MSR ids, enable
+* Return value: status of the first failing call, success otherwise
+*/
+ikgt_status_t util_monitor_msrs(uint32_t num, const uint32_t msr_ids[],
+								boolean_t enable)
 {
-	ikgt_status_t status;
+	ikgt_status_t status = IKGT_STATUS_SUCCESS;
 	ikgt_monitor_msr_params_t *msr_params;
+	uint32_t i, j, n;
+
+	if (0 == num)
+		return IKGT_STATUS_SUCCESS;
 
-	msr_params = (ikgt_monitor_msr_params_t *)ikgt_malloc(sizeof(ikgt_monitor_msr_params_t));
+	msr_params = pool_alloc(POOL_MONITOR_MSR);
 	if (NULL == msr_params)
 		return IKGT_ALLOCATE_FAILED;
 
-	mon_memset(msr_params, 0, sizeof(ikgt_monitor_msr_params_t));
+	for (i = 0; i < num; i += n) {
+		n = min(num - i, ARRAY_SIZE(msr_params->msr_ids));
+
+		mon_memset(msr_params, 0, sizeof(ikgt_monitor_msr_params_t));
 
-	msr_params->enable = enable;
-	msr_params->num_ids = 1;
-	msr_params->msr_ids[0] = msr_id;
+		msr_params->enable = enable;
+		msr_params->num_ids = n;
+		for (j = 0; j < n; j++)
+			msr_params->msr_ids[j] = msr_ids[i + j];
 
-	status = ikgt_monitor_msr_writes(msr_params);
+		status = ikgt_monitor_msr_writes(msr_params);
+		if (IKGT_STATUS_SUCCESS != status)
+			break;
+	}
 
-	ikgt_free((uint64_t *)msr_params);
+	pool_free(POOL_MONITOR_MSR, msr_params);
 
 	return status;
 }
+
+ikgt_status_t util_monitor_msr(uint32_t msr_id, boolean_t enable)
+{
+	return util_monitor_msrs(1, &msr_id, enable);
+}
@@ -22,25 +22,81 @@
 #endif
 
 
-ikgt_status_t read_guest_reg(ikgt_vmcs_guest_state_reg_id_t reg_id,
+boolean_t utils_initialize(uint16_t num_of_cpus);
+
+void *util_alloc_percpu(uint16_t num_of_cpus, uint32_t size);
+
+ikgt_status_t read_guest_regs(uint16_t cpu_id, uint32_t num,
+							  const ikgt_vmcs_guest_state_reg_id_t reg_ids[],
+							  uint64_t values[]);
+
+ikgt_status_t write_guest_regs(uint16_t cpu_id, uint32_t num,
+							   const ikgt_vmcs_guest_state_reg_id_t reg_ids[],
+							   const uint64_t values[]);
+
+ikgt_status_t read_guest_reg(uint16_t cpu_id,
+							 ikgt_vmcs_guest_state_reg_id_t reg_id,
 							 uint64_t *value);
 
-ikgt_status_t write_guest_reg(ikgt_vmcs_guest_state_reg_id_t reg_id, uint64_t value);
+ikgt_status_t write_guest_reg(uint16_t cpu_id,
+							  ikgt_vmcs_guest_state_reg_id_t reg_id,
+							  uint64_t value);
+
+ikgt_status_t util_gva_to_gpa(uint64_t gva, uint64_t *gpa);
+
+ikgt_status_t util_gpa_to_hva(ikgt_event_info_t *event_info, uint64_t gpa,
+							  void **hva);
+
+ikgt_status_t util_gva_to_hva(ikgt_event_info_t *event_info, uint64_t gva,
+							  void **hva);
+
+/* limit of the pages of a buffer mapped with util_map_gva_range() */
+#define UTIL_MAP_MAX_PAGES (1 << 20)
+
+/* buffer of the agent mapped a page at a time */
+typedef struct {
+	uint32_t offset;    /* of the buffer in its first page */
+	uint32_t size;
+	uint32_t num_pages;
+	uint32_t reserved;
+	void *hva[];
+} util_page_map_t;
+
+/* hva of a byte of the buffer, the object there must not cross a page */
+static inline void *util_page_map_ptr(const util_page_map_t *map, uint64_t offset)
+{
+	offset += map->offset;
+
+	return (char *)map->hva[offset >> PAGE_SHIFT] + (offset & (PAGE_4KB - 1));
+}
+
+util_page_map_t *util_map_gva_range(ikgt_event_info_t *event_info,
+									uint64_t gva, uint32_t size);
+
+void util_page_map_read(const util_page_map_t *map, uint64_t offset,
+						void *dst, uint32_t size);
+
+void util_page_map_write(const util_page_map_t *map, uint64_t offset,
+						 const void *src, uint32_t size);
 
 ikgt_status_t get_ikgt_vmcs_guest_reg_id(ikgt_cpu_reg_t event_reg_id,
 										 ikgt_vmcs_guest_state_reg_id_t *vmcs_reg_id);
 
-ikgt_status_t util_monitor_memory(uint64_t start_addr, uint32_t size,
-									uint32_t permission);
+ikgt_status_t util_monitor_memory(ikgt_event_info_t *event_info,
+								  uint64_t start_addr, uint32_t size,
+								  uint32_t permission);
 
-ikgt_status_t util_monitor_memory_ex(uint64_t start_addr, uint32_t size,
-									uint32_t permission);
+ikgt_status_t util_monitor_pages(const uint64_t gva[], const uint64_t gpa[],
+								 uint32_t num, uint32_t permission);
 
 ikgt_status_t util_monitor_cpu_events(uint64_t cpu_bitmap[],
 									  uint64_t mask,
 									  ikgt_cpu_reg_t reg,
 									  boolean_t enable);
 
+ikgt_status_t util_monitor_msrs(uint32_t num, const uint32_t msr_ids[],
+								boolean_t enable);
+
 ikgt_status_t util_monitor_msr(uint32_t msr_id, boolean_t enable);
 
 #endif /* _UTILS_H */
@@ -21,6 +21,10 @@ import json
 #Strings from JSON file
 log_val = 'log.txt'
 
+#Driver files
+batch_val = 'batch'
+enable_val = 'enable'
+
 #Command strings
 echo_cmd = 'echo '
 touch_cmd = 'touch '
@@ -32,8 +36,15 @@ def execute_shell_command(command):
 		print "Shell command error: %s" % str(e)
 		sys.exit()
 
+def is_enabled():
+	if not os.path.exists(enable_val):
+		return False
+	with open(enable_val) as f:
+		return f.read().strip() == '1'
+
 def parse_and_create_dir_structure(policy_data):
-	for key, value in policy_data.iteritems():
+	#Write 'enable' last, it sends the settings of the entry to the handler
+	for key, value in sorted(policy_data.iteritems(), key=lambda kv: kv[0] == 'enable'):
 		try:
 			if isinstance(value, dict):
 				#Save cwd
@@ -45,8 +56,10 @@ def parse_and_create_dir_structure(policy_data):
 				#Change to this dir
 				os.chdir(key)
 
-				#Create sub directories
-				parse_and_create_dir_structure(value)
+				#Create sub directories, unless the driver restored the
+				#entry from the policy still in force in the handler
+				if not is_enabled():
+					parse_and_create_dir_structure(value)
 
 				#Change back to original dir
 				os.chdir(prev_dir)
@@ -97,7 +110,19 @@ def parse_policy():
 		if args.remove_dir:
 			parse_and_remove_dir_structure(policy_data)
 		else:
-			parse_and_create_dir_structure(policy_data)
+			#Send all entries to the handler in one go, if the driver can batch
+			batch = os.path.exists(batch_val)
+			if batch:
+				#An error may exit from a sub directory
+				batch_path = os.path.abspath(batch_val)
+				execute_shell_command(echo_cmd + "1 > " + batch_path)
+
+			try:
+				parse_and_create_dir_structure(policy_data)
+			finally:
+				#An open batch holds back every later configfs write
+				if batch:
+					execute_shell_command(echo_cmd + "0 > " + batch_path)
 
 		#Change back to original dir
 		os.chdir(prev_dir)